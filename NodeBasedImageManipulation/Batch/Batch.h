@@ -0,0 +1,64 @@
+#pragma once
+#include "graph.h"
+#include <filesystem>
+
+// Shared between the nbip-batch run modes
+
+struct BatchOptions
+{
+	string graphPath;
+	vector<string> inputs;
+	string outputDir;
+	string format;
+	int inputNode = -1;
+	int jobs = 0;
+	// Pipelined mode, 0 picks a count from the number of cores
+	bool pipeline = false;
+	int decoders = 0;
+	int encoders = 0;
+	int queueDepth = 4;
+	// Out of core images, see TiledImageStore. 0 keeps everything in memory.
+	double outOfCoreMegapixels = 0;
+	size_t residentMegabytes = 0;
+	string scratchDir;
+	// Print time and memory per node when done
+	bool profile = false;
+	// Chrome trace of the whole run, see Core/Trace.h
+	string tracePath;
+	// Evaluate the graph twice on the first image and fail if the second pass allocates
+	bool checkSteadyState = false;
+	// Keep processing the images written into this directory, see RunWatch
+	string watchDir;
+	// Leave outputs alone that already hold the same image, told by a sidecar hash file
+	bool skipUnchanged = false;
+};
+
+// One graph per compute thread, nodes keep their state between images so unchanged
+// parameters are not rebuilt for every file.
+struct BatchWorker
+{
+	Graph graph;
+	InputNode* input = nullptr;
+	vector<OutputNode*> outputs;
+	// Output formats as saved in the graph, parallel to outputs
+	vector<string> savedExts;
+};
+
+bool SetUpWorker(BatchWorker& worker, const BatchOptions& options, int tileThreads);
+// Image extensions the batch processor picks up from directories
+bool IsImageFile(const std::filesystem::path& path);
+// Runs the worker's graph on file and writes its outputs, false if anything failed.
+// ms is how long that took.
+bool ProcessImage(BatchWorker& worker, const BatchOptions& options, const string& file, double& ms);
+string OutputPath(const BatchOptions& options, const BatchWorker& worker, size_t outputIndex, const string& input);
+// Node statistics summed over the workers' copies of each node
+void PrintNodeStats(const vector<BatchWorker>& workers);
+// Exports the workers' Output nodes skipped as unchanged, see --skip-unchanged
+size_t CountSkippedExports(const vector<BatchWorker>& workers);
+
+// Decodes, evaluates and encodes on separate thread groups connected by bounded queues.
+// Returns the number of images that failed.
+int RunPipelined(const BatchOptions& options, const vector<string>& files);
+// Processes files, then every image closed after writing or moved into options.watchDir
+// until SIGINT or SIGTERM. Returns the number of images that failed.
+int RunWatch(const BatchOptions& options, const vector<string>& files);
@@ -0,0 +1,456 @@
+// nbip-batch: runs a saved node graph over many images without opening a window.
+//
+//   nbip-batch --graph edit.nbg --input "photos/*.jpg" --output-dir out [--format png] [--jobs 8]
+//
+// Every file matched by --input is bound in turn to the graph's first Input node (or the
+// one picked with --node) and each Output node writes <output-dir>/<input name>.<format>,
+// with "_<node id>" appended when the graph has more than one Output node.
+//
+// With --pipeline, decoding, graph evaluation and encoding run on separate groups of
+// threads so the three overlap across images, see BatchPipeline.cpp. With --watch it keeps
+// running and processes every image written into a directory, see BatchWatch.cpp.
+
+#include "Batch.h"
+#include "Core/ImageCache.h"
+#include "Core/TiledImageStore.h"
+#include "Core/Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    void PrintUsage()
+    {
+        cerr << "usage: nbip-batch --graph <file.nbg> --input <pattern|dir|@list> [--input ...]\n"
+                "                  --output-dir <dir> [--format png|jpg|bmp|qoi] [--node <input node id>]\n"
+                "                  [--jobs <n>] [--pipeline [--decoders <n>] [--encoders <n>] [--queue-depth <n>]]\n"
+                "                  [--out-of-core <megapixels> [--resident-mb <n>] [--scratch-dir <dir>]] [--profile]\n"
+                "                  [--trace <file.json>] [--check-steady-state] [--watch <dir>] [--skip-unchanged]\n"
+                "\n"
+                "  --input    a file, a directory (its images), a file name pattern using * and ?\n"
+                "             or @list, a text file naming one input per line\n"
+                "  --format   output format, defaults to the one saved in each Output node\n"
+                "  --jobs     images processed at the same time, defaults to the core count\n"
+                "             (with --pipeline: threads evaluating the graph)\n"
+                "  --pipeline decode, evaluate and encode on separate threads, overlapping images\n"
+                "  --decoders / --encoders  threads for the first / last pipeline stage\n"
+                "  --queue-depth  images waiting between two stages at most, default 4, minimum 2\n"
+                "  --out-of-core  keep images of at least this many megapixels in memory mapped\n"
+                "             scratch files instead of RAM, paging tiles in and out as needed\n"
+                "  --resident-mb  memory the paged tiles may use together, default 512\n"
+                "  --scratch-dir  where the scratch files go, default $NBIP_SCRATCH_DIR or /var/tmp\n"
+                "  --profile  print the time and memory each node took over the whole run\n"
+                "  --trace    write a Chrome trace of the run (chrome://tracing, ui.perfetto.dev)\n"
+                "  --check-steady-state  evaluate the first image a second time, unchanged, and exit\n"
+                "             with 3 if that allocates any memory\n"
+                "  --watch    after the --input images (which may be left out), keep running and process\n"
+                "             every image written or moved into dir until interrupted. --jobs\n"
+                "             defaults to 1 here, each image using every core.\n"
+                "  --skip-unchanged  keep a hash of every export in <output>.xxh64 and do not write\n"
+                "             outputs again that already hold the same image\n";
+    }
+
+    bool ParseArgs(int argc, char** argv, BatchOptions& options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            string arg = argv[i];
+            if (arg == "--help" || arg == "-h")
+                return false;
+            if (arg == "--pipeline" || arg == "--profile" || arg == "--check-steady-state" || arg == "--skip-unchanged")
+            {
+                (arg == "--pipeline" ? options.pipeline : arg == "--profile" ? options.profile
+                    : arg == "--skip-unchanged" ? options.skipUnchanged : options.checkSteadyState) = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+            {
+                cerr << "Missing value for " << arg << endl;
+                return false;
+            }
+            string value = argv[++i];
+            if (arg == "--graph")
+                options.graphPath = value;
+            else if (arg == "--input")
+                options.inputs.push_back(value);
+            else if (arg == "--output-dir")
+                options.outputDir = value;
+            else if (arg == "--format")
+                options.format = value[0] == '.' ? value : "." + value;
+            else if (arg == "--node")
+                options.inputNode = atoi(value.c_str());
+            else if (arg == "--jobs")
+                options.jobs = atoi(value.c_str());
+            else if (arg == "--decoders")
+                options.decoders = atoi(value.c_str());
+            else if (arg == "--encoders")
+                options.encoders = atoi(value.c_str());
+            else if (arg == "--queue-depth")
+                options.queueDepth = std::max(2, atoi(value.c_str()));
+            else if (arg == "--out-of-core")
+                options.outOfCoreMegapixels = atof(value.c_str());
+            else if (arg == "--resident-mb")
+                options.residentMegabytes = (size_t)std::max(1, atoi(value.c_str()));
+            else if (arg == "--scratch-dir")
+                options.scratchDir = value;
+            else if (arg == "--trace")
+                options.tracePath = value;
+            else if (arg == "--watch")
+                options.watchDir = value;
+            else
+            {
+                cerr << "Unknown option " << arg << endl;
+                return false;
+            }
+        }
+
+        if (options.format != "" && options.format != ".png" && options.format != ".jpg" && options.format != ".bmp"
+            && options.format != ".qoi")
+        {
+            cerr << "Unsupported format " << options.format << endl;
+            return false;
+        }
+        if (options.pipeline && !options.watchDir.empty())
+        {
+            cerr << "--pipeline and --watch cannot be combined" << endl;
+            return false;
+        }
+        return !options.graphPath.empty() && (!options.inputs.empty() || !options.watchDir.empty()) && !options.outputDir.empty();
+    }
+
+    bool WildcardMatch(const char* pattern, const char* name)
+    {
+        if (*pattern == '\0')
+            return *name == '\0';
+        if (*pattern == '*')
+            return WildcardMatch(pattern + 1, name) || (*name != '\0' && WildcardMatch(pattern, name + 1));
+        if (*name != '\0' && (*pattern == '?' || *pattern == *name))
+            return WildcardMatch(pattern + 1, name + 1);
+        return false;
+    }
+
+    // Expands one --input argument. Patterns are only allowed in the file name part.
+    void ExpandInput(const string& input, vector<string>& files)
+    {
+        if (input[0] == '@')
+        {
+            std::ifstream list(input.substr(1));
+            if (!list)
+                cerr << "Cannot read list " << input.substr(1) << endl;
+            string line;
+            while (getline(list, line))
+            {
+                if (!line.empty() && line.back() == '\r')
+                    line.pop_back();
+                if (!line.empty())
+                    files.push_back(line);
+            }
+            return;
+        }
+
+        std::error_code error;
+        fs::path path(input);
+        if (fs::is_directory(path, error))
+        {
+            vector<string> found;
+            for (const fs::directory_entry& entry : fs::directory_iterator(path, error))
+                if (entry.is_regular_file(error) && IsImageFile(entry.path()))
+                    found.push_back(entry.path().string());
+            std::sort(found.begin(), found.end());
+            files.insert(files.end(), found.begin(), found.end());
+            return;
+        }
+
+        string pattern = path.filename().string();
+        if (pattern.find_first_of("*?") == string::npos)
+        {
+            files.push_back(input);
+            return;
+        }
+
+        fs::path dir = path.has_parent_path() ? path.parent_path() : fs::path(".");
+        vector<string> found;
+        for (const fs::directory_entry& entry : fs::directory_iterator(dir, error))
+            if (entry.is_regular_file(error) && WildcardMatch(pattern.c_str(), entry.path().filename().string().c_str()))
+                found.push_back(entry.path().string());
+        if (found.empty())
+            cerr << "No files match " << input << endl;
+        std::sort(found.begin(), found.end());
+        files.insert(files.end(), found.begin(), found.end());
+    }
+
+    int RunSequential(const BatchOptions& options, const vector<string>& files)
+    {
+        int cores = std::max(1, (int)std::thread::hardware_concurrency());
+        int jobs = options.jobs > 0 ? options.jobs : cores;
+        jobs = std::min(jobs, (int)files.size());
+        // Cores left over when there are fewer images than cores go to the tiles of each image
+        int tileThreads = std::max(1, cores / jobs);
+
+        vector<BatchWorker> workers(jobs);
+        for (BatchWorker& worker : workers)
+        {
+            if (!SetUpWorker(worker, options, tileThreads))
+                return -1;
+        }
+
+        std::atomic<int> next{ 0 };
+        std::atomic<int> failed{ 0 };
+        std::mutex logMutex;
+
+        auto run = [&](BatchWorker& worker) {
+            Trace::SetThreadName("job " + to_string(&worker - workers.data() + 1));
+            for (int i = next++; i < (int)files.size(); i = next++)
+            {
+                const string& file = files[i];
+                double ms = 0;
+                bool ok = ProcessImage(worker, options, file, ms);
+                if (!ok)
+                    failed++;
+
+                std::lock_guard<std::mutex> lock(logMutex);
+                if (ok)
+                    cout << "[" << i + 1 << "/" << files.size() << "] " << file << " (" << (int)ms << " ms)" << endl;
+                else
+                    cerr << "[" << i + 1 << "/" << files.size() << "] " << file << " failed" << endl;
+            }
+        };
+
+        vector<std::thread> threads;
+        for (int w = 1; w < jobs; ++w)
+            threads.emplace_back(run, std::ref(workers[w]));
+        run(workers[0]);
+        for (std::thread& t : threads)
+            t.join();
+
+        if (size_t skipped = CountSkippedExports(workers))
+            cout << skipped << " outputs were unchanged and not written again" << endl;
+        if (options.profile)
+            PrintNodeStats(workers);
+        return failed;
+    }
+
+    // Buffers get their size on the first evaluation, after that re-running the graph on
+    // the same image should not touch the heap at all
+    bool CheckSteadyState(const BatchOptions& options, const vector<string>& files)
+    {
+        BatchWorker worker;
+        if (!SetUpWorker(worker, options, 0))
+            return false;
+        for (OutputNode* output : worker.outputs)
+            output->SetSavePath("");
+
+        for (const string& file : files)
+        {
+            worker.input->SetFilePath(file);
+            worker.graph.Evaluate();
+            if (worker.input->GetLoadedPath() != file)
+                continue;
+
+            AllocationCounts counts = worker.graph.CheckSteadyState();
+            cout << "Steady state check on " << file << ": " << counts.allocations << " allocations, "
+                 << counts.bytes << " bytes" << endl;
+            for (Node* node : worker.graph.nodes)
+            {
+                if (node->stats.heap.allocations)
+                    cout << "  " << node->GetName() << " " << node->id << ": " << node->stats.heap.allocations
+                         << " allocations, " << node->stats.heap.bytes << " bytes" << endl;
+            }
+            return counts.allocations == 0;
+        }
+        cerr << "Steady state check: no image could be loaded" << endl;
+        return false;
+    }
+}
+
+bool IsImageFile(const fs::path& path)
+{
+    string ext = path.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)tolower(c); });
+    return ext == ".png" || ext == ".jpg" || ext == ".jpeg" || ext == ".bmp" || ext == ".tga" || ext == ".qoi";
+}
+
+bool ProcessImage(BatchWorker& worker, const BatchOptions& options, const string& file, double& ms)
+{
+    TraceScope trace("batch", "Image", -1, file.c_str());
+    // The same path again is a changed file, it has to be decoded again
+    worker.input->SetFilePath(file);
+    worker.input->Reload();
+    for (size_t o = 0; o < worker.outputs.size(); ++o)
+        worker.outputs[o]->SetSavePath(OutputPath(options, worker, o, file));
+
+    auto fileStart = std::chrono::steady_clock::now();
+    worker.graph.Evaluate();
+    ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - fileStart).count();
+
+    bool ok = worker.input->GetLoadedPath() == file;
+    for (size_t o = 0; o < worker.outputs.size(); ++o)
+        ok = ok && worker.outputs[o]->GetLastExport() == OutputPath(options, worker, o, file);
+    return ok;
+}
+
+size_t CountSkippedExports(const vector<BatchWorker>& workers)
+{
+    size_t skipped = 0;
+    for (const BatchWorker& worker : workers)
+        for (OutputNode* output : worker.outputs)
+            skipped += output->GetSkippedExports();
+    return skipped;
+}
+
+void PrintNodeStats(const vector<BatchWorker>& workers)
+{
+    if (workers.empty())
+        return;
+    printf("%-24s %6s %10s %10s %10s %10s %10s %10s\n", "Node", "Evals", "Wall ms", "CPU ms", "Alloc MB", "Read MB", "Write MB",
+        "Heap allocs");
+    for (Node* node : workers[0].graph.nodes)
+    {
+        NodeStats sum;
+        for (const BatchWorker& worker : workers)
+        {
+            auto copy = std::find_if(worker.graph.nodes.begin(), worker.graph.nodes.end(),
+                [node](const Node* n) { return n->id == node->id; });
+            if (copy == worker.graph.nodes.end())
+                continue;
+            const NodeStats& s = (*copy)->stats;
+            sum.evaluations += s.evaluations;
+            sum.totalWallMs += s.totalWallMs;
+            sum.totalCpuMs += s.totalCpuMs;
+            sum.totalBytesAllocated += s.totalBytesAllocated;
+            sum.totalBytesRead += s.totalBytesRead;
+            sum.totalBytesWritten += s.totalBytesWritten;
+            sum.totalHeap += s.totalHeap;
+        }
+        string name = node->GetName() + " " + to_string(node->id);
+        printf("%-24s %6d %10.1f %10.1f %10.1f %10.1f %10.1f %10zu\n", name.c_str(), sum.evaluations, sum.totalWallMs,
+            sum.totalCpuMs, sum.totalBytesAllocated / 1048576.0, sum.totalBytesRead / 1048576.0, sum.totalBytesWritten / 1048576.0,
+            sum.totalHeap.allocations);
+    }
+    fflush(stdout);
+}
+
+bool SetUpWorker(BatchWorker& worker, const BatchOptions& options, int tileThreads)
+{
+    if (!worker.graph.Load(options.graphPath))
+        return false;
+
+    worker.graph.SetProxyMode(ProxyMode::Off);
+    worker.graph.SetTiledEvaluation(true, 256, tileThreads);
+    if (options.outOfCoreMegapixels > 0)
+        worker.graph.SetOutOfCore(std::max<size_t>(1, (size_t)(options.outOfCoreMegapixels * 1e6)));
+
+    for (Node* node : worker.graph.nodes)
+    {
+        if (node->type == NodeType::Input && !worker.input && (options.inputNode < 0 || (int)node->id == options.inputNode))
+            worker.input = static_cast<InputNode*>(node);
+        if (node->type == NodeType::Output)
+        {
+            OutputNode* output = static_cast<OutputNode*>(node);
+            output->SetUseSidecar(options.skipUnchanged);
+            worker.outputs.push_back(output);
+            worker.savedExts.push_back(output->GetSaveExt());
+        }
+    }
+
+    if (!worker.input)
+    {
+        cerr << (options.inputNode < 0 ? string("The graph has no Input node") : "No Input node with id " + to_string(options.inputNode)) << endl;
+        return false;
+    }
+    if (worker.outputs.empty())
+    {
+        cerr << "The graph has no Output node" << endl;
+        return false;
+    }
+    return true;
+}
+
+string OutputPath(const BatchOptions& options, const BatchWorker& worker, size_t outputIndex, const string& input)
+{
+    string ext = options.format;
+    if (ext.empty())
+        ext = worker.savedExts[outputIndex].empty() ? ".png" : worker.savedExts[outputIndex];
+
+    string name = fs::path(input).stem().string();
+    if (worker.outputs.size() > 1)
+        name += "_" + to_string(worker.outputs[outputIndex]->id);
+    return (fs::path(options.outputDir) / (name + ext)).string();
+}
+
+int main(int argc, char** argv)
+{
+    BatchOptions options;
+    if (!ParseArgs(argc, argv, options))
+    {
+        PrintUsage();
+        return 2;
+    }
+
+    vector<string> files;
+    for (const string& input : options.inputs)
+        ExpandInput(input, files);
+    if (files.empty() && options.watchDir.empty())
+    {
+        cerr << "Nothing to process" << endl;
+        return 2;
+    }
+
+    std::error_code error;
+    fs::create_directories(options.outputDir, error);
+    if (!fs::is_directory(options.outputDir, error))
+    {
+        cerr << "Cannot create " << options.outputDir << endl;
+        return 2;
+    }
+    // The exports would be picked up as new images
+    if (!options.watchDir.empty() && fs::equivalent(options.watchDir, options.outputDir, error))
+    {
+        cerr << "--watch needs an --output-dir other than the watched directory" << endl;
+        return 2;
+    }
+
+    if (options.residentMegabytes)
+        TiledImageStore::SetResidentLimit(options.residentMegabytes << 20);
+    if (!options.scratchDir.empty())
+        TiledImageStore::SetScratchDirectory(options.scratchDir);
+    // Every file is decoded once, there is nothing to gain from keeping any around
+    ImageCache::Shared().SetCapacity(0);
+
+    Trace::SetThreadName("main");
+    if (!options.tracePath.empty())
+        Trace::Start();
+
+    auto start = std::chrono::steady_clock::now();
+    int failed = !options.watchDir.empty() ? RunWatch(options, files)
+        : options.pipeline ? RunPipelined(options, files) : RunSequential(options, files);
+    if (failed < 0)
+        return 2;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (options.watchDir.empty())
+        cout << files.size() - failed << " of " << files.size() << " images processed in " << seconds << " s" << endl;
+    if (options.outOfCoreMegapixels > 0)
+        cout << "Peak paged tile memory " << (TiledImageStore::GetPeakResidentBytes() >> 20) << " MB" << endl;
+    if (options.checkSteadyState && !CheckSteadyState(options, files))
+        return 3;
+    if (!options.tracePath.empty())
+    {
+        Trace::Stop();
+        if (Trace::WriteJson(options.tracePath))
+            cout << "Trace of " << Trace::GetEventCount() << " events written to " << options.tracePath << endl;
+        else
+            cerr << "Cannot write " << options.tracePath << endl;
+    }
+
+    return failed ? 1 : 0;
+}
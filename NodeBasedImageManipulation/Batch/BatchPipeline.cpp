@@ -0,0 +1,334 @@
+// Pipelined batch mode: decode -> evaluate -> encode.
+//
+// The three steps cost very different amounts per image, so each gets its own group of
+// threads and images flow between the groups through bounded queues. While one image is
+// being evaluated the next ones are already decoding and the previous ones encoding.
+// A full queue makes the stage feeding it wait, so at most
+//   decoders + queue depth + compute threads + queue depth + encoders
+// images are held in memory at any time however long the file list is.
+
+#include "Batch.h"
+#include "Core/BoundedQueue.h"
+#include "Core/ExportHash.h"
+#include "Core/NodeUtils.h"
+#include "Core/Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct DecodedImage
+    {
+        int index = -1;
+        std::unique_ptr<ImageBuffer> image;
+    };
+
+    struct EncodeJob
+    {
+        int index = -1;
+        vector<string> paths;
+        vector<string> exts;
+        vector<EncodeOptions> settings;
+        vector<std::unique_ptr<ImageBuffer>> images;
+    };
+
+    struct StageStats
+    {
+        const char* name = "";
+        int threads = 0;
+        std::atomic<int> items{ 0 };
+        std::atomic<long long> busyMicroseconds{ 0 };
+        std::atomic<long long> idleMicroseconds{ 0 };
+
+        void AddBusy(Clock::time_point start, Clock::time_point end)
+        {
+            busyMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        }
+        void AddIdle(Clock::time_point start, Clock::time_point end)
+        {
+            idleMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        }
+    };
+
+    // Queue depth sampled by the producer after every push
+    template<typename T>
+    struct QueueStats
+    {
+        const char* name = "";
+        BoundedQueue<T>& queue;
+        std::atomic<long long> depthSum{ 0 };
+        std::atomic<long long> samples{ 0 };
+        std::atomic<size_t> maxDepth{ 0 };
+
+        QueueStats(const char* name, BoundedQueue<T>& queue) : name(name), queue(queue) {}
+
+        void Sample()
+        {
+            size_t depth = queue.SizeApprox();
+            depthSum += (long long)depth;
+            samples++;
+            size_t seen = maxDepth.load();
+            while (depth > seen && !maxDepth.compare_exchange_weak(seen, depth)) {}
+        }
+
+        void Print()
+        {
+            printf("  %-18s capacity %3zu  mean depth %5.2f  max %3zu  producer waits %5zu  consumer waits %5zu\n",
+                name, queue.Capacity(), samples ? (double)depthSum / samples : 0.0, maxDepth.load(),
+                queue.FullWaits(), queue.EmptyWaits());
+        }
+    };
+
+    void PrintStage(StageStats& stage, double wallSeconds)
+    {
+        double busy = stage.busyMicroseconds / 1e6;
+        double idle = stage.idleMicroseconds / 1e6;
+        double capacity = wallSeconds * stage.threads;
+        printf("  %-8s %2d thread(s)  %5d images  %7.2f img/s  %6.1f ms/img  busy %5.1f%%  starved/blocked %5.1f%%\n",
+            stage.name, stage.threads, stage.items.load(), wallSeconds > 0 ? stage.items / wallSeconds : 0.0,
+            stage.items ? busy * 1000.0 / stage.items : 0.0,
+            capacity > 0 ? 100.0 * busy / capacity : 0.0, capacity > 0 ? 100.0 * idle / capacity : 0.0);
+    }
+
+    // Signals the queue once the last thread of the stage feeding it has finished
+    template<typename T>
+    void FinishProducer(std::atomic<int>& producersLeft, BoundedQueue<T>& queue)
+    {
+        if (--producersLeft == 0)
+            queue.Close();
+    }
+}
+
+int RunPipelined(const BatchOptions& options, const vector<string>& files)
+{
+    int cores = std::max(1, (int)std::thread::hardware_concurrency());
+    int decoders = options.decoders > 0 ? options.decoders : std::max(1, cores / 4);
+    int encoders = options.encoders > 0 ? options.encoders : std::max(1, cores / 4);
+    int computes = options.jobs > 0 ? options.jobs : std::max(1, cores - decoders - encoders);
+    decoders = std::min(decoders, (int)files.size());
+    encoders = std::min(encoders, (int)files.size());
+    computes = std::min(computes, (int)files.size());
+    int tileThreads = std::max(1, (cores - decoders - encoders) / computes);
+
+    vector<BatchWorker> workers(computes);
+    for (BatchWorker& worker : workers)
+    {
+        if (!SetUpWorker(worker, options, tileThreads))
+            return -1;
+        // The encode stage writes the files, evaluation stops at the Output nodes
+        for (OutputNode* output : worker.outputs)
+            output->SetSavePath("");
+    }
+
+    BoundedQueue<DecodedImage> decoded(options.queueDepth);
+    BoundedQueue<EncodeJob> processed(options.queueDepth);
+    QueueStats<DecodedImage> decodedStats("decode -> process", decoded);
+    QueueStats<EncodeJob> processedStats("process -> encode", processed);
+
+    StageStats decodeStage, computeStage, encodeStage;
+    decodeStage.name = "decode";
+    decodeStage.threads = decoders;
+    computeStage.name = "process";
+    computeStage.threads = computes;
+    encodeStage.name = "encode";
+    encodeStage.threads = encoders;
+
+    std::atomic<int> next{ 0 };
+    std::atomic<int> failed{ 0 };
+    std::atomic<int> done{ 0 };
+    std::atomic<int> skipped{ 0 };
+    std::atomic<int> decodersLeft{ decoders };
+    std::atomic<int> computesLeft{ computes };
+    std::mutex logMutex;
+
+    auto fail = [&](int index, const char* stage) {
+        failed++;
+        done++;
+        std::lock_guard<std::mutex> lock(logMutex);
+        cerr << "[" << done << "/" << files.size() << "] " << files[index] << " failed to " << stage << endl;
+    };
+
+    auto decode = [&](int thread) {
+        Trace::SetThreadName("decode " + to_string(thread + 1));
+        for (int i = next++; i < (int)files.size(); i = next++)
+        {
+            auto start = Clock::now();
+            DecodedImage item;
+            item.index = i;
+            item.image = std::make_unique<ImageBuffer>();
+            bool ok = LoadImageFromFile(files[i].c_str(), item.image.get());
+            auto end = Clock::now();
+            decodeStage.AddBusy(start, end);
+            if (!ok)
+            {
+                fail(i, "decode");
+                continue;
+            }
+            decodeStage.items++;
+            bool pushed;
+            {
+                TraceScope trace("queue", "Wait for process");
+                pushed = decoded.Push(item);
+            }
+            if (!pushed)
+                break;
+            decodedStats.Sample();
+            decodeStage.AddIdle(end, Clock::now());
+        }
+        FinishProducer(decodersLeft, decoded);
+    };
+
+    auto compute = [&](BatchWorker& worker) {
+        Trace::SetThreadName("process " + to_string(&worker - workers.data() + 1));
+        DecodedImage item;
+        while (true)
+        {
+            auto waitStart = Clock::now();
+            bool popped;
+            {
+                TraceScope trace("queue", "Wait for decode");
+                popped = decoded.Pop(item);
+            }
+            if (!popped)
+                break;
+            auto start = Clock::now();
+            computeStage.AddIdle(waitStart, start);
+
+            const string& file = files[item.index];
+            {
+                TraceScope trace("batch", "Image", -1, file.c_str());
+                worker.input->SetImage(file, item.image.release());
+                worker.graph.Evaluate();
+            }
+
+            EncodeJob job;
+            job.index = item.index;
+            const char* failedStep = nullptr;
+            for (size_t o = 0; o < worker.outputs.size(); ++o)
+            {
+                ImageBuffer* result = worker.outputs[o]->GetImageBuffer();
+                if (!result)
+                {
+                    failedStep = "evaluate";
+                    break;
+                }
+                // The worker's buffers are reused by the next image while this one encodes
+                auto copy = std::make_unique<ImageBuffer>();
+                if (!copy->CopyFrom(*result))
+                {
+                    failedStep = "copy its result";
+                    break;
+                }
+                job.paths.push_back(OutputPath(options, worker, o, file));
+                job.exts.push_back(job.paths.back().substr(job.paths.back().find_last_of('.')));
+                job.settings.push_back(worker.outputs[o]->GetEncodeOptions());
+                job.images.push_back(std::move(copy));
+            }
+            auto end = Clock::now();
+            computeStage.AddBusy(start, end);
+            if (failedStep)
+            {
+                fail(item.index, failedStep);
+                continue;
+            }
+            computeStage.items++;
+            bool pushed;
+            {
+                TraceScope waitTrace("queue", "Wait for encode");
+                pushed = processed.Push(job);
+            }
+            if (!pushed)
+                break;
+            processedStats.Sample();
+            computeStage.AddIdle(end, Clock::now());
+        }
+        FinishProducer(computesLeft, processed);
+    };
+
+    auto encode = [&](int thread) {
+        Trace::SetThreadName("encode " + to_string(thread + 1));
+        EncodeJob job;
+        while (true)
+        {
+            auto waitStart = Clock::now();
+            bool popped;
+            {
+                TraceScope trace("queue", "Wait for process");
+                popped = processed.Pop(job);
+            }
+            if (!popped)
+                break;
+            auto start = Clock::now();
+            encodeStage.AddIdle(waitStart, start);
+
+            bool ok = true;
+            for (size_t k = 0; k < job.images.size(); ++k)
+            {
+                uint64_t hash = 0;
+                if (options.skipUnchanged)
+                {
+                    hash = HashExport(*job.images[k], job.exts[k], job.settings[k]);
+                    ExportRecord record;
+                    if (ReadExportSidecar(job.paths[k], record) && IsExportCurrent(record, job.paths[k], hash))
+                    {
+                        skipped++;
+                        continue;
+                    }
+                }
+                bool written = SaveImageToFile(job.paths[k], job.exts[k], job.images[k].get(), job.settings[k]);
+                ExportRecord record;
+                if (written && options.skipUnchanged && RecordExport(job.paths[k], hash, record))
+                    WriteExportSidecar(record);
+                ok = written && ok;
+            }
+            job.images.clear();
+            job.settings.clear();
+
+            auto end = Clock::now();
+            encodeStage.AddBusy(start, end);
+            if (!ok)
+            {
+                fail(job.index, "encode");
+                continue;
+            }
+            encodeStage.items++;
+            done++;
+            std::lock_guard<std::mutex> lock(logMutex);
+            cout << "[" << done << "/" << files.size() << "] " << files[job.index] << endl;
+        }
+    };
+
+    auto start = Clock::now();
+    vector<std::thread> threads;
+    for (int d = 0; d < decoders; ++d)
+        threads.emplace_back(decode, d);
+    for (int c = 0; c < computes; ++c)
+        threads.emplace_back(compute, std::ref(workers[c]));
+    for (int e = 0; e < encoders; ++e)
+        threads.emplace_back(encode, e);
+    for (std::thread& t : threads)
+        t.join();
+    double wallSeconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    cout.flush();
+    printf("Pipeline, %.2f s:\n", wallSeconds);
+    PrintStage(decodeStage, wallSeconds);
+    PrintStage(computeStage, wallSeconds);
+    PrintStage(encodeStage, wallSeconds);
+    decodedStats.Print();
+    processedStats.Print();
+    if (skipped)
+        printf("%d outputs were unchanged and not written again\n", skipped.load());
+    fflush(stdout);
+    if (options.profile)
+        PrintNodeStats(workers);
+
+    return failed;
+}
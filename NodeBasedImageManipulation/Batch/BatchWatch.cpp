@@ -0,0 +1,310 @@
+// Watch mode: nbip-batch --watch <dir> stays up and processes every image that lands in dir.
+//
+// The workers and their graphs are set up once, so a new file only costs its own decode,
+// evaluation and export: node buffers, the thread pool and everything else stay warm
+// between files. On Linux inotify reports files as they are closed after writing or
+// renamed into the directory (what copy tools and rsync do), so a half written file is
+// never picked up. Elsewhere the directory is listed twice a second and a file is taken
+// once its size and time stop changing.
+//
+// Input files are read into memory rather than mapped. A file that is written again while
+// it is decoded then only fails (reported, and picked up again once the new one is closed)
+// instead of taking the process down with SIGBUS.
+
+#include "Batch.h"
+#include "Core/MappedFile.h"
+#include "Core/Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    std::atomic<bool> stopRequested{ false };
+
+    void RequestStop(int)
+    {
+        stopRequested = true;
+    }
+
+    // Image files in one directory (not its subdirectories) that were written or moved in
+    class FolderWatcher
+    {
+    public:
+        FolderWatcher() = default;
+        FolderWatcher(const FolderWatcher&) = delete;
+        FolderWatcher& operator=(const FolderWatcher&) = delete;
+        ~FolderWatcher()
+        {
+#ifdef __linux__
+            if (fd >= 0)
+                close(fd);
+#endif
+        }
+
+        bool Open(const string& path)
+        {
+            dir = path;
+#ifdef __linux__
+            fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (fd < 0)
+                return false;
+            return inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF) >= 0;
+#else
+            // What is there already is not new
+            std::error_code error;
+            if (!fs::is_directory(dir, error))
+                return false;
+            Scan(nullptr);
+            return true;
+#endif
+        }
+
+        // Waits up to timeoutMs for changes and adds the files to changed. False once the
+        // directory is gone.
+        bool Wait(int timeoutMs, vector<string>& changed)
+        {
+#ifdef __linux__
+            pollfd ready = { fd, POLLIN, 0 };
+            if (poll(&ready, 1, timeoutMs) <= 0)
+                return true;
+            alignas(inotify_event) char buffer[16384];
+            ssize_t length;
+            while ((length = read(fd, buffer, sizeof(buffer))) > 0)
+            {
+                for (char* at = buffer; at < buffer + length;)
+                {
+                    const inotify_event* event = reinterpret_cast<const inotify_event*>(at);
+                    at += sizeof(inotify_event) + event->len;
+                    if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+                        return false;
+                    if (event->mask & IN_Q_OVERFLOW)
+                    {
+                        // Events were lost, everything could have changed
+                        std::error_code error;
+                        for (const fs::directory_entry& entry : fs::directory_iterator(dir, error))
+                            if (entry.is_regular_file(error) && IsImageFile(entry.path()))
+                                changed.push_back(entry.path().string());
+                        continue;
+                    }
+                    if (event->len && !(event->mask & IN_ISDIR))
+                    {
+                        fs::path file = fs::path(dir) / event->name;
+                        if (IsImageFile(file))
+                            changed.push_back(file.string());
+                    }
+                }
+            }
+            return true;
+#else
+            std::this_thread::sleep_for(std::chrono::milliseconds(timeoutMs));
+            std::error_code error;
+            if (!fs::is_directory(dir, error))
+                return false;
+            Scan(&changed);
+            return true;
+#endif
+        }
+
+    private:
+        string dir;
+#ifdef __linux__
+        int fd = -1;
+#else
+        struct Seen
+        {
+            fs::file_time_type time;
+            uintmax_t size = 0;
+            bool reported = false;
+        };
+        std::map<string, Seen> seen;
+
+        // A file is reported on the first scan that finds it unchanged since the last one,
+        // so one that is still being copied waits. Without changed everything counts as done.
+        void Scan(vector<string>* changed)
+        {
+            std::error_code error;
+            for (const fs::directory_entry& entry : fs::directory_iterator(dir, error))
+            {
+                if (!entry.is_regular_file(error) || !IsImageFile(entry.path()))
+                    continue;
+                Seen now{ entry.last_write_time(error), entry.file_size(error), !changed };
+                auto found = seen.find(entry.path().string());
+                if (found == seen.end())
+                    seen.emplace(entry.path().string(), now);
+                else if (found->second.time != now.time || found->second.size != now.size)
+                    found->second = now;
+                else if (!found->second.reported)
+                {
+                    found->second.reported = true;
+                    changed->push_back(found->first);
+                }
+            }
+        }
+#endif
+    };
+
+    // Files waiting for a worker. A file changed again before a worker got to it is only
+    // queued once, and one file is never processed by two workers at a time.
+    class WatchQueue
+    {
+    public:
+        void Push(const string& file)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (std::find(waiting.begin(), waiting.end(), file) != waiting.end())
+                return;
+            waiting.push_back(file);
+            ready.notify_one();
+        }
+
+        // Waits for a file no other worker has. False once stopped.
+        bool Pop(string& file)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true)
+            {
+                if (stopped)
+                    return false;
+                auto next = std::find_if(waiting.begin(), waiting.end(), [&](const string& f) { return !busy.count(f); });
+                if (next != waiting.end())
+                {
+                    file = *next;
+                    waiting.erase(next);
+                    busy.insert(file);
+                    return true;
+                }
+                ready.wait(lock);
+            }
+        }
+
+        void Done(const string& file)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            busy.erase(file);
+            // Another change of the same file may be waiting for this one
+            ready.notify_all();
+        }
+
+        // Workers finish the file they have, what is still waiting is dropped
+        size_t Stop()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopped = true;
+            ready.notify_all();
+            return waiting.size();
+        }
+
+    private:
+        std::mutex mutex;
+        std::condition_variable ready;
+        std::deque<string> waiting;
+        std::set<string> busy;
+        bool stopped = false;
+    };
+}
+
+int RunWatch(const BatchOptions& options, const vector<string>& files)
+{
+    FolderWatcher watcher;
+    if (!watcher.Open(options.watchDir))
+    {
+        cerr << "Cannot watch " << options.watchDir << endl;
+        return -1;
+    }
+
+    MappedFile::SetMappingAllowed(false);
+
+    // Files mostly come one at a time, by default one image gets all the cores
+    int cores = std::max(1, (int)std::thread::hardware_concurrency());
+    int jobs = options.jobs > 0 ? options.jobs : 1;
+    int tileThreads = std::max(1, cores / jobs);
+    vector<BatchWorker> workers(jobs);
+    for (BatchWorker& worker : workers)
+    {
+        if (!SetUpWorker(worker, options, tileThreads))
+            return -1;
+    }
+
+    WatchQueue queue;
+    std::atomic<int> processed{ 0 };
+    std::atomic<int> failed{ 0 };
+    std::mutex logMutex;
+
+    auto run = [&](BatchWorker& worker) {
+        Trace::SetThreadName("job " + to_string(&worker - workers.data() + 1));
+        string file;
+        while (queue.Pop(file))
+        {
+            double ms = 0;
+            bool ok = ProcessImage(worker, options, file, ms);
+            int count = ++processed;
+            if (!ok)
+                failed++;
+            queue.Done(file);
+
+            std::lock_guard<std::mutex> lock(logMutex);
+            if (ok)
+                cout << "[" << count << "] " << file << " (" << (int)ms << " ms)" << endl;
+            else
+                cerr << "[" << count << "] " << file << " failed" << endl;
+        }
+    };
+
+    std::signal(SIGINT, RequestStop);
+    std::signal(SIGTERM, RequestStop);
+
+    vector<std::thread> threads;
+    for (BatchWorker& worker : workers)
+        threads.emplace_back(run, std::ref(worker));
+    for (const string& file : files)
+        queue.Push(file);
+    {
+        std::lock_guard<std::mutex> lock(logMutex);
+        cout << "Watching " << options.watchDir << ", Ctrl+C to stop" << endl;
+    }
+
+    vector<string> changed;
+    while (!stopRequested)
+    {
+        changed.clear();
+        if (!watcher.Wait(500, changed))
+        {
+            std::lock_guard<std::mutex> lock(logMutex);
+            cerr << options.watchDir << " is gone" << endl;
+            break;
+        }
+        for (const string& file : changed)
+            queue.Push(file);
+    }
+
+    size_t dropped = queue.Stop();
+    for (std::thread& t : threads)
+        t.join();
+    std::signal(SIGINT, SIG_DFL);
+    std::signal(SIGTERM, SIG_DFL);
+
+    cout << processed - failed << " of " << processed << " images processed";
+    if (dropped)
+        cout << ", " << dropped << " still waiting were left";
+    cout << endl;
+    if (size_t skipped = CountSkippedExports(workers))
+        cout << skipped << " outputs were unchanged and not written again" << endl;
+    if (options.profile)
+        PrintNodeStats(workers);
+    return failed;
+}
@@ -0,0 +1,446 @@
+// nbip-bench: times each node's pixel kernel on synthetic images, no window needed.
+//
+//   nbip-bench [--sizes 256,1024,4096,16384] [--threads 1,2,4] [--radii 2,8,32]
+//              [--kernels bc,splitter,blur,histogram,otsu,downsample] [--min-time 0.25] [--json out.json] [--perf]
+//
+// --kernels qoi,stb-png (not run by default) times encoding and decoding whole frames in
+// memory with the QOI codec and with stb's PNG writer and reader, to compare the cost of an
+// intermediate file in either format.
+//
+// Kernels run the way tiled evaluation runs them: the frame is cut into 256 x 256 tiles
+// handed out to the shared thread pool. Every result is reported as ns per pixel, GB/s
+// of pixel data read + written and speedup over the first --threads entry (1 unless
+// given), and written to a JSON file so runs on different commits and machines can be
+// compared. --perf adds IPC and cache / branch misses per thousand instructions from the
+// hardware counters (Linux only) to tell compute bound kernels from memory bound ones.
+
+#include "node.h"
+#include "Core/ImageResample.h"
+#include "Core/QoiCodec.h"
+#include "Core/PerfCounters.h"
+#include "Core/ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include "stb_image.h"
+#define STB_IMAGE_WRITE_IMPLEMENTATION
+#include "stb_image_write.h"
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    struct Options
+    {
+        vector<int> sizes = { 256, 1024, 4096, 16384 };
+        vector<int> threads;
+        vector<int> radii = { 2, 8, 32 };
+        vector<string> kernels = { "bc", "splitter", "blur", "histogram", "otsu", "downsample" };
+        double minTime = 0.25;
+        string jsonPath = "nbip-bench.json";
+        bool perf = false;
+    };
+
+    struct Result
+    {
+        string kernel;
+        string params;
+        int size = 0;
+        int threads = 0;
+        int iterations = 0;
+        double meanSeconds = 0;
+        double bestSeconds = 0;
+        double bytesPerPixel = 0;
+        double speedup = 1;
+        // Over every run including the warm up, empty without --perf
+        PerfCounts perf;
+    };
+
+    vector<int> ParseList(const string& text)
+    {
+        vector<int> values;
+        std::stringstream stream(text);
+        string item;
+        while (getline(stream, item, ','))
+            if (atoi(item.c_str()) > 0)
+                values.push_back(atoi(item.c_str()));
+        return values;
+    }
+
+    bool ParseArgs(int argc, char** argv, Options& options)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            string arg = argv[i];
+            if (arg == "--perf")
+            {
+                options.perf = true;
+                continue;
+            }
+            if (i + 1 >= argc)
+                return false;
+            string value = argv[++i];
+            if (arg == "--sizes")
+                options.sizes = ParseList(value);
+            else if (arg == "--threads")
+                options.threads = ParseList(value);
+            else if (arg == "--radii")
+                options.radii = ParseList(value);
+            else if (arg == "--min-time")
+                options.minTime = atof(value.c_str());
+            else if (arg == "--json")
+                options.jsonPath = value;
+            else if (arg == "--kernels")
+            {
+                options.kernels.clear();
+                std::stringstream stream(value);
+                string item;
+                while (getline(stream, item, ','))
+                    options.kernels.push_back(item);
+            }
+            else
+                return false;
+        }
+        return !options.sizes.empty();
+    }
+
+    // Gradients with some noise on top, so histograms and thresholds see a spread of values
+    bool MakeCorpusImage(int size, ImageBuffer& image)
+    {
+        image.Resize(size, size);
+        if (!image.imageData)
+            return false;
+        unsigned int seed = 0x9e3779b9u ^ (unsigned int)size;
+        for (int y = 0; y < size; ++y)
+        {
+            unsigned char* row = image.imageData + (size_t)y * size * 4;
+            for (int x = 0; x < size; ++x)
+            {
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                int noise = (int)(seed & 31) - 16;
+                row[x * 4 + 0] = (unsigned char)std::clamp((int)((long long)x * 255 / size) + noise, 0, 255);
+                row[x * 4 + 1] = (unsigned char)std::clamp((int)((long long)y * 255 / size) + noise, 0, 255);
+                row[x * 4 + 2] = (unsigned char)std::clamp(((x ^ y) & 255) + noise, 0, 255);
+                row[x * 4 + 3] = 255;
+            }
+        }
+        image.MarkWritten(image.GetRect());
+        return true;
+    }
+
+    // Runs fn until minTime has passed (at least twice, once more as warm up)
+    void Measure(const std::function<void()>& fn, double minTime, Result& result)
+    {
+        fn();
+        double total = 0, best = 1e30;
+        int iterations = 0;
+        while (iterations < 2 || (total < minTime && iterations < 1000))
+        {
+            auto start = Clock::now();
+            fn();
+            double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+            total += seconds;
+            best = std::min(best, seconds);
+            iterations++;
+        }
+        result.iterations = iterations;
+        result.meanSeconds = total / iterations;
+        result.bestSeconds = best;
+    }
+
+    // The node's kernel over the whole frame, tile by tile on `threads` threads
+    std::function<void()> TiledKernel(Node* node, ImageBuffer& input, int threads, AtomicPerfCounts& perf)
+    {
+        return [node, &input, threads, &perf]() {
+            vector<ImageView> in = { input.GetView() };
+            vector<ImageView> out;
+            for (Channel* channel : node->outputs)
+                out.push_back(static_cast<ImageBuffer*>(channel->data)->GetView());
+
+            const int tileSize = 256;
+            int tilesX = (input.width + tileSize - 1) / tileSize;
+            int tilesY = (input.height + tileSize - 1) / tileSize;
+            ThreadPool::Shared().ParallelFor(tilesX * tilesY, [&](int tile) {
+                Rect region((tile % tilesX) * tileSize, (tile / tilesX) * tileSize, 0, 0);
+                region.x1 = std::min(region.x0 + tileSize, input.width);
+                region.y1 = std::min(region.y0 + tileSize, input.height);
+                PerfScope scope;
+                node->ProcessRegion(in, out, region);
+                perf.Add(scope.Stop());
+            }, threads);
+        };
+    }
+
+    bool AppendBytes(void* context, const void* data, size_t size)
+    {
+        auto* bytes = static_cast<vector<unsigned char>*>(context);
+        bytes->insert(bytes->end(), (const unsigned char*)data, (const unsigned char*)data + size);
+        return true;
+    }
+
+    void EncodeInMemory(const string& kernel, const ImageBuffer& input, vector<unsigned char>& encoded)
+    {
+        encoded.clear();
+        if (kernel == "qoi")
+        {
+            EncodeQoi(input, AppendBytes, &encoded);
+            return;
+        }
+        int length = 0;
+        unsigned char* png = stbi_write_png_to_mem(input.imageData, input.width * 4, input.width, input.height, 4, &length);
+        encoded.assign(png, png + length);
+        STBIW_FREE(png);
+    }
+
+    // A whole frame through a codec and back, all in memory so the disk stays out of it
+    std::function<void()> CodecKernel(const string& kernel, bool decode, ImageBuffer& input,
+        vector<unsigned char>& encoded, ImageBuffer& decoded, AtomicPerfCounts& perf)
+    {
+        return [kernel, decode, &input, &encoded, &decoded, &perf]() {
+            PerfScope scope;
+            if (!decode)
+                EncodeInMemory(kernel, input, encoded);
+            else if (kernel == "qoi")
+                DecodeQoi(encoded.data(), encoded.size(), decoded.imageData, (size_t)decoded.width * 4);
+            else
+            {
+                int width, height, channels;
+                stbi_image_free(stbi_load_from_memory(encoded.data(), (int)encoded.size(), &width, &height, &channels, 4));
+            }
+            perf.Add(scope.Stop());
+        };
+    }
+
+    std::unique_ptr<Node> MakeNode(const string& kernel, int radius, int direction)
+    {
+        std::unique_ptr<Node> node;
+        if (kernel == "bc")
+        {
+            node.reset(new BrightnessContrastNode(5));
+            std::istringstream brightness("10"), contrast("1.2");
+            node->LoadParam("brightness", brightness);
+            node->LoadParam("contrast", contrast);
+        }
+        else if (kernel == "splitter")
+            node.reset(new ColorChannelSplitterNode(5));
+        else if (kernel == "blur")
+        {
+            node.reset(new BlurNode(5));
+            std::istringstream radiusValue(to_string(radius)), directionValue(to_string(direction));
+            node->LoadParam("radius", radiusValue);
+            node->LoadParam("direction", directionValue);
+        }
+        return node;
+    }
+
+    void PrintResult(const Result& r)
+    {
+        double pixels = (double)r.size * r.size;
+        printf("%-10s %-18s %6d^2 %3d thr %9.3f ns/px %8.2f GB/s %6.2fx  (%d runs)\n",
+            r.kernel.c_str(), r.params.c_str(), r.size, r.threads, r.meanSeconds * 1e9 / pixels,
+            pixels * r.bytesPerPixel / r.meanSeconds / 1e9, r.speedup, r.iterations);
+        if (!r.perf.Empty())
+            printf("%-10s %-18s IPC %5.2f  LLC misses %7.3f/ki  branch misses %7.3f/ki  %8.2f instr/px\n", "", "",
+                r.perf.Ipc(), r.perf.CacheMissesPerKiloInstruction(), r.perf.BranchMissesPerKiloInstruction(),
+                r.perf.instructions / (pixels * (r.iterations + 1)));
+        fflush(stdout);
+    }
+
+    void WriteJson(const Options& options, const vector<Result>& results)
+    {
+        std::ofstream json(options.jsonPath);
+        if (!json)
+        {
+            fprintf(stderr, "Cannot write %s\n", options.jsonPath.c_str());
+            return;
+        }
+        json << "{\n  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+        json << "  \"min_time_s\": " << options.minTime << ",\n  \"results\": [\n";
+        for (size_t i = 0; i < results.size(); ++i)
+        {
+            const Result& r = results[i];
+            double pixels = (double)r.size * r.size;
+            json << "    {\"kernel\": \"" << r.kernel << "\", \"params\": \"" << r.params << "\", \"width\": " << r.size
+                 << ", \"height\": " << r.size << ", \"threads\": " << r.threads << ", \"iterations\": " << r.iterations
+                 << ", \"mean_s\": " << r.meanSeconds << ", \"best_s\": " << r.bestSeconds
+                 << ", \"ns_per_pixel\": " << r.meanSeconds * 1e9 / pixels
+                 << ", \"best_ns_per_pixel\": " << r.bestSeconds * 1e9 / pixels
+                 << ", \"gb_per_s\": " << pixels * r.bytesPerPixel / r.meanSeconds / 1e9
+                 << ", \"speedup\": " << r.speedup;
+            if (!r.perf.Empty())
+                json << ", \"ipc\": " << r.perf.Ipc() << ", \"llc_misses_per_kinstr\": " << r.perf.CacheMissesPerKiloInstruction()
+                     << ", \"branch_misses_per_kinstr\": " << r.perf.BranchMissesPerKiloInstruction()
+                     << ", \"instructions_per_pixel\": " << r.perf.instructions / (pixels * (r.iterations + 1));
+            json << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+        }
+        json << "  ]\n}\n";
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!ParseArgs(argc, argv, options))
+    {
+        fprintf(stderr, "usage: nbip-bench [--sizes 256,1024,4096,16384] [--threads 1,2,4] [--radii 2,8,32]\n"
+                        "                  [--kernels bc,splitter,blur,histogram,otsu,downsample] [--min-time <s>] [--json <file>] [--perf]\n"
+                        "A 16384^2 run needs about 6 GB of memory (the splitter writes four images).\n");
+        return 2;
+    }
+
+    if (options.perf && !PerfCounters::Enable(true))
+        fprintf(stderr, "Hardware counters unavailable, timing only: %s\n", PerfCounters::GetError().c_str());
+
+    int maxThreads = ThreadPool::Shared().GetThreadCount() + 1;
+    if (options.threads.empty())
+    {
+        for (int t = 1; t < maxThreads; t *= 2)
+            options.threads.push_back(t);
+        options.threads.push_back(maxThreads);
+    }
+
+    vector<Result> results;
+    for (int size : options.sizes)
+    {
+        ImageBuffer input;
+        if (!MakeCorpusImage(size, input))
+        {
+            fprintf(stderr, "Not enough memory for %d^2, skipped\n", size);
+            continue;
+        }
+
+        for (const string& kernel : options.kernels)
+        {
+            // Parameter sets of this kernel: (label, blur radius, blur direction or decode)
+            vector<std::tuple<string, int, int>> variants;
+            vector<unsigned char> encoded;
+            ImageBuffer decoded;
+            if (kernel == "blur")
+            {
+                const char* directions[] = { "uniform", "horizontal", "vertical" };
+                for (int radius : options.radii)
+                    for (int d = 0; d < 3; ++d)
+                        variants.emplace_back("r=" + to_string(radius) + " " + directions[d], radius, d);
+            }
+            else if (kernel == "qoi" || kernel == "stb-png")
+            {
+                // Encoded once up front for the decode runs, the label gives the size
+                decoded.Resize(size, size);
+                if (!decoded.imageData)
+                {
+                    fprintf(stderr, "Not enough memory for %s at %d^2, skipped\n", kernel.c_str(), size);
+                    continue;
+                }
+                EncodeInMemory(kernel, input, encoded);
+                char ratio[32];
+                snprintf(ratio, sizeof(ratio), "enc %.1f%% of raw", 100.0 * encoded.size() / ((double)size * size * 4));
+                variants.emplace_back(ratio, 0, 0);
+                variants.emplace_back("decode", 0, 1);
+            }
+            else if (kernel == "bc" || kernel == "splitter" || kernel == "histogram" || kernel == "otsu" || kernel == "downsample")
+                variants.emplace_back(kernel == "bc" ? "b=10 c=1.2" : "", 0, 0);
+            else
+            {
+                fprintf(stderr, "Unknown kernel %s\n", kernel.c_str());
+                continue;
+            }
+
+            for (auto& [label, radius, direction] : variants)
+            {
+                std::unique_ptr<Node> node = MakeNode(kernel, radius, direction);
+                double bytesPerPixel = 4;
+                if (node)
+                {
+                    node->inputs[0]->data = &input;
+                    bool ready = node->PrepareOutputs();
+                    for (Channel* channel : node->outputs)
+                        ready = ready && static_cast<ImageBuffer*>(channel->data)->imageData;
+                    if (!ready)
+                    {
+                        fprintf(stderr, "Not enough memory for %s at %d^2, skipped\n", kernel.c_str(), size);
+                        node->inputs[0]->data = nullptr;
+                        continue;
+                    }
+                    bytesPerPixel = 4.0 + 4.0 * node->outputs.size();
+                }
+
+                // Histogram and Otsu are single threaded kernels. Downsample is the preview
+                // pyramid's 2x reduction, split into bands of rows like ImagePyramid does.
+                ImageBuffer half;
+                if (kernel == "downsample")
+                {
+                    half.Resize((input.width + 1) / 2, (input.height + 1) / 2);
+                    bytesPerPixel = 5;
+                }
+                vector<int> threadCounts = node || kernel == "downsample" ? options.threads : vector<int>{ 1 };
+                double baseline = 0;
+                for (int threads : threadCounts)
+                {
+                    Result result;
+                    result.kernel = kernel;
+                    result.params = label;
+                    result.size = size;
+                    result.threads = threads;
+                    result.bytesPerPixel = bytesPerPixel;
+
+                    AtomicPerfCounts perf;
+                    std::function<void()> fn;
+                    if (node)
+                        fn = TiledKernel(node.get(), input, threads, perf);
+                    else if (kernel == "qoi" || kernel == "stb-png")
+                        fn = CodecKernel(kernel, direction == 1, input, encoded, decoded, perf);
+                    else if (kernel == "downsample")
+                        fn = [&input, &half, threads, &perf]() {
+                            const int bandRows = 32;
+                            ThreadPool::Shared().ParallelFor((half.height + bandRows - 1) / bandRows, [&](int band) {
+                                PerfScope scope;
+                                Downsample2xRows(input.GetView(), half.GetView(), band * bandRows,
+                                    std::min((band + 1) * bandRows, half.height));
+                                perf.Add(scope.Stop());
+                            }, threads);
+                        };
+                    else if (kernel == "histogram")
+                        fn = [&input, &perf]() {
+                            float histogram[256];
+                            float maxValue = 0;
+                            PerfScope scope;
+                            ThresholdNode::ComputeHistogram(input.imageData, input.width, input.height, histogram, maxValue);
+                            perf.Add(scope.Stop());
+                        };
+                    else
+                        fn = [&input, &perf]() {
+                            PerfScope scope;
+                            volatile int threshold = ThresholdNode::ComputeOtsuThreshold(input.imageData, input.width, input.height);
+                            (void)threshold;
+                            perf.Add(scope.Stop());
+                        };
+
+                    Measure(fn, options.minTime, result);
+                    result.perf = perf.Load();
+                    if (threads == threadCounts.front())
+                        baseline = result.meanSeconds;
+                    result.speedup = baseline / result.meanSeconds;
+                    PrintResult(result);
+                    results.push_back(result);
+                }
+
+                // The input belongs to us, not to the node
+                if (node)
+                    node->inputs[0]->data = nullptr;
+            }
+        }
+    }
+
+    WriteJson(options, results);
+    printf("Results written to %s\n", options.jsonPath.c_str());
+    return 0;
+}
@@ -0,0 +1,165 @@
+#include "AllocationCounter.h"
+#include <cstdlib>
+#include <new>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#define BlockSize(p) _msize(p)
+#define AlignedBlockSize(p, align) _aligned_msize(p, align, 0)
+#elif defined(__APPLE__)
+#include <malloc/malloc.h>
+#define BlockSize(p) malloc_size(p)
+#define AlignedBlockSize(p, align) malloc_size(p)
+#else
+#include <malloc.h>
+#define BlockSize(p) malloc_usable_size(p)
+#define AlignedBlockSize(p, align) malloc_usable_size(p)
+#endif
+
+namespace
+{
+    // Plain data, so the thread_local needs no constructor and is safe to use from
+    // operator new at any point of a thread's life
+    struct ThreadAllocations
+    {
+        size_t allocations;
+        size_t bytes;
+        long long live;
+        long long peak;
+    };
+    thread_local ThreadAllocations t_counts;
+
+    void Allocated(size_t bytes)
+    {
+        ThreadAllocations& counts = t_counts;
+        counts.allocations++;
+        counts.bytes += bytes;
+        counts.live += (long long)bytes;
+        if (counts.live > counts.peak)
+            counts.peak = counts.live;
+    }
+
+    // Frees can happen on another thread than the allocation, live bytes are a per thread
+    // balance and may go negative
+    void Freed(size_t bytes)
+    {
+        t_counts.live -= (long long)bytes;
+    }
+
+    void* Allocate(size_t size, bool nothrow)
+    {
+        void* p = malloc(size ? size : 1);
+        if (!p)
+        {
+            if (nothrow)
+                return nullptr;
+            throw std::bad_alloc();
+        }
+        Allocated(BlockSize(p));
+        return p;
+    }
+
+    void Release(void* p)
+    {
+        if (!p)
+            return;
+        Freed(BlockSize(p));
+        free(p);
+    }
+
+    void* AllocateAligned(size_t size, std::align_val_t align, bool nothrow)
+    {
+        size_t alignment = (size_t)align;
+#ifdef _WIN32
+        void* p = _aligned_malloc(size ? size : 1, alignment);
+#else
+        void* p = nullptr;
+        if (posix_memalign(&p, alignment < sizeof(void*) ? sizeof(void*) : alignment, size ? size : 1) != 0)
+            p = nullptr;
+#endif
+        if (!p)
+        {
+            if (nothrow)
+                return nullptr;
+            throw std::bad_alloc();
+        }
+        Allocated(AlignedBlockSize(p, alignment));
+        return p;
+    }
+
+    void ReleaseAligned(void* p, [[maybe_unused]] std::align_val_t align)
+    {
+        if (!p)
+            return;
+        Freed(AlignedBlockSize(p, (size_t)align));
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+}
+
+void* operator new(size_t size) { return Allocate(size, false); }
+void* operator new[](size_t size) { return Allocate(size, false); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return Allocate(size, true); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return Allocate(size, true); }
+void operator delete(void* p) noexcept { Release(p); }
+void operator delete[](void* p) noexcept { Release(p); }
+void operator delete(void* p, size_t) noexcept { Release(p); }
+void operator delete[](void* p, size_t) noexcept { Release(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { Release(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { Release(p); }
+
+void* operator new(size_t size, std::align_val_t align) { return AllocateAligned(size, align, false); }
+void* operator new[](size_t size, std::align_val_t align) { return AllocateAligned(size, align, false); }
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return AllocateAligned(size, align, true); }
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept { return AllocateAligned(size, align, true); }
+void operator delete(void* p, std::align_val_t align) noexcept { ReleaseAligned(p, align); }
+void operator delete[](void* p, std::align_val_t align) noexcept { ReleaseAligned(p, align); }
+void operator delete(void* p, size_t, std::align_val_t align) noexcept { ReleaseAligned(p, align); }
+void operator delete[](void* p, size_t, std::align_val_t align) noexcept { ReleaseAligned(p, align); }
+
+namespace AllocationCounter
+{
+    void RecordAllocation(size_t bytes)
+    {
+        Allocated(bytes);
+    }
+
+    void RecordFree(size_t bytes)
+    {
+        Freed(bytes);
+    }
+}
+
+AllocationScope::AllocationScope()
+{
+    ThreadAllocations& counts = t_counts;
+    startAllocations = counts.allocations;
+    startBytes = counts.bytes;
+    startLive = counts.live;
+    outerPeak = counts.peak;
+    counts.peak = counts.live;
+}
+
+AllocationScope::~AllocationScope()
+{
+    if (running)
+        Stop();
+}
+
+AllocationCounts AllocationScope::Stop()
+{
+    ThreadAllocations& counts = t_counts;
+    AllocationCounts result;
+    if (!running)
+        return result;
+    running = false;
+    result.allocations = counts.allocations - startAllocations;
+    result.bytes = counts.bytes - startBytes;
+    result.peakBytes = (size_t)(counts.peak > startLive ? counts.peak - startLive : 0);
+    if (outerPeak > counts.peak)
+        counts.peak = outerPeak;
+    return result;
+}
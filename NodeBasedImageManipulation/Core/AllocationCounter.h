@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+// Heap allocations made by some piece of work on one thread
+struct AllocationCounts
+{
+	size_t allocations = 0;
+	size_t bytes = 0;
+	// Most bytes held at once above what was held when counting started
+	size_t peakBytes = 0;
+
+	AllocationCounts& operator+=(const AllocationCounts& other)
+	{
+		allocations += other.allocations;
+		bytes += other.bytes;
+		peakBytes = peakBytes > other.peakBytes ? peakBytes : other.peakBytes;
+		return *this;
+	}
+};
+
+// The same, added to from several threads at once. Peaks are per thread, the largest wins.
+struct AtomicAllocationCounts
+{
+	std::atomic<size_t> allocations{ 0 }, bytes{ 0 }, peakBytes{ 0 };
+
+	void Add(const AllocationCounts& counts)
+	{
+		allocations += counts.allocations;
+		bytes += counts.bytes;
+		size_t seen = peakBytes.load();
+		while (counts.peakBytes > seen && !peakBytes.compare_exchange_weak(seen, counts.peakBytes)) {}
+	}
+	void Reset()
+	{
+		allocations = 0;
+		bytes = 0;
+		peakBytes = 0;
+	}
+	AllocationCounts Load() const
+	{
+		AllocationCounts counts;
+		counts.allocations = allocations;
+		counts.bytes = bytes;
+		counts.peakBytes = peakBytes;
+		return counts;
+	}
+};
+
+// Every global operator new / delete is counted per thread (AllocationCounter.cpp replaces
+// them). Pixel buffers come from malloc and are reported by ImageBuffer through
+// RecordAllocation / RecordFree; other malloc users (stb_image, the C library) are not seen.
+namespace AllocationCounter
+{
+	void RecordAllocation(size_t bytes);
+	void RecordFree(size_t bytes);
+}
+
+// Counts the calling thread's allocations from construction until Stop(). Scopes nest.
+class AllocationScope
+{
+public:
+	AllocationScope();
+	~AllocationScope();
+	AllocationCounts Stop();
+
+private:
+	size_t startAllocations, startBytes;
+	long long startLive, outerPeak;
+	bool running = true;
+};
@@ -0,0 +1,144 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+
+// Fixed capacity multi producer / multi consumer queue. TryPush and TryPop never take a
+// lock: every cell carries a sequence number telling whose turn it is, and producers and
+// consumers claim positions with a compare and swap (Vyukov's bounded queue).
+//
+// Push and Pop wait when the queue is full / empty, which is what gives a pipeline its
+// backpressure: a fast stage cannot run further ahead of a slow one than the capacity.
+template<typename T>
+class BoundedQueue
+{
+public:
+	// At least two cells: with one, a full cell and a free one for the next lap would
+	// carry the same sequence number.
+	explicit BoundedQueue(size_t capacity)
+		: capacity(capacity < 2 ? 2 : capacity), cells(new Cell[this->capacity])
+	{
+		for (size_t i = 0; i < this->capacity; ++i)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	BoundedQueue(const BoundedQueue&) = delete;
+	BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+	bool TryPush(T& value)
+	{
+		size_t pos = tail.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Cell& cell = cells[pos % capacity];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			if (sequence == pos)
+			{
+				if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					cell.value = std::move(value);
+					cell.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (sequence < pos)
+				return false; // the consumer of the previous lap has not emptied this cell
+			else
+				pos = tail.load(std::memory_order_relaxed);
+		}
+	}
+
+	bool TryPop(T& value)
+	{
+		size_t pos = head.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Cell& cell = cells[pos % capacity];
+			size_t sequence = cell.sequence.load(std::memory_order_acquire);
+			if (sequence == pos + 1)
+			{
+				if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					value = std::move(cell.value);
+					cell.sequence.store(pos + capacity, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (sequence < pos + 1)
+				return false; // not written yet
+			else
+				pos = head.load(std::memory_order_relaxed);
+		}
+	}
+
+	// Waits for room. Returns false, leaving value alone, if the queue was closed.
+	bool Push(T& value)
+	{
+		if (TryPush(value))
+			return true;
+		fullWaits.fetch_add(1, std::memory_order_relaxed);
+		for (int attempt = 0; !closed.load(std::memory_order_acquire); ++attempt)
+		{
+			Backoff(attempt);
+			if (TryPush(value))
+				return true;
+		}
+		return false;
+	}
+
+	// Waits for an item. Returns false once the queue is closed and drained.
+	bool Pop(T& value)
+	{
+		if (TryPop(value))
+			return true;
+		emptyWaits.fetch_add(1, std::memory_order_relaxed);
+		for (int attempt = 0; ; ++attempt)
+		{
+			bool wasClosed = closed.load(std::memory_order_acquire);
+			if (TryPop(value))
+				return true;
+			if (wasClosed)
+				return false;
+			Backoff(attempt);
+		}
+	}
+
+	// No more pushes will come, consumers drain what is left and then stop
+	void Close() { closed.store(true, std::memory_order_release); }
+
+	size_t Capacity() const { return capacity; }
+	size_t SizeApprox() const
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		size_t t = tail.load(std::memory_order_relaxed);
+		return t > h ? t - h : 0;
+	}
+	// Times a Push found the queue full / a Pop found it empty and had to wait
+	size_t FullWaits() const { return fullWaits.load(std::memory_order_relaxed); }
+	size_t EmptyWaits() const { return emptyWaits.load(std::memory_order_relaxed); }
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		T value{};
+	};
+
+	static void Backoff(int attempt)
+	{
+		if (attempt < 64)
+			std::this_thread::yield();
+		else
+			std::this_thread::sleep_for(std::chrono::microseconds(attempt < 256 ? 50 : 500));
+	}
+
+	const size_t capacity;
+	std::unique_ptr<Cell[]> cells;
+	// Producers and consumers hammer different counters, keep them on separate cache lines
+	alignas(64) std::atomic<size_t> tail{ 0 };
+	alignas(64) std::atomic<size_t> head{ 0 };
+	alignas(64) std::atomic<bool> closed{ false };
+	std::atomic<size_t> fullWaits{ 0 };
+	std::atomic<size_t> emptyWaits{ 0 };
+};
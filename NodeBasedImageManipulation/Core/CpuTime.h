@@ -0,0 +1,4 @@
+#pragma once
+
+// CPU time the calling thread has used so far, in seconds
+double ThreadCpuSeconds();
@@ -0,0 +1,78 @@
+#ifdef _WIN32
+#include <Windows.h>
+#endif
+#include "EditorUtils.h"
+#include <cstdio>
+
+#ifdef _WIN32
+std::string OpenFileDialog(const char* filter) 
+{
+    OPENFILENAMEA ofn;
+    CHAR szFile[260] = { 0 };
+    ZeroMemory(&ofn, sizeof(ofn));
+
+    ofn.lStructSize = sizeof(ofn);
+    ofn.hwndOwner = NULL; // or your main window handle
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = sizeof(szFile);
+    ofn.lpstrFilter = filter;
+    ofn.nFilterIndex = 1;
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
+
+    if (GetOpenFileNameA(&ofn)) {
+        return std::string(ofn.lpstrFile);
+    }
+    return "";
+}
+
+std::string SaveFileDialog(const char* defaultExt, const char* filter) 
+{
+    char szFile[MAX_PATH] = { 0 };
+
+    OPENFILENAMEA ofn;
+    ZeroMemory(&ofn, sizeof(ofn));
+    ofn.lStructSize = sizeof(ofn);
+    ofn.lpstrFilter = filter;
+    ofn.lpstrFile = szFile;
+    ofn.nMaxFile = sizeof(szFile);
+    ofn.lpstrDefExt = defaultExt;
+    ofn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT;
+    ofn.lpstrTitle = "Save As";
+
+    if (GetSaveFileNameA(&ofn)) {
+        return std::string(ofn.lpstrFile);
+    }
+
+    return "";
+}
+#else
+// No native dialogs elsewhere, paths are typed into the nodes instead
+std::string OpenFileDialog(const char*) { return ""; }
+std::string SaveFileDialog(const char*, const char*) { return ""; }
+#endif
+
+void HelpMarker(const char* desc)
+{
+    ImGui::TextDisabled("(?)");
+    if (ImGui::BeginItemTooltip())
+    {
+        ImGui::PushTextWrapPos(ImGui::GetFontSize() * 35.0f);
+        ImGui::TextUnformatted(desc);
+        ImGui::PopTextWrapPos();
+        ImGui::EndTooltip();
+    }
+}
+std::string FormatBytes(size_t bytes)
+{
+    const char* units[] = { "B", "KB", "MB", "GB", "TB" };
+    double value = (double)bytes;
+    int unit = 0;
+    while (value >= 1024.0 && unit < 4)
+    {
+        value /= 1024.0;
+        unit++;
+    }
+    char text[32];
+    snprintf(text, sizeof(text), unit ? "%.1f %s" : "%.0f %s", value, units[unit]);
+    return text;
+}
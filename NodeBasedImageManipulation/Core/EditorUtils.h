@@ -0,0 +1,13 @@
+#pragma once
+#include <string>
+#include "imgui.h"
+
+#define IMAGE_FILE_FILTER "Image Files\0*.png;*.jpg;*.jpeg;*.bmp;*.qoi\0"
+#define GRAPH_FILE_FILTER "Node Graphs\0*.nbg\0"
+
+std::string OpenFileDialog(const char* filter = IMAGE_FILE_FILTER);
+std::string SaveFileDialog(const char* defaultExt = "png",
+    const char* filter = "PNG Files\0*.png\0JPEG Files\0*.jpg;*.jpeg\0Bitmap Files\0*.bmp\0QOI Files\0*.qoi");
+void HelpMarker(const char* desc);
+// "512 B", "3.4 KB", "12.0 MB"...
+std::string FormatBytes(size_t bytes);
\ No newline at end of file
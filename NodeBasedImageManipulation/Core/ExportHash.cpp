@@ -0,0 +1,206 @@
+#include <algorithm>
+#include <array>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include "ExportHash.h"
+#include "ImageBuffer.h"
+#include "NodeUtils.h"
+#include "OutputFile.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+namespace fs = std::filesystem;
+
+namespace
+{
+    const uint64_t kPrime1 = 0x9E3779B185EBCA87ull;
+    const uint64_t kPrime2 = 0xC2B2AE3D27D4EB4Full;
+    const uint64_t kPrime3 = 0x165667B19E3779F9ull;
+    const uint64_t kPrime4 = 0x85EBCA77C2B2AE63ull;
+    const uint64_t kPrime5 = 0x27D4EB2F165667C5ull;
+
+    // Rows hashed as one piece, and pieces per ParallelFor. Both are fixed so the hash of
+    // an image does not depend on the thread count or on where its pixels live.
+    const int kBandRows = 16;
+    const int kWaveBands = 256;
+
+    uint64_t RotateLeft(uint64_t x, int bits)
+    {
+        return (x << bits) | (x >> (64 - bits));
+    }
+
+    uint64_t Read64(const unsigned char* p)
+    {
+        uint64_t value;
+        memcpy(&value, p, 8);
+        return value; // little endian, like every target this builds for
+    }
+
+    uint32_t Read32(const unsigned char* p)
+    {
+        uint32_t value;
+        memcpy(&value, p, 4);
+        return value;
+    }
+
+    uint64_t Round(uint64_t accumulator, uint64_t input)
+    {
+        accumulator += input * kPrime2;
+        return RotateLeft(accumulator, 31) * kPrime1;
+    }
+
+    uint64_t MergeRound(uint64_t accumulator, uint64_t value)
+    {
+        accumulator ^= Round(0, value);
+        return accumulator * kPrime1 + kPrime4;
+    }
+
+    uint64_t HashBand(const ImageBuffer& image, int band, std::vector<unsigned char>& rows)
+    {
+        int y0 = band * kBandRows, y1 = std::min(image.height, y0 + kBandRows);
+        size_t stride = (size_t)image.width * 4;
+        if (!image.IsOutOfCore())
+            return Xxh64(image.imageData + y0 * stride, (y1 - y0) * stride);
+        rows.resize((y1 - y0) * stride);
+        image.ReadRegion(Rect(0, y0, image.width, y1), rows.data(), stride);
+        return Xxh64(rows.data(), rows.size());
+    }
+
+    bool StatFile(const std::string& path, uint64_t& size, int64_t& time)
+    {
+        std::error_code error;
+        uintmax_t bytes = fs::file_size(path, error);
+        if (error)
+            return false;
+        fs::file_time_type written = fs::last_write_time(path, error);
+        if (error)
+            return false;
+        size = bytes;
+        time = (int64_t)written.time_since_epoch().count();
+        return true;
+    }
+
+    std::string SidecarPath(const std::string& path)
+    {
+        return path + ".xxh64";
+    }
+}
+
+uint64_t Xxh64(const void* data, size_t size, uint64_t seed)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    uint64_t hash;
+    if (size >= 32)
+    {
+        uint64_t v1 = seed + kPrime1 + kPrime2, v2 = seed + kPrime2, v3 = seed, v4 = seed - kPrime1;
+        for (; p + 32 <= end; p += 32)
+        {
+            v1 = Round(v1, Read64(p));
+            v2 = Round(v2, Read64(p + 8));
+            v3 = Round(v3, Read64(p + 16));
+            v4 = Round(v4, Read64(p + 24));
+        }
+        hash = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) + RotateLeft(v4, 18);
+        hash = MergeRound(hash, v1);
+        hash = MergeRound(hash, v2);
+        hash = MergeRound(hash, v3);
+        hash = MergeRound(hash, v4);
+    }
+    else
+        hash = seed + kPrime5;
+    hash += size;
+
+    for (; p + 8 <= end; p += 8)
+        hash = RotateLeft(hash ^ Round(0, Read64(p)), 27) * kPrime1 + kPrime4;
+    if (p + 4 <= end)
+    {
+        hash = RotateLeft(hash ^ (Read32(p) * kPrime1), 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        hash = RotateLeft(hash ^ (*p * kPrime5), 11) * kPrime1;
+
+    hash ^= hash >> 33;
+    hash *= kPrime2;
+    hash ^= hash >> 29;
+    hash *= kPrime3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t HashExport(const ImageBuffer& image, const std::string& ext, const EncodeOptions& options)
+{
+    TraceScope trace("io", "Export hash");
+    int32_t settings[6] = { image.width, image.height, 0, 0, 0, 0 };
+    if (ext == ".png")
+    {
+        settings[2] = options.pngLevel;
+        settings[3] = options.pngFilter;
+    }
+    else if (ext == ".jpg")
+    {
+        settings[4] = options.jpgQuality;
+        settings[5] = options.jpgSubsampling;
+    }
+    uint64_t hash = Xxh64(ext.data(), ext.size(), Xxh64(settings, sizeof(settings)));
+
+    // Band hashes are folded into the total a wave at a time, in order
+    int bandCount = (image.height + kBandRows - 1) / kBandRows;
+    std::array<uint64_t, kWaveBands> wave;
+    for (int first = 0; first < bandCount; first += kWaveBands)
+    {
+        int count = std::min(kWaveBands, bandCount - first);
+        ThreadPool::Shared().ParallelFor(count, [&](int i) {
+            std::vector<unsigned char> rows;
+            wave[i] = HashBand(image, first + i, rows);
+        });
+        hash = Xxh64(wave.data(), count * sizeof(uint64_t), hash);
+    }
+    return hash;
+}
+
+bool RecordExport(const std::string& path, uint64_t hash, ExportRecord& record)
+{
+    if (!StatFile(path, record.size, record.time))
+        return false;
+    record.path = path;
+    record.hash = hash;
+    return true;
+}
+
+bool IsExportCurrent(const ExportRecord& record, const std::string& path, uint64_t hash)
+{
+    uint64_t size;
+    int64_t time;
+    return !record.path.empty() && record.path == path && record.hash == hash && StatFile(path, size, time)
+        && size == record.size && time == record.time;
+}
+
+bool ReadExportSidecar(const std::string& path, ExportRecord& record)
+{
+    std::ifstream in(SidecarPath(path));
+    std::string hex;
+    uint64_t size;
+    int64_t time;
+    if (!(in >> hex >> size >> time) || hex.size() != 16)
+        return false;
+    record.path = path;
+    record.hash = strtoull(hex.c_str(), nullptr, 16);
+    record.size = size;
+    record.time = time;
+    return true;
+}
+
+bool WriteExportSidecar(const ExportRecord& record)
+{
+    char line[64];
+    int length = snprintf(line, sizeof(line), "%016" PRIx64 " %" PRIu64 " %" PRId64 "\n", record.hash, record.size, record.time);
+    OutputFile file;
+    return file.Open(SidecarPath(record.path)) && file.Write(line, length) && file.Commit();
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+class ImageBuffer;
+struct EncodeOptions;
+
+// Skipping exports that would write what is on disk already. An export is identified by a
+// hash of its pixels, format and encoder settings. What was written is remembered with the
+// size and time of the file, so a file changed or deleted since is written again.
+
+// XXH64 of size bytes
+uint64_t Xxh64(const void* data, size_t size, uint64_t seed = 0);
+
+// Hash of what SaveImageToFile(path, ext, &image, options) writes. Bands of rows are hashed
+// on the thread pool, out of core images are read a band at a time. Settings the format
+// does not use are left out.
+uint64_t HashExport(const ImageBuffer& image, const std::string& ext, const EncodeOptions& options);
+
+struct ExportRecord
+{
+	std::string path;
+	uint64_t hash = 0;
+	// Of the file as it was written
+	uint64_t size = 0;
+	int64_t time = 0;
+};
+
+// Record of the file at path as it is now, written from an export with hash. False if
+// there is no such file.
+bool RecordExport(const std::string& path, uint64_t hash, ExportRecord& record);
+// True when path still is the file record describes and hash is the same export
+bool IsExportCurrent(const ExportRecord& record, const std::string& path, uint64_t hash);
+
+// The record kept in <path>.xxh64 next to the export, for runs that start from nothing
+bool ReadExportSidecar(const std::string& path, ExportRecord& record);
+bool WriteExportSidecar(const ExportRecord& record);
@@ -0,0 +1,97 @@
+#include "ExportQueue.h"
+#include "ImageBuffer.h"
+#include "Trace.h"
+
+namespace
+{
+    // Encoding runs on the shared pool, the writers mostly wait on it and on the disk. Two
+    // let one file encode while another is being written.
+    const int kWriterThreads = 2;
+}
+
+ExportQueue& ExportQueue::Shared()
+{
+    // The encoders run on the shared pool, created first so it is destroyed after the writers
+    ThreadPool::Shared();
+    static ExportQueue queue;
+    return queue;
+}
+
+ExportQueue::ExportQueue() : writers(kWriterThreads)
+{
+}
+
+std::shared_ptr<ExportQueue::Job> ExportQueue::Submit(const std::string& path, const std::string& ext,
+    const ImageBuffer& image, const EncodeOptions& options)
+{
+    auto job = std::make_shared<Job>();
+    job->path = path;
+    job->ext = ext;
+    job->options = options;
+    job->options.progress = &job->progress;
+    job->image = std::make_unique<ImageBuffer>();
+    bool copied;
+    {
+        TraceScope trace("io", "Copy for export");
+        copied = job->image->CopyFrom(image);
+    }
+    if (!copied)
+    {
+        job->image.reset();
+        job->progress = 1.0f;
+        job->state = State::Failed;
+        return job;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto previous = latest.find(path);
+        if (previous != latest.end())
+        {
+            State queued = State::Queued;
+            if (previous->second->state.compare_exchange_strong(queued, State::Superseded))
+                previous->second->image.reset();
+        }
+        latest[path] = job;
+        unfinished++;
+    }
+    changed.notify_all();
+    writers.Submit([this, job]() { Run(job); });
+    return job;
+}
+
+void ExportQueue::Run(const std::shared_ptr<Job>& job)
+{
+    {
+        // Behind an export of the same file that is still being written
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return job->state != State::Queued || !writing.count(job->path); });
+        State queued = State::Queued;
+        if (job->state.compare_exchange_strong(queued, State::Writing))
+            writing.insert(job->path);
+    }
+
+    if (job->state == State::Writing)
+    {
+        bool written = SaveImageToFile(job->path, job->ext, job->image.get(), job->options);
+        job->image.reset();
+        job->progress = 1.0f;
+        job->state = written ? State::Done : State::Failed;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (job->state != State::Superseded)
+            writing.erase(job->path);
+        auto newest = latest.find(job->path);
+        if (newest != latest.end() && newest->second == job)
+            latest.erase(newest);
+        unfinished--;
+    }
+    changed.notify_all();
+}
+
+void ExportQueue::WaitAll()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    changed.wait(lock, [this] { return unfinished == 0; });
+}
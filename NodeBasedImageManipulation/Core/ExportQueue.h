@@ -0,0 +1,62 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "NodeUtils.h"
+#include "ThreadPool.h"
+
+class ImageBuffer;
+
+// Image exports encoded and written on writer threads of their own, so saving never holds
+// up whoever asked for it. An export works on a copy of the image taken when it is queued,
+// the original is free to change meanwhile. Exports of different files run side by side,
+// those of one file one after the other, and a queued export that has not started yet is
+// dropped when a newer one of the same file comes in.
+//
+// Submit may be called from any thread.
+class ExportQueue
+{
+public:
+	enum class State { Queued, Writing, Done, Failed, Superseded };
+
+	// One export, finished or not
+	struct Job
+	{
+		std::string path;
+		std::string ext;
+		EncodeOptions options;
+		std::unique_ptr<ImageBuffer> image; // the copy, released once the export finishes
+		std::atomic<State> state{ State::Queued };
+		std::atomic<float> progress{ 0.0f };
+
+		bool IsFinished() const { State s = state; return s != State::Queued && s != State::Writing; }
+	};
+
+	static ExportQueue& Shared();
+
+	ExportQueue();
+	ExportQueue(const ExportQueue&) = delete;
+	ExportQueue& operator=(const ExportQueue&) = delete;
+
+	// Copies image and queues it to be saved as SaveImageToFile would. The job has Failed
+	// already when there is no memory for the copy.
+	std::shared_ptr<Job> Submit(const std::string& path, const std::string& ext, const ImageBuffer& image,
+		const EncodeOptions& options);
+	// Blocks until every export submitted so far has finished
+	void WaitAll();
+
+private:
+	void Run(const std::shared_ptr<Job>& job);
+
+	std::mutex mutex;
+	std::condition_variable changed;
+	// Newest export of each path, until it finishes
+	std::unordered_map<std::string, std::shared_ptr<Job>> latest;
+	std::unordered_set<std::string> writing;
+	int unfinished = 0;
+	ThreadPool writers;
+};
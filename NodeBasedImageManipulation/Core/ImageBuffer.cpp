@@ -1,45 +1,121 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
 #include "ImageBuffer.h"
-#include "NodeUtils.h"
+#include "TiledImageStore.h"
+#include "ImagePyramid.h"
+#include "AllocationCounter.h"
+#include "ThreadPool.h"
 
-void ImageBuffer::ShowImage()
+unsigned int ImageBuffer::NextVersion()
 {
-    if (!texture)
-        return;
-
-    UploadTextureToOpenGL(width, height, texture, imageData, true);
-
-    ImGui::Text("pointer = %x", texture);
-    ImGui::Text("size = %d x %d", width, height);
+    static std::atomic<unsigned int> lastVersion{ 0 };
+    return ++lastVersion;
+}
 
-    // Get content region size
-    ImVec2 contentSize = ImGui::GetContentRegionAvail();
+bool ImageBuffer::Resize(int newWidth, int newHeight, bool outOfCore)
+{
+    if ((imageData || tiles) && IsOutOfCore() == outOfCore && width == newWidth && height == newHeight)
+        return false;
 
-    // Original image size
-    ImVec2 imageSize = ImVec2((float)width, (float)height);
+    // Same allocator as stbi_load so the destructor can free either kind of buffer
+    if (imageData)
+        AllocationCounter::RecordFree((size_t)width * height * 4);
+    free(imageData);
+    imageData = nullptr;
+    delete tiles;
+    tiles = nullptr;
 
-    // Calculate scaling factor while preserving aspect ratio
-    float scaleX = contentSize.x / imageSize.x;
-    float scaleY = contentSize.y / imageSize.y;
-    float scale = (scaleX < scaleY) ? scaleX : scaleY;
+    if (outOfCore)
+    {
+        tiles = new TiledImageStore(newWidth, newHeight);
+        if (!tiles->IsValid())
+        {
+            // No room for a scratch file, try the heap instead
+            delete tiles;
+            tiles = nullptr;
+        }
+    }
+    if (!tiles)
+    {
+        imageData = (unsigned char*)malloc((size_t)newWidth * newHeight * 4);
+        if (imageData)
+            AllocationCounter::RecordAllocation((size_t)newWidth * newHeight * 4);
+    }
+    width = newWidth;
+    height = newHeight;
+    validRect = Rect();
+    contentVersion = NextVersion();
+    return true;
+}
 
-    // Clamp to 1.0 if image is smaller than window
-    if (scale > 1.0f) scale = 1.0f;
+bool ImageBuffer::CopyFrom(const ImageBuffer& source)
+{
+    Resize(source.width, source.height, source.IsOutOfCore());
+    if (!imageData && !tiles)
+        return false;
+    size_t stride = (size_t)width * 4;
+    if (!source.IsOutOfCore())
+    {
+        const int bandRows = 64;
+        int bands = (height + bandRows - 1) / bandRows;
+        ThreadPool::Shared().ParallelFor(bands, [&](int band) {
+            int y0 = band * bandRows;
+            int rows = std::min(bandRows, height - y0);
+            memcpy(imageData + y0 * stride, source.imageData + y0 * stride, rows * stride);
+        });
+    }
+    else
+    {
+        // A paged copy may have ended up on the heap, WriteRegion takes either
+        const int bandRows = TiledImageStore::kTileSize;
+        std::vector<unsigned char> band(stride * bandRows);
+        for (int y0 = 0; y0 < height; y0 += bandRows)
+        {
+            Rect rows(0, y0, width, std::min(height, y0 + bandRows));
+            source.ReadRegion(rows, band.data(), stride);
+            WriteRegion(rows, band.data(), stride);
+        }
+    }
+    MarkWritten(GetRect());
+    return true;
+}
 
-    // Final displayed size
-    ImVec2 displaySize = ImVec2(imageSize.x * scale, imageSize.y * scale);
+void ImageBuffer::ReadRegion(const Rect& region, unsigned char* dst, size_t dstStride) const
+{
+    if (tiles)
+    {
+        tiles->Read(region, dst, dstStride);
+        return;
+    }
+    ImageView view = GetView();
+    for (int y = region.y0; y < region.y1; ++y)
+        memcpy(dst + (size_t)(y - region.y0) * dstStride, view.Pixel(region.x0, y), (size_t)region.Width() * 4);
+}
 
-    // Draw the image
-    ImGui::Image((ImTextureID)(intptr_t)texture, displaySize);
+void ImageBuffer::WriteRegion(const Rect& region, const unsigned char* src, size_t srcStride)
+{
+    if (tiles)
+    {
+        tiles->Write(region, src, srcStride);
+        return;
+    }
+    ImageView view = GetView();
+    for (int y = region.y0; y < region.y1; ++y)
+        memcpy(view.Pixel(region.x0, y), src + (size_t)(y - region.y0) * srcStride, (size_t)region.Width() * 4);
 }
 
 ImageBuffer::~ImageBuffer()
 {
     if (imageData) {
+        AllocationCounter::RecordFree((size_t)width * height * 4);
         free(imageData);
         imageData = nullptr;
     }
-    if (texture) {
-        glDeleteTextures(1, &texture);
-        texture = 0;
-    }
-}
\ No newline at end of file
+    delete tiles;
+    tiles = nullptr;
+    delete pyramid;
+    pyramid = nullptr;
+}
@@ -1,13 +1,47 @@
 #pragma once
+#include "ImageRegion.h"
+
+class TiledImageStore;
+class ImagePyramid;
 
 class ImageBuffer
 {
 public:
 	int width = 0, height = 0;
-	unsigned int texture = 0;
 	unsigned char* imageData = nullptr;
+	// Out of core images keep their pixels here instead and imageData stays null
+	TiledImageStore* tiles = nullptr;
+	// Part of imageData that holds up to date pixels. Region of interest evaluation only
+	// computes what the preview shows, the rest of the buffer is stale until it is needed.
+	Rect validRect;
+	// Changes every time the pixels are written, so the preview can tell whether its
+	// textures are stale without comparing any pixels. Versions are never reused, not even
+	// by another buffer, so (buffer, version) also tells a new buffer at an old address apart.
+	unsigned int contentVersion = 0;
+	// Proxies hold their image at 1 / (1 << proxyShift) of its real resolution.
+	int proxyShift = 0;
+	// Reduced copies for the preview, made the first time it shows the image smaller
+	ImagePyramid* pyramid = nullptr;
+
+	// (Re)allocates a width x height RGBA image, in memory or, with outOfCore, in a
+	// TiledImageStore. Returns true when the storage was reallocated, in which case the
+	// previous contents are gone and validRect is emptied.
+	bool Resize(int newWidth, int newHeight, bool outOfCore = false);
+	// Makes this a copy of source's pixels, kept the way source keeps them. Paged images
+	// are copied a tile row at a time, others in bands on the shared pool. False when there
+	// is no memory for the copy.
+	bool CopyFrom(const ImageBuffer& source);
+	bool IsOutOfCore() const { return tiles != nullptr; }
+	Rect GetRect() const { return Rect(0, 0, width, height); }
+	// Call after writing pixels: written becomes the valid part of the image
+	void MarkWritten(const Rect& written) { validRect = written; contentVersion = NextVersion(); }
+	static unsigned int NextVersion();
+	// Out of core images have no view (its data is null), use ReadRegion / WriteRegion
+	ImageView GetView() const { return ImageView{ imageData, GetRect(), width * 4, width, height }; }
 
-	void ShowImage();
+	// Copy pixels out of / into the image whichever way it is stored
+	void ReadRegion(const Rect& region, unsigned char* dst, size_t dstStride) const;
+	void WriteRegion(const Rect& region, const unsigned char* src, size_t srcStride);
 
 	ImageBuffer() {};
 	ImageBuffer(const ImageBuffer&) = delete;
@@ -0,0 +1,122 @@
+#include "ImageCache.h"
+#include <algorithm>
+#include <vector>
+#include "ImageBuffer.h"
+#include "NodeUtils.h"
+
+namespace
+{
+    // Decoding is mostly compute, a couple of threads keep a few files going at once
+    // without taking the evaluation pool's cores
+    const int kIoThreads = 2;
+    // Reduced decodes stop at about what a preview window shows
+    const size_t kReducedPixels = 4000000;
+
+    size_t ImageBytes(const ImageBuffer& image)
+    {
+        return (size_t)image.width * image.height * 4;
+    }
+}
+
+ImageCache& ImageCache::Shared()
+{
+    static ImageCache cache;
+    return cache;
+}
+
+std::shared_ptr<ImageCache::Entry> ImageCache::Load(const std::string& path, bool background, bool reduced)
+{
+    // Files that cannot be looked at are still handed to the decoder, which fails them
+    std::error_code error;
+    std::filesystem::file_time_type modified = std::filesystem::last_write_time(path, error);
+    uintmax_t size = error ? 0 : std::filesystem::file_size(path, error);
+
+    std::shared_ptr<Entry> entry;
+    std::shared_ptr<std::packaged_task<std::shared_ptr<ImageBuffer>()>> decode;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::string key = reduced ? path + "\n(reduced)" : path;
+        std::shared_ptr<Entry>& cached = entries[key];
+        bool failed = cached && cached->IsReady() && !cached->Get();
+        if (!cached || failed || cached->modified != modified || cached->size != size)
+        {
+            cached = std::make_shared<Entry>();
+            cached->path = path;
+            cached->key = key;
+            cached->modified = modified;
+            cached->size = size;
+            decode = std::make_shared<std::packaged_task<std::shared_ptr<ImageBuffer>()>>([path, reduced]() {
+                auto image = std::make_shared<ImageBuffer>();
+                bool loaded = reduced ? LoadReducedImageFromFile(path.c_str(), kReducedPixels, image.get())
+                    : LoadImageFromFile(path.c_str(), image.get());
+                if (!loaded)
+                    image.reset();
+                return image;
+            });
+            cached->image = decode->get_future().share();
+            if (background && !ioPool)
+                ioPool = std::make_unique<ThreadPool>(kIoThreads);
+        }
+        cached->lastUsed = ++clock;
+        entry = cached;
+        Trim();
+    }
+
+    if (decode && background)
+        ioPool->Submit([decode]() { (*decode)(); });
+    else if (decode)
+        (*decode)();
+    return entry;
+}
+
+void ImageCache::SetCapacity(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    capacity = bytes;
+    Trim();
+}
+
+size_t ImageCache::GetCachedBytes()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t bytes = 0;
+    for (auto& cached : entries)
+    {
+        if (cached.second->IsReady() && cached.second->Get())
+            bytes += ImageBytes(*cached.second->Get());
+    }
+    return bytes;
+}
+
+void ImageCache::Trim()
+{
+    // Unused: finished, and the cache holds the only reference to the entry and the image
+    std::vector<Entry*> unused;
+    size_t unusedBytes = 0;
+    for (auto it = entries.begin(); it != entries.end();)
+    {
+        Entry& entry = *it->second;
+        if (it->second.use_count() > 1 || !entry.IsReady() || (entry.Get() && entry.Get().use_count() > 1))
+        {
+            ++it;
+            continue;
+        }
+        if (!entry.Get())
+        {
+            it = entries.erase(it);
+            continue;
+        }
+        unused.push_back(&entry);
+        unusedBytes += ImageBytes(*entry.Get());
+        ++it;
+    }
+
+    std::sort(unused.begin(), unused.end(), [](Entry* a, Entry* b) { return a->lastUsed < b->lastUsed; });
+    for (Entry* entry : unused)
+    {
+        if (unusedBytes <= capacity)
+            break;
+        unusedBytes -= ImageBytes(*entry->Get());
+        entries.erase(entry->key);
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "ThreadPool.h"
+
+class ImageBuffer;
+
+// Decoded image files, shared by everything that opens the same file. An entry is keyed by
+// the path and the file's modification time and size, so a file changed on disk is decoded
+// again. Images nobody holds any more are kept too, the least recently loaded going first
+// once they add up to more than the capacity, so going back to a recent file is free.
+//
+// Load may be called from any thread.
+class ImageCache
+{
+public:
+	// One decode of a file, finished or not
+	struct Entry
+	{
+		std::string path;
+		// Where the entry is kept, the path with a suffix for reduced decodes
+		std::string key;
+		std::filesystem::file_time_type modified;
+		uintmax_t size = 0;
+		std::shared_future<std::shared_ptr<ImageBuffer>> image;
+		unsigned long long lastUsed = 0;
+
+		bool IsReady() const { return image.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+		// The decoded image, null when the file could not be decoded. Waits for the decode.
+		const std::shared_ptr<ImageBuffer>& Get() const { return image.get(); }
+	};
+
+	static ImageCache& Shared();
+
+	ImageCache() {};
+	ImageCache(const ImageCache&) = delete;
+	ImageCache& operator=(const ImageCache&) = delete;
+
+	// The decode of path as it is on disk now. When there is none yet it is started, on
+	// the I/O threads with background, else right here before returning. Failed decodes
+	// are tried again on the next Load. reduced asks for LoadReducedImageFromFile's quick
+	// stand-in instead, which is null for files it does not apply to.
+	std::shared_ptr<Entry> Load(const std::string& path, bool background, bool reduced = false);
+
+	// Bytes of decoded images kept while nothing uses them (default 1 GB)
+	void SetCapacity(size_t bytes);
+	size_t GetCachedBytes();
+
+private:
+	// Drops unused images beyond the capacity, with the mutex held
+	void Trim();
+
+	std::mutex mutex;
+	std::unordered_map<std::string, std::shared_ptr<Entry>> entries;
+	size_t capacity = (size_t)1 << 30;
+	unsigned long long clock = 0;
+	// Started by the first background Load
+	std::unique_ptr<ThreadPool> ioPool;
+};
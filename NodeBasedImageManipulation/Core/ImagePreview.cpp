@@ -0,0 +1,222 @@
+#include <cmath>
+#include <GLFW/glfw3.h>
+#include "imgui.h"
+#include "ImagePreview.h"
+#include "ImageBuffer.h"
+#include "ImagePyramid.h"
+#include "TextureUpload.h"
+
+// Preview of an ImageBuffer: everything here needs a GL context.
+
+size_t ImagePreview::TileKeyHash::operator()(const TileKey& key) const
+{
+    size_t hash = std::hash<const void*>()(key.image);
+    hash = hash * 31 + (size_t)key.level;
+    hash = hash * 1000003 + (size_t)key.x;
+    return hash * 1000003 + (size_t)key.y;
+}
+
+void ImagePreview::Clear()
+{
+    for (auto& entry : tiles)
+        glDeleteTextures(1, &entry.second.texture);
+    tiles.clear();
+}
+
+void ImagePreview::EvictUnused()
+{
+    if ((int)tiles.size() < MaxResidentTiles)
+        return;
+    auto oldest = tiles.end();
+    for (auto it = tiles.begin(); it != tiles.end(); ++it)
+    {
+        if (it->second.lastUsed < frame && (oldest == tiles.end() || it->second.lastUsed < oldest->second.lastUsed))
+            oldest = it;
+    }
+    // Everything is on screen, go over the limit rather than thrash
+    if (oldest == tiles.end())
+        return;
+    glDeleteTextures(1, &oldest->second.texture);
+    tiles.erase(oldest);
+}
+
+ImagePreview::Tile* ImagePreview::GetTile(const ImageBuffer& image, const ImageBuffer* level, const TileKey& key)
+{
+    auto found = tiles.find(key);
+    Tile* tile = found != tiles.end() ? &found->second : nullptr;
+    if (tile)
+        tile->lastUsed = frame;
+    // A stale tile still beats an empty one while the budget is used up
+    if ((tile && tile->version == image.contentVersion) || uploads >= MaxUploadsPerFrame)
+        return tile;
+
+    if (!tile)
+    {
+        EvictUnused();
+        tile = &tiles[key];
+        tile->lastUsed = frame;
+        glGenTextures(1, &tile->texture);
+    }
+
+    // A border of neighbouring pixels keeps linear filtering seamless across tiles
+    Rect inner(key.x * TileSize, key.y * TileSize, (key.x + 1) * TileSize, (key.y + 1) * TileSize);
+    Rect pixels = inner.Expand(1).Intersect(level->GetRect());
+    bool allocate = pixels.Width() != tile->pixels.Width() || pixels.Height() != tile->pixels.Height();
+    scratch.resize((size_t)pixels.Width() * pixels.Height() * 4);
+    level->ReadRegion(pixels, scratch.data(), (size_t)pixels.Width() * 4);
+    TextureUpload::Upload(tile->texture, pixels.Width(), pixels.Height(), scratch.data(), allocate);
+    tile->pixels = pixels;
+    tile->version = image.contentVersion;
+    uploads++;
+    return tile;
+}
+
+ImagePreview::Tile* ImagePreview::FindCoarserTile(const TileKey& key, int maxLevel, int& coarserLevel)
+{
+    for (int level = key.level + 1; level <= maxLevel; ++level)
+    {
+        int d = level - key.level;
+        auto found = tiles.find(TileKey{ key.image, level, key.x >> d, key.y >> d });
+        if (found != tiles.end())
+        {
+            found->second.lastUsed = frame;
+            coarserLevel = level;
+            return &found->second;
+        }
+    }
+    return nullptr;
+}
+
+Rect ImagePreview::Show(ImageBuffer* image, float* displayScale)
+{
+    frame++;
+    uploads = 0;
+    if (displayScale)
+        *displayScale = 0.0f;
+    if (!image || (!image->imageData && !image->IsOutOfCore()) || image->width <= 0 || image->height <= 0)
+        return Rect();
+
+    // Proxies are laid out at the size of the image they stand in for
+    int shift = image->proxyShift;
+    int fullWidth = image->width << shift;
+    int fullHeight = image->height << shift;
+
+    ImGui::Text("size = %d x %d", fullWidth, fullHeight);
+    if (shift)
+    {
+        ImGui::SameLine();
+        ImGui::TextDisabled("(1/%d proxy)", 1 << shift);
+    }
+    ImGui::SameLine();
+    if (ImGui::SmallButton("Fit"))
+        fit = true;
+    ImGui::SameLine();
+    if (ImGui::SmallButton("1:1"))
+    {
+        fit = false;
+        zoom = 1.0f;
+    }
+    ImGui::SameLine();
+    ImGui::TextDisabled("%.0f%% | %zu tiles | %s upload", zoom * 100.0f, tiles.size(), TextureUpload::GetMode());
+
+    ImVec2 canvasMin = ImGui::GetCursorScreenPos();
+    ImVec2 canvasSize = ImGui::GetContentRegionAvail();
+    if (canvasSize.x < 1.0f || canvasSize.y < 1.0f)
+        return Rect();
+    ImVec2 canvasMax(canvasMin.x + canvasSize.x, canvasMin.y + canvasSize.y);
+    ImVec2 middle(canvasMin.x + canvasSize.x * 0.5f, canvasMin.y + canvasSize.y * 0.5f);
+    ImGui::InvisibleButton("canvas", canvasSize, ImGuiButtonFlags_MouseButtonLeft | ImGuiButtonFlags_MouseButtonMiddle);
+    bool hovered = ImGui::IsItemHovered();
+    ImGuiIO& io = ImGui::GetIO();
+
+    // Fit shows the whole image, never enlarged
+    float fitZoom = std::min(std::min(canvasSize.x / fullWidth, canvasSize.y / fullHeight), 1.0f);
+    if (fit)
+    {
+        zoom = fitZoom;
+        centerX = fullWidth * 0.5;
+        centerY = fullHeight * 0.5;
+    }
+    if (hovered && io.MouseWheel != 0.0f)
+    {
+        // Zoom about the pixel under the mouse
+        double mouseX = centerX + (io.MousePos.x - middle.x) / zoom;
+        double mouseY = centerY + (io.MousePos.y - middle.y) / zoom;
+        zoom = std::clamp(zoom * powf(1.25f, io.MouseWheel), fitZoom * 0.5f, 32.0f);
+        centerX = mouseX - (io.MousePos.x - middle.x) / zoom;
+        centerY = mouseY - (io.MousePos.y - middle.y) / zoom;
+        fit = false;
+    }
+    if (ImGui::IsItemActive() && (ImGui::IsMouseDragging(ImGuiMouseButton_Left) || ImGui::IsMouseDragging(ImGuiMouseButton_Middle)))
+    {
+        centerX -= io.MouseDelta.x / zoom;
+        centerY -= io.MouseDelta.y / zoom;
+        fit = false;
+    }
+    if (hovered && ImGui::IsMouseDoubleClicked(ImGuiMouseButton_Left))
+        fit = true;
+
+    if (displayScale)
+        *displayScale = zoom;
+    Rect visible((int)floor(centerX - canvasSize.x * 0.5 / zoom), (int)floor(centerY - canvasSize.y * 0.5 / zoom),
+        (int)ceil(centerX + canvasSize.x * 0.5 / zoom), (int)ceil(centerY + canvasSize.y * 0.5 / zoom));
+    visible = visible.Intersect(Rect(0, 0, fullWidth, fullHeight));
+    if (visible.Empty())
+        return Rect();
+
+    // Tiles come from the level with about one texel per screen pixel, coarser resident
+    // tiles stand in for the ones still waiting to be uploaded
+    float screenScale = zoom * (float)(1 << shift) * io.DisplayFramebufferScale.x;
+    int level = ImagePyramid::LevelForScale(*image, screenScale);
+    int coarsest = ImagePyramid::LevelForScale(*image, 1e-9f);
+    if (level > 0 && !image->pyramid)
+        image->pyramid = new ImagePyramid();
+    const ImageBuffer* levelImage = level > 0 ? image->pyramid->GetLevel(*image, level) : image;
+    int levelWidth = image->width, levelHeight = image->height;
+    for (int i = 0; i < level; ++i)
+    {
+        levelWidth = (levelWidth + 1) / 2;
+        levelHeight = (levelHeight + 1) / 2;
+    }
+    if (levelImage && (levelImage->width != levelWidth || levelImage->height != levelHeight))
+        levelImage = nullptr; // out of memory for the level
+
+    // Visible tiles, from the visible part in image pixels
+    Rect pixels(visible.x0 >> shift, visible.y0 >> shift, (visible.x1 + (1 << shift) - 1) >> shift,
+        (visible.y1 + (1 << shift) - 1) >> shift);
+    int tileX0 = (pixels.x0 >> level) / TileSize;
+    int tileY0 = (pixels.y0 >> level) / TileSize;
+    int tileX1 = (std::min((pixels.x1 + (1 << level) - 1) >> level, levelWidth) + TileSize - 1) / TileSize;
+    int tileY1 = (std::min((pixels.y1 + (1 << level) - 1) >> level, levelHeight) + TileSize - 1) / TileSize;
+
+    ImDrawList* drawList = ImGui::GetWindowDrawList();
+    drawList->PushClipRect(canvasMin, canvasMax, true);
+    auto screenX = [&](int x) { return (float)(middle.x + ((double)x * (1 << shift) - centerX) * zoom); };
+    auto screenY = [&](int y) { return (float)(middle.y + ((double)y * (1 << shift) - centerY) * zoom); };
+    for (int ty = tileY0; ty < tileY1; ++ty)
+    {
+        for (int tx = tileX0; tx < tileX1; ++tx)
+        {
+            TileKey key{ image, level, tx, ty };
+            int tileLevel = level;
+            Tile* tile = levelImage ? GetTile(*image, levelImage, key) : nullptr;
+            if (!tile)
+                tile = FindCoarserTile(key, coarsest, tileLevel);
+            if (!tile)
+                continue;
+
+            // The tile's area in image pixels and where that lies in the texture
+            Rect area(tx * TileSize << level, ty * TileSize << level,
+                std::min((tx + 1) * TileSize << level, image->width), std::min((ty + 1) * TileSize << level, image->height));
+            double texel = 1.0 / (1 << tileLevel);
+            ImVec2 uv0((float)((area.x0 * texel - tile->pixels.x0) / tile->pixels.Width()),
+                (float)((area.y0 * texel - tile->pixels.y0) / tile->pixels.Height()));
+            ImVec2 uv1((float)((area.x1 * texel - tile->pixels.x0) / tile->pixels.Width()),
+                (float)((area.y1 * texel - tile->pixels.y0) / tile->pixels.Height()));
+            drawList->AddImage((ImTextureID)(intptr_t)tile->texture, ImVec2(screenX(area.x0), screenY(area.y0)),
+                ImVec2(screenX(area.x1), screenY(area.y1)), uv0, uv1);
+        }
+    }
+    drawList->PopClipRect();
+    return visible;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+#include "ImageRegion.h"
+
+class ImageBuffer;
+
+// The "Image Preview" window: an image fitted to the window, or zoomed (mouse wheel) and
+// panned (drag) in it. The image is drawn as tiles of the ImagePyramid level that matches
+// the zoom, so only visible tiles are ever uploaded and no texture comes near
+// GL_MAX_TEXTURE_SIZE, out of core images included. Tiles stay resident until more than
+// MaxResidentTiles are, then the least recently drawn go. Needs a GL context.
+class ImagePreview
+{
+public:
+	static const int TileSize = 256;
+	static const int MaxResidentTiles = 512;     // 128 MB of textures
+	static const int MaxUploadsPerFrame = 32;    // the rest waits for the next frame
+
+	ImagePreview() {};
+	ImagePreview(const ImagePreview&) = delete;
+	ImagePreview& operator=(const ImagePreview&) = delete;
+
+	// Draws image into the current window and returns the part of it that is visible, in
+	// full resolution pixels. displayScale receives screen pixels per full resolution pixel.
+	Rect Show(ImageBuffer* image, float* displayScale = nullptr);
+
+	// Deletes every tile texture, call while the context is still current
+	void Clear();
+
+private:
+	struct TileKey
+	{
+		const ImageBuffer* image;
+		int level, x, y;
+		bool operator==(const TileKey& o) const { return image == o.image && level == o.level && x == o.x && y == o.y; }
+	};
+	struct TileKeyHash
+	{
+		size_t operator()(const TileKey& key) const;
+	};
+	struct Tile
+	{
+		unsigned int texture = 0;
+		unsigned int version = 0;  // contentVersion of the image the pixels came from
+		Rect pixels;               // level pixels in the texture, the tile plus a 1 pixel border
+		unsigned long long lastUsed = 0;
+	};
+
+	// The tile, uploaded again first when it is stale and the frame's budget allows.
+	// Null when it is not resident and could not be uploaded this frame.
+	Tile* GetTile(const ImageBuffer& image, const ImageBuffer* level, const TileKey& key);
+	// Some resident tile of a coarser level that covers key, for drawing until key is in
+	Tile* FindCoarserTile(const TileKey& key, int maxLevel, int& coarserLevel);
+	void EvictUnused();
+
+	std::unordered_map<TileKey, Tile, TileKeyHash> tiles;
+	std::vector<unsigned char> scratch;
+	unsigned long long frame = 0;
+	int uploads = 0;
+
+	// View: screen pixels per full resolution pixel and the full resolution pixel at the
+	// middle of the window. Fit recomputes both every frame.
+	bool fit = true;
+	float zoom = 1.0f;
+	double centerX = 0, centerY = 0;
+};
@@ -0,0 +1,73 @@
+#include "ImagePyramid.h"
+#include "ImageBuffer.h"
+#include "ImageResample.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+// Levels of out of core images stay out of core down to this size
+static const long long kInMemoryLevelPixels = 16 << 20;
+
+ImagePyramid::~ImagePyramid()
+{
+    for (ImageBuffer* level : levels)
+        delete level;
+}
+
+int ImagePyramid::LevelForScale(const ImageBuffer& source, float screenScale)
+{
+    int level = 0;
+    while (screenScale > 0.0f && screenScale * (float)(2 << level) <= 1.0f &&
+        (source.width >> (level + 1)) > 0 && (source.height >> (level + 1)) > 0)
+        level++;
+    return level;
+}
+
+const ImageBuffer* ImagePyramid::GetLevel(const ImageBuffer& source, int level)
+{
+    if (!source.imageData && !source.IsOutOfCore())
+        return nullptr;
+    if (level <= 0)
+        return &source;
+
+    while ((int)levels.size() < level)
+    {
+        levels.push_back(new ImageBuffer());
+        versions.push_back(0);
+    }
+
+    // Each level comes from the one above it, only the stale ones are redone
+    const ImageBuffer* parent = &source;
+    for (int i = 0; i < level; ++i)
+    {
+        ImageBuffer& target = *levels[i];
+        if (versions[i] != source.contentVersion || target.width != (parent->width + 1) / 2 ||
+            target.height != (parent->height + 1) / 2)
+        {
+            TraceScope trace("preview", "Downsample level", -1,
+                Trace::IsRecording() ? std::to_string(i + 1).c_str() : nullptr);
+            int width = (parent->width + 1) / 2;
+            int height = (parent->height + 1) / 2;
+            if (parent->IsOutOfCore())
+            {
+                // Streamed a band at a time
+                Downsample2x(*parent, target, (long long)width * height > kInMemoryLevelPixels);
+            }
+            else
+            {
+                target.Resize(width, height);
+                if (!target.imageData)
+                    return parent;
+                ImageView src = parent->GetView();
+                ImageView dst = target.GetView();
+                const int bandRows = 32;
+                ThreadPool::Shared().ParallelFor((height + bandRows - 1) / bandRows, [&](int band) {
+                    Downsample2xRows(src, dst, band * bandRows, std::min((band + 1) * bandRows, height));
+                });
+                target.MarkWritten(target.GetRect());
+            }
+            versions[i] = source.contentVersion;
+        }
+        parent = &target;
+    }
+    return parent;
+}
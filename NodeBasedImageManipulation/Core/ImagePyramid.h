@@ -0,0 +1,27 @@
+#pragma once
+#include <vector>
+
+class ImageBuffer;
+
+// Successive 2x box reductions of an image, for showing it at less than full size. Levels
+// are built on demand, and again once the source's contentVersion has moved on.
+class ImagePyramid
+{
+public:
+	ImagePyramid() {};
+	ImagePyramid(const ImagePyramid&) = delete;
+	ImagePyramid& operator=(const ImagePyramid&) = delete;
+	~ImagePyramid();
+
+	// Coarsest level that still has a pixel for every screen pixel when source is drawn at
+	// screenScale screen pixels per source pixel
+	static int LevelForScale(const ImageBuffer& source, float screenScale);
+
+	// Level 0 is source itself, level n is 1/2^n of its size. Levels of out of core sources
+	// are out of core too until they are small. Returns null for sources without pixels.
+	const ImageBuffer* GetLevel(const ImageBuffer& source, int level);
+
+private:
+	std::vector<ImageBuffer*> levels;     // levels[i] is level i + 1
+	std::vector<unsigned int> versions;   // source contentVersion each level was built from
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include <algorithm>
+#include <cstring>
+
+// Half open pixel rectangle [x0, x1) x [y0, y1) in image coordinates.
+struct Rect
+{
+	int x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+
+	Rect() {};
+	Rect(int x0, int y0, int x1, int y1) : x0(x0), y0(y0), x1(x1), y1(y1) {}
+
+	int Width() const { return x1 - x0; }
+	int Height() const { return y1 - y0; }
+	bool Empty() const { return x1 <= x0 || y1 <= y0; }
+	bool operator==(const Rect& o) const { return x0 == o.x0 && y0 == o.y0 && x1 == o.x1 && y1 == o.y1; }
+	bool operator!=(const Rect& o) const { return !(*this == o); }
+
+	Rect Expand(int radius) const { return Rect(x0 - radius, y0 - radius, x1 + radius, y1 + radius); }
+
+	Rect Intersect(const Rect& o) const
+	{
+		return Rect(std::max(x0, o.x0), std::max(y0, o.y0), std::min(x1, o.x1), std::min(y1, o.y1));
+	}
+
+	Rect Union(const Rect& o) const
+	{
+		if (Empty()) return o;
+		if (o.Empty()) return *this;
+		return Rect(std::min(x0, o.x0), std::min(y0, o.y0), std::max(x1, o.x1), std::max(y1, o.y1));
+	}
+
+	bool Contains(const Rect& o) const
+	{
+		return o.Empty() || (o.x0 >= x0 && o.y0 >= y0 && o.x1 <= x1 && o.y1 <= y1);
+	}
+};
+
+// A window onto RGBA8 pixel memory. `data` points at pixel (rect.x0, rect.y0), so kernels
+// address pixels in absolute image coordinates whether the memory is a full frame or a
+// tile sized scratch buffer. imageWidth/imageHeight are the size of the whole image and
+// are what edge clamping is done against.
+struct ImageView
+{
+	unsigned char* data = nullptr;
+	Rect rect;
+	int stride = 0;
+	int imageWidth = 0, imageHeight = 0;
+
+	unsigned char* Pixel(int x, int y) const
+	{
+		return data + (size_t)(y - rect.y0) * stride + (size_t)(x - rect.x0) * 4;
+	}
+};
+
+inline void CopyRegion(const ImageView& src, const ImageView& dst, const Rect& region)
+{
+	size_t rowBytes = (size_t)region.Width() * 4;
+	for (int y = region.y0; y < region.y1; ++y)
+		memcpy(dst.Pixel(region.x0, y), src.Pixel(region.x0, y), rowBytes);
+}
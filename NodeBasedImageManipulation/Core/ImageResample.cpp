@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <vector>
+#include "ImageResample.h"
+#include "ImageBuffer.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NBIP_SSE2 1
+#endif
+
+// Averages two source rows into one destination row of dstWidth pixels
+static void DownsampleRows(const unsigned char* row0, const unsigned char* row1, int srcWidth, unsigned char* out, int dstWidth)
+{
+    int x = 0;
+#ifdef NBIP_SSE2
+    // Four output pixels from eight input pixels of each row, same rounding as below
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i two = _mm_set1_epi16(2);
+    for (; x + 4 <= dstWidth && x * 2 + 8 <= srcWidth; x += 4)
+    {
+        __m128i a0 = _mm_loadu_si128((const __m128i*)(row0 + x * 8));
+        __m128i a1 = _mm_loadu_si128((const __m128i*)(row0 + x * 8 + 16));
+        __m128i b0 = _mm_loadu_si128((const __m128i*)(row1 + x * 8));
+        __m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + x * 8 + 16));
+        // Vertical sums, 16 bits per channel, two pixels per register
+        __m128i p01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+        __m128i p23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+        __m128i p45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+        __m128i p67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+        // Horizontal pairs: even pixels plus odd pixels
+        __m128i sum0 = _mm_add_epi16(_mm_unpacklo_epi64(p01, p23), _mm_unpackhi_epi64(p01, p23));
+        __m128i sum1 = _mm_add_epi16(_mm_unpacklo_epi64(p45, p67), _mm_unpackhi_epi64(p45, p67));
+        sum0 = _mm_srli_epi16(_mm_add_epi16(sum0, two), 2);
+        sum1 = _mm_srli_epi16(_mm_add_epi16(sum1, two), 2);
+        _mm_storeu_si128((__m128i*)(out + x * 4), _mm_packus_epi16(sum0, sum1));
+    }
+#endif
+    for (; x < dstWidth; ++x)
+    {
+        int i0 = x * 2 * 4;
+        int i1 = std::min(x * 2 + 1, srcWidth - 1) * 4;
+        for (int c = 0; c < 4; ++c)
+            out[x * 4 + c] = (unsigned char)((row0[i0 + c] + row0[i1 + c] + row1[i0 + c] + row1[i1 + c] + 2) >> 2);
+    }
+}
+
+void Downsample2xRows(const ImageView& src, const ImageView& dst, int y0, int y1)
+{
+    int srcWidth = src.rect.Width();
+    for (int y = y0; y < y1; ++y)
+    {
+        int sy0 = src.rect.y0 + y * 2;
+        int sy1 = std::min(sy0 + 1, src.rect.y1 - 1);
+        DownsampleRows(src.Pixel(src.rect.x0, sy0), src.Pixel(src.rect.x0, sy1), srcWidth,
+            dst.Pixel(dst.rect.x0, dst.rect.y0 + y), dst.rect.Width());
+    }
+}
+
+void Downsample2x(const ImageView& src, ImageBuffer& dst)
+{
+    dst.Resize((src.rect.Width() + 1) / 2, (src.rect.Height() + 1) / 2);
+    Downsample2xRows(src, dst.GetView(), 0, dst.height);
+    dst.MarkWritten(dst.GetRect());
+}
+
+void Downsample2x(const ImageBuffer& src, ImageBuffer& dst)
+{
+    Downsample2x(src, dst, src.IsOutOfCore());
+}
+
+void Downsample2x(const ImageBuffer& src, ImageBuffer& dst, bool outOfCore)
+{
+    if (!src.IsOutOfCore() && !outOfCore)
+    {
+        Downsample2x(src.GetView(), dst);
+        return;
+    }
+
+    // Stream through the source a band of rows at a time
+    const int bandRows = 16;
+    dst.Resize((src.width + 1) / 2, (src.height + 1) / 2, outOfCore);
+    size_t srcStride = (size_t)src.width * 4;
+    size_t dstStride = (size_t)dst.width * 4;
+    std::vector<unsigned char> in(srcStride * bandRows * 2);
+    std::vector<unsigned char> out(dstStride * bandRows);
+
+    for (int y0 = 0; y0 < dst.height; y0 += bandRows)
+    {
+        int rows = std::min(bandRows, dst.height - y0);
+        Rect srcBand(0, y0 * 2, src.width, std::min(src.height, (y0 + rows) * 2));
+        src.ReadRegion(srcBand, in.data(), srcStride);
+        for (int y = 0; y < rows; ++y)
+        {
+            int r0 = y * 2;
+            int r1 = std::min(r0 + 1, srcBand.Height() - 1);
+            DownsampleRows(&in[r0 * srcStride], &in[r1 * srcStride], src.width, &out[y * dstStride], dst.width);
+        }
+        dst.WriteRegion(Rect(0, y0, dst.width, y0 + rows), out.data(), dstStride);
+    }
+    dst.MarkWritten(dst.GetRect());
+}
+
+void MakeThumbnail(const ImageBuffer& src, int maxSize, unsigned char* dst, int& width, int& height)
+{
+    const int samples = 4;
+    float scale = std::min(1.0f, (float)maxSize / std::max(src.width, src.height));
+    width = std::clamp((int)(src.width * scale + 0.5f), 1, maxSize);
+    height = std::clamp((int)(src.height * scale + 0.5f), 1, maxSize);
+
+    // Source column of every sample, the same for each row, -1 where it is not valid
+    std::vector<int> columns((size_t)width * samples);
+    for (int x = 0; x < width; ++x)
+    {
+        for (int s = 0; s < samples; ++s)
+        {
+            int srcX = std::min(src.width - 1, (int)((x + (s + 0.5f) / samples) * src.width / width));
+            columns[x * samples + s] = srcX >= src.validRect.x0 && srcX < src.validRect.x1 ? srcX * 4 : -1;
+        }
+    }
+
+    size_t srcStride = (size_t)src.width * 4;
+    std::vector<unsigned char> line(src.IsOutOfCore() ? srcStride : 0);
+    std::vector<unsigned> sums((size_t)width * 4);
+    for (int y = 0; y < height; ++y)
+    {
+        std::fill(sums.begin(), sums.end(), 0u);
+        for (int s = 0; s < samples; ++s)
+        {
+            int srcY = std::min(src.height - 1, (int)((y + (s + 0.5f) / samples) * src.height / height));
+            if (srcY < src.validRect.y0 || srcY >= src.validRect.y1)
+                continue;
+            const unsigned char* row = src.imageData + srcY * srcStride;
+            if (src.IsOutOfCore())
+            {
+                src.ReadRegion(Rect(0, srcY, src.width, srcY + 1), line.data(), srcStride);
+                row = line.data();
+            }
+            for (int x = 0; x < width; ++x)
+            {
+                for (int i = 0; i < samples; ++i)
+                {
+                    int column = columns[x * samples + i];
+                    if (column < 0)
+                        continue;
+                    for (int c = 0; c < 4; ++c)
+                        sums[x * 4 + c] += row[column + c];
+                }
+            }
+        }
+        unsigned char* out = dst + (size_t)y * width * 4;
+        for (int i = 0; i < width * 4; ++i)
+            out[i] = (unsigned char)((sums[i] + samples * samples / 2) / (samples * samples));
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include "ImageRegion.h"
+
+class ImageBuffer;
+
+// Halves an RGBA image in both directions with a 2x2 box filter. Odd edges reuse the
+// last row / column. dst is resized to ((w + 1) / 2) x ((h + 1) / 2).
+void Downsample2x(const ImageView& src, ImageBuffer& dst);
+// Rows [y0, y1) (counted from dst.rect.y0) of that halving into dst, which must already be the halved size. Rows are
+// independent, so callers can split the work.
+void Downsample2xRows(const ImageView& src, const ImageView& dst, int y0, int y1);
+// Same for a whole buffer, also when it is out of core. The result is stored the same way,
+// or as outOfCore asks.
+void Downsample2x(const ImageBuffer& src, ImageBuffer& dst);
+void Downsample2x(const ImageBuffer& src, ImageBuffer& dst, bool outOfCore);
+
+// Shrinks src to fit in maxSize x maxSize, keeping its aspect and never enlarging it, into
+// width x height tightly packed RGBA pixels at dst (room for maxSize * maxSize). Every
+// pixel averages a 4x4 grid of samples over its footprint, so only a few rows of src are
+// read, which keeps it cheap for out of core images too. Samples outside src.validRect
+// count as transparent black.
+void MakeThumbnail(const ImageBuffer& src, int maxSize, unsigned char* dst, int& width, int& height);
@@ -0,0 +1,600 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "JpegDecoder.h"
+#include "ImageBuffer.h"
+#include "Trace.h"
+
+namespace
+{
+    // Natural (row major) position of each coefficient in zig-zag order
+    const unsigned char kDeZigZag[64] = { 0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5, 12, 19, 26, 33, 40,
+        48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28, 35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51, 58,
+        59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63 };
+
+    const int kFastBits = 9;
+
+    struct HuffmanTable
+    {
+        // Codes of up to kFastBits bits are found with one lookup of the next kFastBits bits
+        unsigned char fastLength[1 << kFastBits] = {};
+        unsigned char fastSymbol[1 << kFastBits] = {};
+        // Longer codes by length: the largest code of each length (-1 if none) and where
+        // its symbols start, less the first code of that length
+        int maxCode[17] = {};
+        int offset[17] = {};
+        unsigned char symbols[256] = {};
+        // AC codes short enough that their magnitude bits fit in kFastBits too: the value
+        // << 8 | run << 4 | bits used, 0 where the slow path is needed
+        int fastAc[1 << kFastBits] = {};
+        bool defined = false;
+
+        bool Build(const unsigned char* counts, const unsigned char* values, int valueCount)
+        {
+            memcpy(symbols, values, valueCount);
+            memset(fastLength, 0, sizeof(fastLength));
+            int code = 0, k = 0;
+            for (int length = 1; length <= 16; ++length)
+            {
+                offset[length] = k - code;
+                for (int i = 0; i < counts[length - 1]; ++i, ++k, ++code)
+                {
+                    // A table with more codes than fit in its lengths is broken, and would
+                    // run past the end of the fast table
+                    if (code >= (1 << length))
+                        return false;
+                    if (length <= kFastBits)
+                    {
+                        int first = code << (kFastBits - length);
+                        for (int j = 0; j < 1 << (kFastBits - length); ++j)
+                        {
+                            fastLength[first + j] = (unsigned char)length;
+                            fastSymbol[first + j] = values[k];
+                        }
+                    }
+                }
+                maxCode[length] = counts[length - 1] ? code - 1 : -1;
+                code <<= 1;
+            }
+            for (int peek = 0; peek < 1 << kFastBits; ++peek)
+            {
+                int length = fastLength[peek];
+                int run = fastSymbol[peek] >> 4, category = fastSymbol[peek] & 15;
+                fastAc[peek] = 0;
+                if (!length || !category || length + category > kFastBits)
+                    continue;
+                int value = (peek >> (kFastBits - length - category)) & ((1 << category) - 1);
+                if (value < 1 << (category - 1))
+                    value -= (1 << category) - 1;
+                fastAc[peek] = value * 256 + run * 16 + length + category;
+            }
+            defined = true;
+            return true;
+        }
+    };
+
+    // The entropy coded data: MSB first, a 0 after every 0xff byte, markers in between
+    // restart intervals. Past a marker or the end it reads zeros, so damaged data decodes
+    // to garbage but never reads out of bounds.
+    struct BitReader
+    {
+        const unsigned char* data;
+        size_t at;
+        size_t end;
+        uint64_t bits = 0;
+        int count = 0;
+        bool atMarker = false;
+
+        void Fill()
+        {
+            while (count <= 56)
+            {
+                unsigned byte = 0;
+                if (!atMarker && at < end)
+                {
+                    byte = data[at];
+                    if (byte != 0xff)
+                        at++;
+                    else if (at + 1 < end && data[at + 1] == 0)
+                        at += 2;
+                    else
+                    {
+                        atMarker = true;
+                        byte = 0;
+                    }
+                }
+                bits |= (uint64_t)byte << (56 - count);
+                count += 8;
+            }
+        }
+
+        int Get(int n)
+        {
+            if (count < n)
+                Fill();
+            int value = (int)(bits >> (64 - n));
+            bits <<= n;
+            count -= n;
+            return value;
+        }
+
+        // An AC run and value at once when the table has them, otherwise 0
+        int PeekAc(const HuffmanTable& table)
+        {
+            if (count < 16)
+                Fill();
+            int entry = table.fastAc[bits >> (64 - kFastBits)];
+            bits <<= entry & 15;
+            count -= entry & 15;
+            return entry;
+        }
+
+        int Decode(const HuffmanTable& table)
+        {
+            if (count < 16)
+                Fill();
+            int peek = (int)(bits >> (64 - kFastBits));
+            int length = table.fastLength[peek];
+            if (length)
+            {
+                bits <<= length;
+                count -= length;
+                return table.fastSymbol[peek];
+            }
+            int code = (int)(bits >> 48);
+            for (length = kFastBits + 1; length <= 16; ++length)
+            {
+                int prefix = code >> (16 - length);
+                if (prefix <= table.maxCode[length])
+                {
+                    bits <<= length;
+                    count -= length;
+                    return table.symbols[(table.offset[length] + prefix) & 0xff];
+                }
+            }
+            // No such code, the data is damaged
+            bits <<= 16;
+            count -= 16;
+            return 0;
+        }
+
+        // Magnitude category bits of a coefficient, the negative half as one's complement
+        int Extend(int category)
+        {
+            if (category == 0 || category > 16)
+                return 0;
+            int value = Get(category);
+            return value < (1 << (category - 1)) ? value - (1 << category) + 1 : value;
+        }
+
+        // Drops what is left of the interval and steps over the RST marker after it. Only
+        // markers have a 0xff followed by anything but 0 in the entropy coded data.
+        void Restart()
+        {
+            bits = 0;
+            count = 0;
+            while (at + 1 < end && !(data[at] == 0xff && data[at + 1] >= 0xd0 && data[at + 1] <= 0xd7))
+                at++;
+            at += 2;
+            atMarker = false;
+        }
+    };
+
+    // basis[n][u * n + x]: the weight of frequency u at sample x of an n point inverse DCT,
+    // scaled so a block's DC becomes its mean like the 8 point one
+    struct ReducedBasis
+    {
+        float basis[9][64] = {};
+
+        ReducedBasis()
+        {
+            for (int n = 1; n <= 8; n *= 2)
+                for (int u = 0; u < n; ++u)
+                    for (int x = 0; x < n; ++x)
+                        basis[n][u * n + x] = 0.5f * (u ? 1.0f : 0.70710678f) * cosf((2 * x + 1) * u * 3.14159265f / (2 * n));
+        }
+    };
+
+    // Decodes one block's kept coefficients, see InverseDctReduced
+    using InverseDct = void (*)(const float*, unsigned, const ReducedBasis&, unsigned char*, int);
+
+    struct Component
+    {
+        int id = 0;
+        int h = 1, v = 1;
+        int quantTable = 0;
+        int dcTable = 0, acTable = 0;
+        int prediction = 0;
+        // Samples each block is reduced to. Subsampled components get more so their planes
+        // come out at the output resolution. keep[natural] is where a coefficient goes in
+        // the blockWidth x blockHeight block, -1 if it is dropped.
+        int blockWidth = 1, blockHeight = 1;
+        signed char keep[64] = {};
+        InverseDct inverseDct = nullptr;
+        // Reduced samples of the whole component, blocksAcross * blockWidth wide
+        std::vector<unsigned char> plane;
+        int planeWidth = 0, planeHeight = 0;
+    };
+
+    struct Frame
+    {
+        int width = 0, height = 0;
+        int componentCount = 0;
+        Component components[3];
+        int hMax = 1, vMax = 1;
+        unsigned short quant[4][64] = {}; // natural order
+        HuffmanTable dc[4], ac[4];
+        int restartInterval = 0;
+        bool jfif = false;
+        int adobeTransform = -1;
+        size_t scanStart = 0;
+        int scanComponents[3] = {};
+        int scanCount = 0;
+    };
+
+    unsigned Read16(const unsigned char* p)
+    {
+        return (unsigned)p[0] << 8 | p[1];
+    }
+
+    // Reads the markers up to the first scan. False for files DecodeJpegReduced does not
+    // read. With headerOnly it stops at the frame header.
+    bool ParseHeaders(const unsigned char* data, size_t size, Frame& frame, bool headerOnly)
+    {
+        if (size < 4 || data[0] != 0xff || data[1] != 0xd8)
+            return false;
+        size_t at = 2;
+        bool haveFrame = false;
+        while (at + 4 <= size)
+        {
+            if (data[at] != 0xff)
+                return false;
+            int marker = data[at + 1];
+            if (marker == 0xff)
+            {
+                at++;
+                continue;
+            }
+            size_t length = Read16(data + at + 2);
+            const unsigned char* p = data + at + 4;
+            if (length < 2 || at + 2 + length > size)
+                return false;
+            size_t payload = length - 2;
+
+            if (marker == 0xc0 || marker == 0xc1)
+            {
+                // Baseline or extended sequential, Huffman coded
+                if (payload < 6 || p[0] != 8)
+                    return false;
+                frame.height = (int)Read16(p + 1);
+                frame.width = (int)Read16(p + 3);
+                frame.componentCount = p[5];
+                if (frame.width == 0 || frame.height == 0 || (frame.componentCount != 1 && frame.componentCount != 3)
+                    || payload < 6 + 3u * frame.componentCount)
+                    return false;
+                for (int c = 0; c < frame.componentCount; ++c)
+                {
+                    Component& component = frame.components[c];
+                    component.id = p[6 + c * 3];
+                    component.h = p[7 + c * 3] >> 4;
+                    component.v = p[7 + c * 3] & 15;
+                    component.quantTable = p[8 + c * 3];
+                    if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4 || component.quantTable > 3)
+                        return false;
+                    frame.hMax = std::max(frame.hMax, component.h);
+                    frame.vMax = std::max(frame.vMax, component.v);
+                }
+                // A lone component is coded as whole blocks whatever its sampling factors say
+                if (frame.componentCount == 1)
+                {
+                    frame.components[0].h = frame.components[0].v = 1;
+                    frame.hMax = frame.vMax = 1;
+                }
+                haveFrame = true;
+                if (headerOnly)
+                    return true;
+            }
+            else if ((marker >= 0xc2 && marker <= 0xcb && marker != 0xc4 && marker != 0xc8) || (marker >= 0xcd && marker <= 0xcf))
+                return false; // progressive, lossless or arithmetic coded
+            else if (marker == 0xdb)
+            {
+                for (size_t i = 0; i < payload;)
+                {
+                    int precision = p[i] >> 4, table = p[i] & 15;
+                    size_t bytes = precision ? 128 : 64;
+                    if (table > 3 || i + 1 + bytes > payload)
+                        return false;
+                    for (int k = 0; k < 64; ++k)
+                        frame.quant[table][kDeZigZag[k]] = precision ? (unsigned short)Read16(p + i + 1 + k * 2) : p[i + 1 + k];
+                    i += 1 + bytes;
+                }
+            }
+            else if (marker == 0xc4)
+            {
+                for (size_t i = 0; i < payload;)
+                {
+                    if (i + 17 > payload)
+                        return false;
+                    int tableClass = p[i] >> 4, table = p[i] & 15;
+                    int valueCount = 0;
+                    for (int k = 0; k < 16; ++k)
+                        valueCount += p[i + 1 + k];
+                    if (tableClass > 1 || table > 3 || valueCount > 256 || i + 17 + valueCount > payload)
+                        return false;
+                    HuffmanTable& target = tableClass ? frame.ac[table] : frame.dc[table];
+                    if (!target.Build(p + i + 1, p + i + 17, valueCount))
+                        return false;
+                    i += 17 + valueCount;
+                }
+            }
+            else if (marker == 0xdd)
+            {
+                if (payload < 2)
+                    return false;
+                frame.restartInterval = (int)Read16(p);
+            }
+            else if (marker == 0xe0 && payload >= 5 && memcmp(p, "JFIF", 5) == 0)
+                frame.jfif = true;
+            else if (marker == 0xee && payload >= 12 && memcmp(p, "Adobe", 5) == 0)
+                frame.adobeTransform = p[11];
+            else if (marker == 0xda)
+            {
+                if (!haveFrame || payload < 1)
+                    return false;
+                frame.scanCount = p[0];
+                // Only scans holding every component at once, not one scan per component
+                if (frame.scanCount != frame.componentCount || payload < 1 + 2u * frame.scanCount + 3)
+                    return false;
+                for (int s = 0; s < frame.scanCount; ++s)
+                {
+                    int c = 0;
+                    while (c < frame.componentCount && frame.components[c].id != p[1 + s * 2])
+                        c++;
+                    if (c == frame.componentCount)
+                        return false;
+                    frame.components[c].dcTable = p[2 + s * 2] >> 4;
+                    frame.components[c].acTable = p[2 + s * 2] & 15;
+                    if (frame.components[c].dcTable > 3 || frame.components[c].acTable > 3
+                        || !frame.dc[frame.components[c].dcTable].defined || !frame.ac[frame.components[c].acTable].defined)
+                        return false;
+                    frame.scanComponents[s] = c;
+                }
+                frame.scanStart = at + 2 + length;
+                return true;
+            }
+            else if (marker == 0xd9)
+                return false;
+            at += 2 + length;
+        }
+        return false;
+    }
+
+    // One block's lowest width x height coefficients, dequantized, into as many samples at
+    // out. Bit v of rowMask is set when row v has a coefficient other than zero. Most
+    // coefficients are zero, so each one that is not adds its basis function on its own.
+    // The sizes are template arguments so the loops unroll.
+    template <int width, int height>
+    void InverseDctReduced(const float* coefficients, unsigned rowMask, const ReducedBasis& reduced, unsigned char* out, int stride)
+    {
+        const float* across = reduced.basis[width];
+        const float* down = reduced.basis[height];
+        float samples[width * height];
+        if (rowMask <= 1 && std::all_of(coefficients + 1, coefficients + width, [](float c) { return c == 0; }))
+        {
+            // Flat block
+            unsigned char mean = (unsigned char)(std::clamp(coefficients[0] * 0.125f + 128.0f, 0.0f, 255.0f) + 0.5f);
+            for (int y = 0; y < height; ++y)
+                memset(out + (size_t)y * stride, mean, width);
+            return;
+        }
+        std::fill(samples, samples + width * height, 128.0f);
+        for (int v = 0; v < height; ++v)
+        {
+            if (!(rowMask >> v & 1))
+                continue;
+            float row[width] = {};
+            for (int u = 0; u < width; ++u)
+            {
+                float c = coefficients[v * width + u];
+                if (c != 0)
+                    for (int x = 0; x < width; ++x)
+                        row[x] += c * across[u * width + x];
+            }
+            for (int y = 0; y < height; ++y)
+            {
+                float weight = down[v * height + y];
+                for (int x = 0; x < width; ++x)
+                    samples[y * width + x] += weight * row[x];
+            }
+        }
+        for (int y = 0; y < height; ++y)
+            for (int x = 0; x < width; ++x)
+                out[(size_t)y * stride + x] = (unsigned char)(std::clamp(samples[y * width + x], 0.0f, 255.0f) + 0.5f);
+    }
+
+    template <int width>
+    constexpr InverseDct kInverseDctRow[4] = { InverseDctReduced<width, 1>, InverseDctReduced<width, 2>,
+        InverseDctReduced<width, 4>, InverseDctReduced<width, 8> };
+
+    // By log2 of the width, then of the height
+    constexpr const InverseDct* kInverseDct[4] = { kInverseDctRow<1>, kInverseDctRow<2>, kInverseDctRow<4>, kInverseDctRow<8> };
+
+    int Log2(int n)
+    {
+        return n >= 8 ? 3 : n >= 4 ? 2 : n >= 2 ? 1 : 0;
+    }
+}
+
+bool ReadJpegHeader(const unsigned char* data, size_t size, int& width, int& height)
+{
+    Frame frame;
+    if (!ParseHeaders(data, size, frame, true))
+        return false;
+    width = frame.width;
+    height = frame.height;
+    return true;
+}
+
+bool DecodeJpegReduced(const unsigned char* data, size_t size, int scaleShift, ImageBuffer* buffer)
+{
+    TraceScope trace("io", "JPEG reduced decode");
+    static const ReducedBasis reduced;
+    Frame frame;
+    if (scaleShift < 1 || scaleShift > 3 || !ParseHeaders(data, size, frame, false))
+        return false;
+
+    const int n = 8 >> scaleShift;
+    int mcuWidth = 8 * frame.hMax, mcuHeight = 8 * frame.vMax;
+    int mcusAcross = (frame.width + mcuWidth - 1) / mcuWidth;
+    int mcusDown = (frame.height + mcuHeight - 1) / mcuHeight;
+    for (int c = 0; c < frame.componentCount; ++c)
+    {
+        Component& component = frame.components[c];
+        component.blockWidth = component.blockHeight = n;
+        while (component.blockWidth < 8 && component.blockWidth * component.h < n * frame.hMax)
+            component.blockWidth *= 2;
+        while (component.blockHeight < 8 && component.blockHeight * component.v < n * frame.vMax)
+            component.blockHeight *= 2;
+        for (int natural = 0; natural < 64; ++natural)
+        {
+            int row = natural >> 3, column = natural & 7;
+            component.keep[natural] = (signed char)(row < component.blockHeight && column < component.blockWidth
+                ? row * component.blockWidth + column : -1);
+        }
+        component.inverseDct = kInverseDct[Log2(component.blockWidth)][Log2(component.blockHeight)];
+        component.planeWidth = mcusAcross * component.h * component.blockWidth;
+        component.planeHeight = mcusDown * component.v * component.blockHeight;
+        component.plane.assign((size_t)component.planeWidth * component.planeHeight, 0);
+    }
+
+    BitReader reader{ data, frame.scanStart, size };
+    int mcuCount = mcusAcross * mcusDown;
+    float coefficients[64];
+    for (int mcu = 0; mcu < mcuCount; ++mcu)
+    {
+        if (frame.restartInterval && mcu && mcu % frame.restartInterval == 0)
+        {
+            reader.Restart();
+            for (int c = 0; c < frame.componentCount; ++c)
+                frame.components[c].prediction = 0;
+        }
+        int mcuX = mcu % mcusAcross, mcuY = mcu / mcusAcross;
+        for (int s = 0; s < frame.scanCount; ++s)
+        {
+            Component& component = frame.components[frame.scanComponents[s]];
+            const HuffmanTable& dc = frame.dc[component.dcTable];
+            const HuffmanTable& ac = frame.ac[component.acTable];
+            const unsigned short* quant = frame.quant[component.quantTable];
+            for (int by = 0; by < component.v; ++by)
+                for (int bx = 0; bx < component.h; ++bx)
+                {
+                    // Every coefficient has to be decoded to find the next block, only the
+                    // low frequencies are kept
+                    int kept = component.blockWidth * component.blockHeight;
+                    memset(coefficients, 0, kept * sizeof(float));
+                    component.prediction += reader.Extend(reader.Decode(dc));
+                    coefficients[0] = (float)(component.prediction * quant[0]);
+                    unsigned rowMask = 1;
+                    for (int k = 1; k < 64;)
+                    {
+                        int run, value;
+                        if (int entry = reader.PeekAc(ac))
+                        {
+                            run = entry >> 4 & 15;
+                            value = entry >> 8;
+                        }
+                        else
+                        {
+                            int symbol = reader.Decode(ac);
+                            run = symbol >> 4;
+                            int category = symbol & 15;
+                            if (category == 0)
+                            {
+                                if (run != 15)
+                                    break; // end of block
+                                k += 16;
+                                continue;
+                            }
+                            value = reader.Extend(category);
+                        }
+                        k += run;
+                        if (k > 63)
+                            break;
+                        int natural = kDeZigZag[k++];
+                        int at = component.keep[natural];
+                        if (at >= 0)
+                        {
+                            coefficients[at] = (float)(value * quant[natural]);
+                            rowMask |= 1u << (natural >> 3);
+                        }
+                    }
+                    int x = (mcuX * component.h + bx) * component.blockWidth;
+                    int y = (mcuY * component.v + by) * component.blockHeight;
+                    component.inverseDct(coefficients, rowMask, reduced, &component.plane[(size_t)y * component.planeWidth + x],
+                        component.planeWidth);
+                }
+        }
+    }
+
+    int width = (frame.width + (1 << scaleShift) - 1) >> scaleShift;
+    int height = (frame.height + (1 << scaleShift) - 1) >> scaleShift;
+    buffer->Resize(width, height);
+    if (!buffer->imageData)
+        return false;
+
+    // Colour conversion. Planes are at the output resolution unless a component is
+    // subsampled more than 8 times over, those samples are repeated.
+    const Component* components = frame.components;
+    std::vector<int> columns[3];
+    int rowScale[3];
+    for (int c = 0; c < frame.componentCount; ++c)
+    {
+        int across = components[c].h * components[c].blockWidth, full = frame.hMax * n;
+        columns[c].resize(width);
+        for (int x = 0; x < width; ++x)
+            columns[c][x] = x * across / full;
+        rowScale[c] = components[c].v * components[c].blockHeight;
+    }
+    bool rgb = frame.componentCount == 3 && ((components[0].id == 'R' && components[1].id == 'G' && components[2].id == 'B')
+        || (frame.adobeTransform == 0 && !frame.jfif));
+    for (int y = 0; y < height; ++y)
+    {
+        unsigned char* out = buffer->imageData + (size_t)y * width * 4;
+        const unsigned char* rows[3];
+        for (int c = 0; c < frame.componentCount; ++c)
+            rows[c] = &components[c].plane[(size_t)(y * rowScale[c] / (frame.vMax * n)) * components[c].planeWidth];
+        for (int x = 0; x < width; ++x, out += 4)
+        {
+            if (frame.componentCount == 1)
+            {
+                out[0] = out[1] = out[2] = rows[0][x];
+                out[3] = 255;
+                continue;
+            }
+            int c0 = rows[0][columns[0][x]];
+            int c1 = rows[1][columns[1][x]];
+            int c2 = rows[2][columns[2][x]];
+            if (rgb)
+            {
+                out[0] = (unsigned char)c0;
+                out[1] = (unsigned char)c1;
+                out[2] = (unsigned char)c2;
+            }
+            else
+            {
+                // Fixed point YCbCr to RGB, 16 fractional bits
+                int luma = (c0 << 16) + 32768;
+                int cb = c1 - 128, cr = c2 - 128;
+                out[0] = (unsigned char)std::clamp((luma + 91881 * cr) >> 16, 0, 255);
+                out[1] = (unsigned char)std::clamp((luma - 22554 * cb - 46802 * cr) >> 16, 0, 255);
+                out[2] = (unsigned char)std::clamp((luma + 116130 * cb) >> 16, 0, 255);
+            }
+            out[3] = 255;
+        }
+    }
+    buffer->proxyShift = scaleShift;
+    buffer->MarkWritten(buffer->GetRect());
+    return true;
+}
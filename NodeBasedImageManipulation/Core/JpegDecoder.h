@@ -0,0 +1,20 @@
+#pragma once
+#include <cstddef>
+
+class ImageBuffer;
+
+// Reduced size decoding of baseline JPEGs straight from their DCT coefficients, as
+// libjpeg's scale_denom does: every 8 x 8 block goes through a 4 x 4, 2 x 2 or 1 x 1
+// inverse DCT of its lowest frequencies, so the full resolution image is never built and
+// most of the decoding work (the full size IDCT, colour conversion and upsampling) is
+// skipped. Subsampled chroma blocks keep twice or four times the coefficients so they come
+// out at the output resolution too and need no upsampling.
+//
+// Progressive, arithmetic coded, 12 bit and CMYK files are not read here.
+
+// Size of a JPEG that DecodeJpegReduced reads, false for anything else
+bool ReadJpegHeader(const unsigned char* data, size_t size, int& width, int& height);
+// Decodes data at 1 / (1 << scaleShift) of its size, scaleShift 1 .. 3, into buffer. The
+// result is ceil(width / scale) x ceil(height / scale), the size Downsample2x makes, and
+// its proxyShift is scaleShift.
+bool DecodeJpegReduced(const unsigned char* data, size_t size, int scaleShift, ImageBuffer* buffer);
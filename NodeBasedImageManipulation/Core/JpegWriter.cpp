@@ -0,0 +1,483 @@
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+#include "JpegWriter.h"
+#include "ImageBuffer.h"
+#include "OutputFile.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define NBIP_SSE2 1
+#endif
+
+namespace
+{
+    // Four floats, one SSE register where there is one
+    struct F4
+    {
+#ifdef NBIP_SSE2
+        __m128 v;
+        static F4 Load(const float* p) { return F4{ _mm_loadu_ps(p) }; }
+        static F4 Set(float x) { return F4{ _mm_set1_ps(x) }; }
+        void Store(float* p) const { _mm_storeu_ps(p, v); }
+        F4 operator+(F4 o) const { return F4{ _mm_add_ps(v, o.v) }; }
+        F4 operator-(F4 o) const { return F4{ _mm_sub_ps(v, o.v) }; }
+        F4 operator*(F4 o) const { return F4{ _mm_mul_ps(v, o.v) }; }
+#else
+        float v[4];
+        static F4 Load(const float* p) { return F4{ { p[0], p[1], p[2], p[3] } }; }
+        static F4 Set(float x) { return F4{ { x, x, x, x } }; }
+        void Store(float* p) const { for (int i = 0; i < 4; ++i) p[i] = v[i]; }
+        F4 operator+(F4 o) const { return F4{ { v[0] + o.v[0], v[1] + o.v[1], v[2] + o.v[2], v[3] + o.v[3] } }; }
+        F4 operator-(F4 o) const { return F4{ { v[0] - o.v[0], v[1] - o.v[1], v[2] - o.v[2], v[3] - o.v[3] } }; }
+        F4 operator*(F4 o) const { return F4{ { v[0] * o.v[0], v[1] * o.v[1], v[2] * o.v[2], v[3] * o.v[3] } }; }
+#endif
+    };
+
+    void Transpose(F4& a, F4& b, F4& c, F4& d)
+    {
+#ifdef NBIP_SSE2
+        _MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+#else
+        F4* rows[4] = { &a, &b, &c, &d };
+        for (int i = 0; i < 4; ++i)
+            for (int j = i + 1; j < 4; ++j)
+                std::swap(rows[i]->v[j], rows[j]->v[i]);
+#endif
+    }
+
+    // The AAN forward DCT of eight values (as libjpeg's jfdctflt), four of them at once.
+    // Outputs are scaled up, the quantization table takes that back out.
+    void Dct8(F4* d)
+    {
+        F4 tmp0 = d[0] + d[7], tmp7 = d[0] - d[7];
+        F4 tmp1 = d[1] + d[6], tmp6 = d[1] - d[6];
+        F4 tmp2 = d[2] + d[5], tmp5 = d[2] - d[5];
+        F4 tmp3 = d[3] + d[4], tmp4 = d[3] - d[4];
+
+        F4 tmp10 = tmp0 + tmp3, tmp13 = tmp0 - tmp3;
+        F4 tmp11 = tmp1 + tmp2, tmp12 = tmp1 - tmp2;
+        d[0] = tmp10 + tmp11;
+        d[4] = tmp10 - tmp11;
+        F4 z1 = (tmp12 + tmp13) * F4::Set(0.707106781f);
+        d[2] = tmp13 + z1;
+        d[6] = tmp13 - z1;
+
+        tmp10 = tmp4 + tmp5;
+        tmp11 = tmp5 + tmp6;
+        tmp12 = tmp6 + tmp7;
+        F4 z5 = (tmp10 - tmp12) * F4::Set(0.382683433f);
+        F4 z2 = tmp10 * F4::Set(0.541196100f) + z5;
+        F4 z4 = tmp12 * F4::Set(1.306562965f) + z5;
+        F4 z3 = tmp11 * F4::Set(0.707106781f);
+        F4 z11 = tmp7 + z3, z13 = tmp7 - z3;
+        d[5] = z13 + z2;
+        d[3] = z13 - z2;
+        d[1] = z11 + z4;
+        d[7] = z11 - z4;
+    }
+
+    // 8 x 8 samples at p into coefficients, transposed: out[u * 8 + v] is vertical
+    // frequency v, horizontal frequency u
+    void ForwardDct(const float* p, int stride, float* out)
+    {
+        F4 left[8], right[8];
+        for (int r = 0; r < 8; ++r)
+        {
+            left[r] = F4::Load(p + r * stride);
+            right[r] = F4::Load(p + r * stride + 4);
+        }
+        // Down the columns, then transpose and the same again along the rows
+        Dct8(left);
+        Dct8(right);
+        Transpose(left[0], left[1], left[2], left[3]);
+        Transpose(left[4], left[5], left[6], left[7]);
+        Transpose(right[0], right[1], right[2], right[3]);
+        Transpose(right[4], right[5], right[6], right[7]);
+        for (int i = 0; i < 4; ++i)
+            std::swap(left[4 + i], right[i]);
+        Dct8(left);
+        Dct8(right);
+        for (int u = 0; u < 8; ++u)
+        {
+            left[u].Store(out + u * 8);
+            right[u].Store(out + u * 8 + 4);
+        }
+    }
+
+    // Zig-zag position of each coefficient in natural (row major) order
+    const unsigned char kZigZag[64] = { 0, 1, 5, 6, 14, 15, 27, 28, 2, 4, 7, 13, 16, 26, 29, 42, 3, 8, 12, 17, 25, 30,
+        41, 43, 9, 11, 18, 24, 31, 40, 44, 53, 10, 19, 23, 32, 39, 45, 52, 54, 20, 22, 33, 38, 46, 51, 55, 60, 21, 34,
+        37, 47, 50, 56, 59, 61, 35, 36, 48, 49, 57, 58, 62, 63 };
+
+    // The example tables of the JPEG specification, Annex K
+    const unsigned char kLumaQuant[64] = { 16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55, 14, 13, 16, 24,
+        40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62, 18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113,
+        92, 49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99 };
+    const unsigned char kChromaQuant[64] = { 17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56,
+        99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99 };
+
+    const unsigned char kDcLumaCounts[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+    const unsigned char kDcChromaCounts[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+    const unsigned char kDcValues[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+    const unsigned char kAcLumaCounts[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+    const unsigned char kAcLumaValues[162] = {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14,
+        0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09,
+        0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a,
+        0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65,
+        0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88,
+        0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9,
+        0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca,
+        0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea,
+        0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa };
+    const unsigned char kAcChromaCounts[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+    const unsigned char kAcChromaValues[162] = {
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32,
+        0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16,
+        0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39,
+        0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64,
+        0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86,
+        0x87, 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+        0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8,
+        0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9,
+        0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa };
+
+    // Code and length of every symbol of a Huffman table, from the counts of codes of
+    // each length and the symbols in code order
+    struct HuffmanTable
+    {
+        unsigned short code[256] = {};
+        unsigned char length[256] = {};
+
+        HuffmanTable(const unsigned char* counts, const unsigned char* values)
+        {
+            unsigned next = 0;
+            int k = 0;
+            for (int bits = 1; bits <= 16; ++bits)
+            {
+                for (int i = 0; i < counts[bits - 1]; ++i, ++k)
+                {
+                    code[values[k]] = (unsigned short)next++;
+                    length[values[k]] = (unsigned char)bits;
+                }
+                next <<= 1;
+            }
+        }
+    };
+
+    struct Component
+    {
+        const HuffmanTable* dc;
+        const HuffmanTable* ac;
+        float scale[64];             // 1 / (quantizer * DCT scale), transposed like ForwardDct
+    };
+
+    // JPEG's bit stream: most significant bit first, every 0xff byte followed by a 0
+    struct BitWriter
+    {
+        std::vector<unsigned char>& out;
+        unsigned bits = 0;
+        int count = 0;
+
+        void Put(unsigned value, int length)
+        {
+            bits = (bits << length) | (value & ((1u << length) - 1));
+            count += length;
+            while (count >= 8)
+            {
+                unsigned char byte = (unsigned char)(bits >> (count - 8));
+                out.push_back(byte);
+                if (byte == 0xff)
+                    out.push_back(0);
+                count -= 8;
+            }
+        }
+        // Pads the last byte with ones
+        void Flush()
+        {
+            if (count)
+                Put(0x7f, 8 - count);
+        }
+    };
+
+    int BitLength(int value)
+    {
+        int bits = 0;
+        for (value = abs(value); value; value >>= 1)
+            bits++;
+        return bits;
+    }
+
+    // Magnitude category and bits of a coefficient, negative values as one's complement
+    void PutValue(BitWriter& writer, int value, int bits)
+    {
+        writer.Put(value < 0 ? value - 1 : value, bits);
+    }
+
+    void EncodeBlock(BitWriter& writer, const float* plane, int stride, const Component& component, int& previousDc)
+    {
+        float coefficients[64];
+        ForwardDct(plane, stride, coefficients);
+
+        // Quantize, rounding to nearest, into zig-zag order
+        int quantized[64];
+        for (int t = 0; t < 64; t += 4)
+        {
+            F4 scaled = F4::Load(coefficients + t) * F4::Load(component.scale + t);
+#ifdef NBIP_SSE2
+            __m128i rounded = _mm_cvtps_epi32(scaled.v);
+            alignas(16) int values[4];
+            _mm_store_si128((__m128i*)values, rounded);
+#else
+            int values[4];
+            for (int i = 0; i < 4; ++i)
+                values[i] = (int)(scaled.v[i] < 0 ? scaled.v[i] - 0.5f : scaled.v[i] + 0.5f);
+#endif
+            for (int i = 0; i < 4; ++i)
+            {
+                int n = (t + i) % 8 * 8 + (t + i) / 8; // natural order index
+                quantized[kZigZag[n]] = values[i];
+            }
+        }
+
+        int diff = quantized[0] - previousDc;
+        previousDc = quantized[0];
+        int bits = BitLength(diff);
+        writer.Put(component.dc->code[bits], component.dc->length[bits]);
+        if (bits)
+            PutValue(writer, diff, bits);
+
+        int last = 63;
+        while (last > 0 && quantized[last] == 0)
+            last--;
+        int run = 0;
+        for (int k = 1; k <= last; ++k)
+        {
+            if (quantized[k] == 0)
+            {
+                run++;
+                continue;
+            }
+            for (; run >= 16; run -= 16)
+                writer.Put(component.ac->code[0xf0], component.ac->length[0xf0]); // 16 zeros
+            bits = BitLength(quantized[k]);
+            int symbol = run << 4 | bits;
+            writer.Put(component.ac->code[symbol], component.ac->length[symbol]);
+            PutValue(writer, quantized[k], bits);
+            run = 0;
+        }
+        if (last < 63)
+            writer.Put(component.ac->code[0], component.ac->length[0]); // end of block
+    }
+
+    struct Layout
+    {
+        int h = 1, v = 1;           // luma samples per chroma sample across / down
+        int mcuWidth = 8, mcuHeight = 8;
+        int mcusAcross = 0;
+        int paddedWidth = 0;        // the image width rounded up to whole MCUs
+    };
+
+    // One row of MCUs, a restart interval of its own, into out
+    void EncodeMcuRow(const ImageBuffer& image, const Layout& layout, const Component* components, int row,
+        std::vector<unsigned char>& out)
+    {
+        TraceScope trace("io", "JPEG MCU row");
+        int width = image.width;
+        int y0 = row * layout.mcuHeight;
+        int rows = std::min(layout.mcuHeight, image.height - y0);
+        size_t stride = (size_t)width * 4;
+        std::vector<unsigned char> pixels(stride * rows);
+        image.ReadRegion(Rect(0, y0, width, y0 + rows), pixels.data(), stride);
+
+        // Colour conversion of the full MCU height, repeating the last row and column of
+        // the image into the padding
+        int planeWidth = layout.paddedWidth;
+        std::vector<float> planes((size_t)planeWidth * layout.mcuHeight * 3);
+        float* luma = planes.data();
+        float* cb = luma + (size_t)planeWidth * layout.mcuHeight;
+        float* cr = cb + (size_t)planeWidth * layout.mcuHeight;
+        for (int y = 0; y < layout.mcuHeight; ++y)
+        {
+            const unsigned char* src = &pixels[std::min(y, rows - 1) * stride];
+            float* outY = luma + (size_t)y * planeWidth;
+            float* outCb = cb + (size_t)y * planeWidth;
+            float* outCr = cr + (size_t)y * planeWidth;
+            int x = 0;
+#ifdef NBIP_SSE2
+            const __m128i mask = _mm_set1_epi32(0xff);
+            for (; x + 4 <= width; x += 4)
+            {
+                __m128i rgba = _mm_loadu_si128((const __m128i*)(src + x * 4));
+                F4 r{ _mm_cvtepi32_ps(_mm_and_si128(rgba, mask)) };
+                F4 g{ _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(rgba, 8), mask)) };
+                F4 b{ _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(rgba, 16), mask)) };
+                (r * F4::Set(0.299f) + g * F4::Set(0.587f) + b * F4::Set(0.114f) - F4::Set(128.0f)).Store(outY + x);
+                (r * F4::Set(-0.168736f) - g * F4::Set(0.331264f) + b * F4::Set(0.5f)).Store(outCb + x);
+                (r * F4::Set(0.5f) - g * F4::Set(0.418688f) - b * F4::Set(0.081312f)).Store(outCr + x);
+            }
+#endif
+            for (; x < planeWidth; ++x)
+            {
+                const unsigned char* p = src + std::min(x, width - 1) * 4;
+                float r = p[0], g = p[1], b = p[2];
+                outY[x] = 0.299f * r + 0.587f * g + 0.114f * b - 128.0f;
+                outCb[x] = -0.168736f * r - 0.331264f * g + 0.5f * b;
+                outCr[x] = 0.5f * r - 0.418688f * g - 0.081312f * b;
+            }
+        }
+
+        // Chroma averaged down in place, into the top left of its plane
+        int chromaWidth = planeWidth / layout.h;
+        if (layout.h > 1 || layout.v > 1)
+        {
+            float weight = 1.0f / (layout.h * layout.v);
+            for (float* plane : { cb, cr })
+            {
+                for (int y = 0; y < layout.mcuHeight / layout.v; ++y)
+                {
+                    for (int x = 0; x < chromaWidth; ++x)
+                    {
+                        float sum = 0;
+                        for (int dy = 0; dy < layout.v; ++dy)
+                            for (int dx = 0; dx < layout.h; ++dx)
+                                sum += plane[(size_t)(y * layout.v + dy) * planeWidth + x * layout.h + dx];
+                        plane[(size_t)y * planeWidth + x] = sum * weight;
+                    }
+                }
+            }
+        }
+
+        BitWriter writer{ out };
+        int dc[3] = { 0, 0, 0 };
+        for (int mcu = 0; mcu < layout.mcusAcross; ++mcu)
+        {
+            for (int by = 0; by < layout.v; ++by)
+                for (int bx = 0; bx < layout.h; ++bx)
+                    EncodeBlock(writer, luma + (size_t)by * 8 * planeWidth + mcu * layout.mcuWidth + bx * 8, planeWidth,
+                        components[0], dc[0]);
+            EncodeBlock(writer, cb + mcu * 8, planeWidth, components[1], dc[1]);
+            EncodeBlock(writer, cr + mcu * 8, planeWidth, components[2], dc[2]);
+        }
+        writer.Flush();
+    }
+
+    void Put16(std::vector<unsigned char>& out, unsigned value)
+    {
+        out.push_back((unsigned char)(value >> 8));
+        out.push_back((unsigned char)value);
+    }
+
+    void PutHuffmanTable(std::vector<unsigned char>& out, int tableClass, const unsigned char* counts,
+        const unsigned char* values, int valueCount)
+    {
+        out.push_back((unsigned char)tableClass);
+        out.insert(out.end(), counts, counts + 16);
+        out.insert(out.end(), values, values + valueCount);
+    }
+}
+
+bool WriteJpeg(const std::string& path, const ImageBuffer& image, int quality, int subsampling,
+    std::atomic<float>* progress)
+{
+    if (image.width <= 0 || image.height <= 0 || image.width > 65535 || image.height > 65535)
+        return false;
+
+    static const HuffmanTable dcLuma(kDcLumaCounts, kDcValues), dcChroma(kDcChromaCounts, kDcValues);
+    static const HuffmanTable acLuma(kAcLumaCounts, kAcLumaValues), acChroma(kAcChromaCounts, kAcChromaValues);
+
+    // libjpeg's quality scaling
+    quality = std::clamp(quality, 1, 100);
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    unsigned char tables[2][64];
+    for (int n = 0; n < 64; ++n)
+    {
+        tables[0][n] = (unsigned char)std::clamp((kLumaQuant[n] * scale + 50) / 100, 1, 255);
+        tables[1][n] = (unsigned char)std::clamp((kChromaQuant[n] * scale + 50) / 100, 1, 255);
+    }
+
+    // The DCT leaves coefficient (v, u) scaled by dctScale[v] * dctScale[u]
+    static const float dctScale[8] = { 1.0f * 2.828427125f, 1.387039845f * 2.828427125f, 1.306562965f * 2.828427125f,
+        1.175875602f * 2.828427125f, 1.0f * 2.828427125f, 0.785694958f * 2.828427125f, 0.541196100f * 2.828427125f,
+        0.275899379f * 2.828427125f };
+    Component components[3] = { { &dcLuma, &acLuma, {} }, { &dcChroma, &acChroma, {} }, { &dcChroma, &acChroma, {} } };
+    for (int c = 0; c < 3; ++c)
+    {
+        for (int t = 0; t < 64; ++t)
+        {
+            int v = t % 8, u = t / 8;
+            components[c].scale[t] = 1.0f / (tables[c ? 1 : 0][v * 8 + u] * dctScale[v] * dctScale[u]);
+        }
+    }
+
+    Layout layout;
+    layout.h = subsampling == 444 ? 1 : 2;
+    layout.v = subsampling == 420 ? 2 : 1;
+    layout.mcuWidth = 8 * layout.h;
+    layout.mcuHeight = 8 * layout.v;
+    layout.mcusAcross = (image.width + layout.mcuWidth - 1) / layout.mcuWidth;
+    layout.paddedWidth = layout.mcusAcross * layout.mcuWidth;
+    int mcuRows = (image.height + layout.mcuHeight - 1) / layout.mcuHeight;
+    // A restart interval is one row of MCUs, whose count has to fit in 16 bits
+    if (layout.mcusAcross > 65535)
+        return false;
+
+    OutputFile file;
+    if (!file.Open(path))
+        return false;
+
+    std::vector<unsigned char> header = { 0xff, 0xd8,                                    // SOI
+        0xff, 0xe0, 0, 16, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0 };             // JFIF 1.1, no thumbnail
+    header.insert(header.end(), { 0xff, 0xdb, 0, 132 });                                // quantization tables
+    for (int c = 0; c < 2; ++c)
+    {
+        header.push_back((unsigned char)c);
+        unsigned char zigzag[64];
+        for (int n = 0; n < 64; ++n)
+            zigzag[kZigZag[n]] = tables[c][n];
+        header.insert(header.end(), zigzag, zigzag + 64);
+    }
+    header.insert(header.end(), { 0xff, 0xc0, 0, 17, 8 });                              // baseline frame
+    Put16(header, image.height);
+    Put16(header, image.width);
+    header.insert(header.end(), { 3, 1, (unsigned char)(layout.h << 4 | layout.v), 0, 2, 0x11, 1, 3, 0x11, 1 });
+    header.insert(header.end(), { 0xff, 0xc4, 0x01, 0xa2 });                            // Huffman tables
+    PutHuffmanTable(header, 0x00, kDcLumaCounts, kDcValues, 12);
+    PutHuffmanTable(header, 0x10, kAcLumaCounts, kAcLumaValues, 162);
+    PutHuffmanTable(header, 0x01, kDcChromaCounts, kDcValues, 12);
+    PutHuffmanTable(header, 0x11, kAcChromaCounts, kAcChromaValues, 162);
+    header.insert(header.end(), { 0xff, 0xdd, 0, 4 });                                  // restart interval
+    Put16(header, layout.mcusAcross);
+    header.insert(header.end(), { 0xff, 0xda, 0, 12, 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 }); // scan
+    bool ok = file.Write(header.data(), header.size());
+
+    // A few rows per thread at a time keeps the memory bounded for huge images
+    int waveSize = (ThreadPool::Shared().GetThreadCount() + 1) * 2;
+    std::vector<std::vector<unsigned char>> wave(std::min(waveSize, mcuRows));
+    for (int first = 0; first < mcuRows && ok; first += waveSize)
+    {
+        int count = std::min(waveSize, mcuRows - first);
+        ThreadPool::Shared().ParallelFor(count, [&](int i) {
+            wave[i].clear();
+            EncodeMcuRow(image, layout, components, first + i, wave[i]);
+            // Restart marker between this row and the next
+            if (first + i + 1 < mcuRows)
+            {
+                wave[i].push_back(0xff);
+                wave[i].push_back((unsigned char)(0xd0 + (first + i) % 8));
+            }
+        });
+        for (int i = 0; i < count && ok; ++i)
+            ok = file.Write(wave[i].data(), wave[i].size());
+        if (progress)
+            *progress = (float)(first + count) / mcuRows;
+    }
+
+    const unsigned char end[2] = { 0xff, 0xd9 };
+    ok = ok && file.Write(end, 2);
+    return ok && file.Commit();
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <atomic>
+#include <string>
+
+class ImageBuffer;
+
+// Baseline JPEG encoding spread over the thread pool. Every row of MCUs is a restart
+// interval: its DC predictions start from zero and it ends on a byte boundary, so the rows
+// are encoded independently and joined with RST markers. Colour conversion, the forward
+// DCT and quantization work on four values at a time with SSE2 where it is available.
+// Alpha is dropped. Out of core images are read a row of MCUs at a time.
+// progress, when given, is raised from 0 to 1 as the file is written.
+//
+// quality 1 .. 100 scales the standard quantization tables the way libjpeg does.
+// subsampling is the chroma resolution: 444 (full), 422 (half across) or 420 (half both ways).
+bool WriteJpeg(const std::string& path, const ImageBuffer& image, int quality = 90, int subsampling = 420,
+	std::atomic<float>* progress = nullptr);
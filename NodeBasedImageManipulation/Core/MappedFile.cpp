@@ -0,0 +1,113 @@
+#include <atomic>
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    std::atomic<bool> mappingAllowed{ true };
+}
+
+void MappedFile::SetMappingAllowed(bool allowed)
+{
+    mappingAllowed = allowed;
+}
+
+// The mapping outlives the handles, so they are closed as soon as it exists
+bool MappedFile::Open(const char* path)
+{
+    Close();
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return false;
+    LARGE_INTEGER fileSize;
+    if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0 && mappingAllowed)
+    {
+        HANDLE fileMapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (fileMapping)
+        {
+            data = (const unsigned char*)MapViewOfFile(fileMapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(fileMapping);
+        }
+        size = data ? (size_t)fileSize.QuadPart : 0;
+    }
+#else
+    int file = open(path, O_RDONLY | O_CLOEXEC);
+    if (file < 0)
+        return false;
+    struct stat info;
+    bool sized = fstat(file, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0;
+    if (sized && !mappingAllowed)
+        copy.reserve((size_t)info.st_size);
+    else if (sized)
+    {
+        void* mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+        if (mapping != MAP_FAILED)
+        {
+            madvise(mapping, (size_t)info.st_size, MADV_SEQUENTIAL);
+            madvise(mapping, (size_t)info.st_size, MADV_WILLNEED);
+            data = (const unsigned char*)mapping;
+            size = (size_t)info.st_size;
+        }
+    }
+#endif
+    mapped = data != nullptr;
+
+    // Not mappable, read it instead
+    bool failed = false;
+    while (!mapped && !failed)
+    {
+        unsigned char chunk[64 * 1024];
+#ifdef _WIN32
+        DWORD got = 0;
+        failed = !ReadFile(file, chunk, sizeof(chunk), &got, nullptr);
+#else
+        ssize_t got = read(file, chunk, sizeof(chunk));
+        failed = got < 0;
+#endif
+        if (failed || got == 0)
+            break;
+        copy.insert(copy.end(), chunk, chunk + got);
+    }
+#ifdef _WIN32
+    CloseHandle(file);
+#else
+    close(file);
+#endif
+    if (!mapped)
+    {
+        if (failed || copy.empty())
+        {
+            Close();
+            return false;
+        }
+        data = copy.data();
+        size = copy.size();
+    }
+    return true;
+}
+
+void MappedFile::Close()
+{
+    if (mapped)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap((void*)data, size);
+#endif
+    }
+    data = nullptr;
+    size = 0;
+    mapped = false;
+    copy.clear();
+    copy.shrink_to_fit();
+}
@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+// A whole file mapped read only into memory, so decoders read its bytes straight from the
+// page cache instead of from a copy. The kernel is told the file is read front to back,
+// so it reads ahead aggressively and drops pages behind. Files that cannot be mapped
+// (pipes, some network file systems) are read into memory instead.
+class MappedFile
+{
+public:
+	MappedFile() {};
+	~MappedFile() { Close(); }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// False when the file cannot be opened or read. Empty files count as unreadable.
+	bool Open(const char* path);
+	// With mapping off every file is read into memory. For files another program may
+	// truncate while they are decoded: a mapping then faults (SIGBUS) where a copy only
+	// fails to decode.
+	static void SetMappingAllowed(bool allowed);
+	void Close();
+
+	const unsigned char* Data() const { return data; }
+	size_t Size() const { return size; }
+	// Whether Data() is a mapping rather than a copy
+	bool IsMapped() const { return mapped; }
+
+private:
+	const unsigned char* data = nullptr;
+	size_t size = 0;
+	bool mapped = false;
+	std::vector<unsigned char> copy;
+};
@@ -1,134 +1,150 @@
-#include <Windows.h>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
 #include "NodeUtils.h"
 #include "ImageBuffer.h"
+#include "MappedFile.h"
+#include "OutputFile.h"
+#include "PngWriter.h"
+#include "JpegWriter.h"
+#include "JpegDecoder.h"
+#include "QoiCodec.h"
+#include "Trace.h"
+#include "AllocationCounter.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-std::string OpenFileDialog() 
+// Decodes an encoded image held in memory into buffer
+bool LoadImageFromMemory(const void* data, size_t data_size, ImageBuffer* buffer)
 {
-    OPENFILENAMEA ofn;
-    CHAR szFile[260] = { 0 };
-    ZeroMemory(&ofn, sizeof(ofn));
-
-    ofn.lStructSize = sizeof(ofn);
-    ofn.hwndOwner = NULL; // or your main window handle
-    ofn.lpstrFile = szFile;
-    ofn.nMaxFile = sizeof(szFile);
-    ofn.lpstrFilter = "Image Files\0*.png;*.jpg;*.jpeg;*.bmp\0";
-    ofn.nFilterIndex = 1;
-    ofn.Flags = OFN_PATHMUSTEXIST | OFN_FILEMUSTEXIST;
-
-    if (GetOpenFileNameA(&ofn)) {
-        return std::string(ofn.lpstrFile);
-    }
-    return "";
-}
-
-std::string SaveFileDialog(const char* defaultExt) 
-{
-    char szFile[MAX_PATH] = { 0 };
-
-    OPENFILENAMEA ofn;
-    ZeroMemory(&ofn, sizeof(ofn));
-    ofn.lStructSize = sizeof(ofn);
-    ofn.lpstrFilter = "PNG Files\0*.png\0JPEG Files\0*.jpg;*.jpeg\0Bitmap Files\0*.bmp";
-    ofn.lpstrFile = szFile;
-    ofn.nMaxFile = sizeof(szFile);
-    ofn.lpstrDefExt = defaultExt;
-    ofn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT;
-    ofn.lpstrTitle = "Save Image As";
-
-    if (GetSaveFileNameA(&ofn)) {
-        return std::string(ofn.lpstrFile);
-    }
-
-    return "";
-}
-
-void HelpMarker(const char* desc)
-{
-    ImGui::TextDisabled("(?)");
-    if (ImGui::BeginItemTooltip())
+    // QOI, which stb_image does not read, decodes straight into the image
+    int image_width = 0;
+    int image_height = 0;
+    if (ReadQoiHeader((const unsigned char*)data, data_size, image_width, image_height))
     {
-        ImGui::PushTextWrapPos(ImGui::GetFontSize() * 35.0f);
-        ImGui::TextUnformatted(desc);
-        ImGui::PopTextWrapPos();
-        ImGui::EndTooltip();
+        buffer->Resize(image_width, image_height);
+        if (!buffer->imageData || !DecodeQoi((const unsigned char*)data, data_size, buffer->imageData, (size_t)image_width * 4))
+            return false;
+        buffer->MarkWritten(buffer->GetRect());
+        return true;
     }
-}
 
-void UploadTextureToOpenGL(const int width, const int height, const GLuint texture, unsigned char*& imageData, const bool update)
-{
-    glBindTexture(GL_TEXTURE_2D, texture);
-    if (update)
-        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, imageData);
-    else
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, imageData);
-
-    // Set texture filtering parameters
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-}
-
-// Simple helper function to load an image into a OpenGL texture with common settings
-bool LoadTextureFromMemory(const void* data, size_t data_size, ImageBuffer*& buffer)
-{
-    // Load from file
-    int image_width = 0;
-    int image_height = 0;
+    // stb_image takes the size as an int
+    if (data_size > INT_MAX)
+        return false;
     unsigned char* image_data = stbi_load_from_memory((const unsigned char*)data, (int)data_size, &image_width, &image_height, NULL, 4);
     if (image_data == NULL)
         return false;
 
-    // Create a OpenGL texture identifier
-    GLuint image_texture;
-    glGenTextures(1, &image_texture);
-    glBindTexture(GL_TEXTURE_2D, image_texture);
-
-    // Setup filtering parameters for display
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    // Upload pixels into texture
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image_width, image_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image_data);
-
-    buffer->texture = image_texture;
     buffer->width = image_width;
     buffer->height = image_height;
     buffer->imageData = image_data;
+    AllocationCounter::RecordAllocation((size_t)image_width * image_height * 4);
+    buffer->MarkWritten(buffer->GetRect());
 
     //stbi_image_free(image_data);
     return true;
 }
 
-// Open and read a file, then forward to LoadTextureFromMemory()
-bool LoadTextureFromFile(const char* file_name, ImageBuffer*& buffer)
+// Map a file and decode it in place with LoadImageFromMemory()
+bool LoadImageFromFile(const char* file_name, ImageBuffer* buffer)
 {
-    FILE* f = nullptr;
-    auto err = fopen_s(&f, file_name, "rb");
-    if (f == NULL)
+    TraceScope trace("io", "Decode", -1, file_name);
+    MappedFile file;
+    if (!file.Open(file_name))
         return false;
-    fseek(f, 0, SEEK_END);
-    size_t file_size = (size_t)ftell(f);
-    if (file_size == -1)
+    return LoadImageFromMemory(file.Data(), file.Size(), buffer);
+}
+
+bool LoadReducedImageFromFile(const char* file_name, size_t maxPixels, ImageBuffer* buffer)
+{
+    TraceScope trace("io", "Reduced decode", -1, file_name);
+    MappedFile file;
+    int width, height;
+    // At half size the entropy decoding still costs about as much as a full decode
+    if (!file.Open(file_name) || !ReadJpegHeader(file.Data(), file.Size(), width, height)
+        || (size_t)(width >> 1) * (height >> 1) <= maxPixels)
         return false;
-    fseek(f, 0, SEEK_SET);
-    void* file_data = IM_ALLOC(file_size);
-    fread(file_data, 1, file_size, f);
-    fclose(f);
-    bool ret = LoadTextureFromMemory(file_data, file_size, buffer);
-    IM_FREE(file_data);
-    return ret;
+    int shift = 2;
+    while (shift < 3 && (size_t)(width >> shift) * (height >> shift) > maxPixels)
+        shift++;
+    return DecodeJpegReduced(file.Data(), file.Size(), shift, buffer);
 }
 
 ImageBuffer* CreateBuffer(const std::string& path)
 {
     ImageBuffer* buffer = new ImageBuffer();
-    bool result = LoadTextureFromFile(&path[0], buffer);
+    bool result = LoadImageFromFile(&path[0], buffer);
     if (!result)
+    {
+        delete buffer;
         return nullptr;
+    }
 
     return buffer;
-}
\ No newline at end of file
+}
+// Writes the same 32 bit BMP as stbi_write_bmp, reading the image a band of rows at a time
+static bool SaveBmp(const std::string& path, const ImageBuffer* buffer, std::atomic<float>* progress)
+{
+    OutputFile file;
+    if (!file.Open(path))
+        return false;
+
+    int w = buffer->width, h = buffer->height;
+    unsigned char bytes[14 + 108] = {};
+    auto put32 = [&](int at, unsigned int v) { for (int i = 0; i < 4; ++i) bytes[at + i] = (unsigned char)(v >> (i * 8)); };
+    auto put16 = [&](int at, unsigned int v) { bytes[at] = (unsigned char)v; bytes[at + 1] = (unsigned char)(v >> 8); };
+    bytes[0] = 'B';
+    bytes[1] = 'M';
+    put32(2, (unsigned int)(14 + 108 + (unsigned long long)w * h * 4));
+    put32(10, 14 + 108);
+    put32(14, 108);
+    put32(18, w);
+    put32(22, h);
+    put16(26, 1);
+    put16(28, 32);
+    put32(30, 3); // BI_BITFIELDS
+    put32(54, 0xff0000);
+    put32(58, 0xff00);
+    put32(62, 0xff);
+    put32(66, 0xff000000u);
+    bool ok = file.Write(bytes, 14 + 108);
+
+    // Rows go bottom up as BGRA, a band is flipped and swizzled in place and written at once
+    const int bandRows = 32;
+    size_t stride = (size_t)w * 4;
+    std::vector<unsigned char> band(stride * bandRows);
+    for (int y1 = h; y1 > 0 && ok; y1 -= bandRows)
+    {
+        int y0 = y1 > bandRows ? y1 - bandRows : 0;
+        int rows = y1 - y0;
+        buffer->ReadRegion(Rect(0, y0, w, y1), band.data(), stride);
+        for (int y = 0; y < rows / 2; ++y)
+            std::swap_ranges(&band[y * stride], &band[(y + 1) * stride], &band[(rows - 1 - y) * stride]);
+        for (size_t i = 0; i < stride * rows; i += 4)
+            std::swap(band[i], band[i + 2]);
+        ok = file.Write(band.data(), stride * rows);
+        if (progress)
+            *progress = (float)(h - y0) / h;
+    }
+    return ok && file.Commit();
+}
+
+bool SaveImageToFile(const std::string& path, const std::string& ext, const ImageBuffer* buffer,
+    const EncodeOptions& options)
+{
+    TraceScope trace("io", "Encode", -1, path.c_str());
+    // Reads the image a strip at a time, out of core or not
+    if (ext == ".png")
+        return WritePng(path, *buffer, options.pngLevel, options.pngFilter, options.progress);
+    if (ext == ".jpg")
+        return WriteJpeg(path, *buffer, options.jpgQuality, options.jpgSubsampling, options.progress);
+    if (ext == ".bmp")
+        return SaveBmp(path, buffer, options.progress);
+    if (ext == ".qoi")
+        return WriteQoi(path, *buffer, options.progress);
+    return false;
+}
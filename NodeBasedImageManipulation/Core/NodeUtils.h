@@ -1,22 +1,36 @@
 #pragma once
+#include <atomic>
 #include <string>
-#include <GLFW/glfw3.h>
-#include "imgui.h"
 
 class ImageBuffer;
 
 template<typename T>
 T Clamp(T val, T lo, T hi)
 {
-    if (val < lo || val > hi)
-        val = abs(val - lo) <= abs(val - hi) ? lo : hi;
+    if (val < lo) return lo;
+    if (val > hi) return hi;
     return val;
 }
 
-std::string OpenFileDialog();
-std::string SaveFileDialog(const char* defaultExt = "png");
-void HelpMarker(const char* desc);
-void UploadTextureToOpenGL(int width, int height, GLuint texture, unsigned char*& imageData, bool update = false);
+bool LoadImageFromMemory(const void* data, size_t data_size, ImageBuffer* buffer);
+bool LoadImageFromFile(const char* file_name, ImageBuffer* buffer);
+// A quick stand-in for a large JPEG, decoded at 1/4 or 1/8 of its size (whichever first has
+// at most maxPixels) with its proxyShift set accordingly. False for other files and for
+// images whose half size fits maxPixels, those decode in full about as fast.
+bool LoadReducedImageFromFile(const char* file_name, size_t maxPixels, ImageBuffer* buffer);
 ImageBuffer* CreateBuffer(const std::string& path);
+// Encoder settings of SaveImageToFile
+struct EncodeOptions
+{
+    int pngLevel = 6;   // 0 (stored) .. 9, see WritePng
+    int pngFilter = -1; // -1 picks one per row, 0 .. 4 forces one
+    int jpgQuality = 90;        // 1 .. 100, see WriteJpeg
+    int jpgSubsampling = 420;   // chroma resolution: 444, 422 or 420
+    // Raised from 0 to 1 while the file is written, when set
+    std::atomic<float>* progress = nullptr;
+};
 
-
+// Encodes buffer as ext (".png", ".jpg", ".bmp" or ".qoi") into path. The file is replaced only
+// once it is complete, a failed export leaves whatever was there before.
+bool SaveImageToFile(const std::string& path, const std::string& ext, const ImageBuffer* buffer,
+    const EncodeOptions& options = EncodeOptions());
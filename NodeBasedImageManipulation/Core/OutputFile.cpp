@@ -0,0 +1,128 @@
+#include <atomic>
+#include <cstdio>
+#include "OutputFile.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+bool OutputFile::Open(const std::string& destination)
+{
+    Discard();
+    path = destination;
+    failed = false;
+    // Named after the process and a counter, created only when no such file exists yet
+    static std::atomic<unsigned> counter{ 0 };
+    for (int attempt = 0; attempt < 100; ++attempt)
+    {
+        tempPath = path + "." + std::to_string(getpid()) + "-" + std::to_string(counter++) + ".tmp";
+#ifdef _WIN32
+        HANDLE created = CreateFileA(tempPath.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_NEW,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (created != INVALID_HANDLE_VALUE)
+        {
+            handle = created;
+            return true;
+        }
+        if (GetLastError() != ERROR_FILE_EXISTS)
+            break;
+#else
+        file = open(tempPath.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (file >= 0)
+            return true;
+        if (errno != EEXIST)
+            break;
+#endif
+    }
+    tempPath.clear();
+    return false;
+}
+
+bool OutputFile::Write(const void* data, size_t size)
+{
+    const char* bytes = (const char*)data;
+    while (size > 0 && !failed)
+    {
+        // Large blocks go in pieces the system calls take in one go
+        size_t piece = size < ((size_t)1 << 30) ? size : ((size_t)1 << 30);
+#ifdef _WIN32
+        DWORD written = 0;
+        failed = !handle || !WriteFile(handle, bytes, (DWORD)piece, &written, nullptr);
+#else
+        ssize_t written = file < 0 ? -1 : write(file, bytes, piece);
+        if (written < 0 && errno == EINTR)
+            continue;
+        failed = written <= 0;
+#endif
+        if (!failed)
+        {
+            bytes += written;
+            size -= written;
+        }
+    }
+    return !failed;
+}
+
+bool OutputFile::Close()
+{
+    bool closed = true;
+#ifdef _WIN32
+    if (handle)
+        closed = CloseHandle(handle) != 0;
+    handle = nullptr;
+#else
+    if (file >= 0)
+        closed = close(file) == 0;
+    file = -1;
+#endif
+    return closed;
+}
+
+bool OutputFile::Commit()
+{
+    if (tempPath.empty())
+        return false;
+    // The data has to be on disk before the rename is, or a crash in between can leave an
+    // empty file where the old one was
+    bool ok = !failed;
+#ifdef _WIN32
+    ok = ok && FlushFileBuffers(handle) != 0;
+    ok = Close() && ok;
+    ok = ok && MoveFileExA(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+#else
+    ok = ok && fsync(file) == 0;
+    ok = Close() && ok;
+    ok = ok && rename(tempPath.c_str(), path.c_str()) == 0;
+    if (ok)
+    {
+        // And the rename itself. Not every file system can sync a directory, the file is
+        // complete either way.
+        size_t slash = path.find_last_of('/');
+        std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        int dirFile = open(dir.c_str(), O_RDONLY | O_CLOEXEC);
+        if (dirFile >= 0)
+        {
+            fsync(dirFile);
+            close(dirFile);
+        }
+    }
+#endif
+    if (!ok)
+        remove(tempPath.c_str());
+    tempPath.clear();
+    return ok;
+}
+
+void OutputFile::Discard()
+{
+    Close();
+    if (!tempPath.empty())
+        remove(tempPath.c_str());
+    tempPath.clear();
+}
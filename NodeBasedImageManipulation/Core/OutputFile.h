@@ -0,0 +1,35 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+// A file written straight through its descriptor, without stdio's buffer in between, so
+// callers should hand over large blocks. The bytes go to a temporary file next to the
+// destination that only replaces it on Commit, so readers see the old file or the complete
+// new one but never half an image. An uncommitted file is deleted again.
+class OutputFile
+{
+public:
+	OutputFile() {};
+	~OutputFile() { Discard(); }
+	OutputFile(const OutputFile&) = delete;
+	OutputFile& operator=(const OutputFile&) = delete;
+
+	bool Open(const std::string& path);
+	// False once any write has failed
+	bool Write(const void* data, size_t size);
+	// Closes the file and moves it over the destination
+	bool Commit();
+	void Discard();
+
+private:
+	bool Close();
+
+	std::string path;
+	std::string tempPath;
+#ifdef _WIN32
+	void* handle = nullptr;
+#else
+	int file = -1;
+#endif
+	bool failed = false;
+};
@@ -0,0 +1,140 @@
+#include "PerfCounters.h"
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    std::string g_error;
+
+#ifdef __linux__
+    enum Counter { Cycles, Instructions, CacheMisses, BranchMisses, CounterCount };
+
+    // One group per thread, read with a single syscall. Cycles and instructions are
+    // required, the cache and branch counters are left out where the CPU lacks them.
+    struct ThreadCounters
+    {
+        bool opened = false;
+        bool valid = false;
+        int fds[CounterCount] = { -1, -1, -1, -1 };
+        int slot[CounterCount] = { -1, -1, -1, -1 }; // position in the group read
+        std::string error;
+
+        ~ThreadCounters()
+        {
+            for (int fd : fds)
+                if (fd >= 0)
+                    close(fd);
+        }
+
+        int OpenCounter(unsigned long long config, int groupFd)
+        {
+            perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = config;
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.disabled = groupFd < 0 ? 1 : 0;
+            attr.exclude_kernel = 1; // allowed at the default perf_event_paranoid
+            attr.exclude_hv = 1;
+            return (int)syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+        }
+
+        void Open()
+        {
+            opened = true;
+            const unsigned long long configs[CounterCount] = {
+                PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+            int next = 0;
+            for (int c = 0; c < CounterCount; ++c)
+            {
+                fds[c] = OpenCounter(configs[c], fds[Cycles]);
+                if (fds[c] >= 0)
+                    slot[c] = next++;
+                else if (c <= Instructions)
+                {
+                    error = std::string("perf_event_open failed: ") + strerror(errno);
+                    if (errno == EACCES || errno == EPERM)
+                        error += " (see /proc/sys/kernel/perf_event_paranoid)";
+                    else if (errno == ENOENT || errno == ENODEV || errno == EOPNOTSUPP)
+                        error += " (no hardware counters here, e.g. inside a VM)";
+                    return;
+                }
+            }
+            valid = ioctl(fds[Cycles], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP) == 0;
+            if (!valid)
+                error = std::string("Cannot start the counters: ") + strerror(errno);
+        }
+
+        bool Read(PerfCounts& counts)
+        {
+            unsigned long long values[1 + CounterCount];
+            if (read(fds[Cycles], values, sizeof(values)) < (ssize_t)sizeof(unsigned long long))
+                return false;
+            unsigned long long* total[CounterCount] = { &counts.cycles, &counts.instructions, &counts.cacheMisses, &counts.branchMisses };
+            for (int c = 0; c < CounterCount; ++c)
+                *total[c] = slot[c] >= 0 && slot[c] < (int)values[0] ? values[1 + slot[c]] : 0;
+            return true;
+        }
+    };
+
+    ThreadCounters& CurrentCounters()
+    {
+        thread_local ThreadCounters counters;
+        if (!counters.opened)
+            counters.Open();
+        return counters;
+    }
+#endif
+}
+
+namespace PerfCounters
+{
+    std::atomic<bool> enabled{ false };
+
+    bool Enable(bool enable)
+    {
+        if (!enable)
+        {
+            enabled = false;
+            return true;
+        }
+#ifdef __linux__
+        // Opened here first so the reason can be shown if it does not work
+        ThreadCounters& counters = CurrentCounters();
+        if (!counters.valid)
+        {
+            g_error = counters.error;
+            return false;
+        }
+        g_error.clear();
+        enabled = true;
+        return true;
+#else
+        g_error = "Hardware counters are only read on Linux";
+        return false;
+#endif
+    }
+
+    const std::string& GetError()
+    {
+        return g_error;
+    }
+
+    bool Read(PerfCounts& counts)
+    {
+#ifdef __linux__
+        ThreadCounters& counters = CurrentCounters();
+        return counters.valid && counters.Read(counts);
+#else
+        return false;
+#endif
+    }
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <string>
+
+// Hardware event counts of some piece of work
+struct PerfCounts
+{
+	unsigned long long cycles = 0;
+	unsigned long long instructions = 0;
+	unsigned long long cacheMisses = 0;   // last level cache
+	unsigned long long branchMisses = 0;
+
+	double Ipc() const { return cycles ? (double)instructions / cycles : 0.0; }
+	double CacheMissesPerKiloInstruction() const { return instructions ? 1000.0 * cacheMisses / instructions : 0.0; }
+	double BranchMissesPerKiloInstruction() const { return instructions ? 1000.0 * branchMisses / instructions : 0.0; }
+	bool Empty() const { return cycles == 0 && instructions == 0; }
+
+	PerfCounts& operator+=(const PerfCounts& other)
+	{
+		cycles += other.cycles;
+		instructions += other.instructions;
+		cacheMisses += other.cacheMisses;
+		branchMisses += other.branchMisses;
+		return *this;
+	}
+};
+
+// The same, added to from several threads at once
+struct AtomicPerfCounts
+{
+	std::atomic<unsigned long long> cycles{ 0 }, instructions{ 0 }, cacheMisses{ 0 }, branchMisses{ 0 };
+
+	void Add(const PerfCounts& counts)
+	{
+		cycles += counts.cycles;
+		instructions += counts.instructions;
+		cacheMisses += counts.cacheMisses;
+		branchMisses += counts.branchMisses;
+	}
+	void Reset()
+	{
+		cycles = 0;
+		instructions = 0;
+		cacheMisses = 0;
+		branchMisses = 0;
+	}
+	PerfCounts Load() const
+	{
+		PerfCounts counts;
+		counts.cycles = cycles;
+		counts.instructions = instructions;
+		counts.cacheMisses = cacheMisses;
+		counts.branchMisses = branchMisses;
+		return counts;
+	}
+};
+
+// Per thread hardware counters (Linux perf_event_open, user space only). Off by default;
+// while off, or where the counters cannot be opened (other systems, containers, a high
+// kernel.perf_event_paranoid), PerfScope measures nothing and every count stays 0.
+namespace PerfCounters
+{
+	extern std::atomic<bool> enabled;
+
+	inline bool IsEnabled() { return enabled.load(std::memory_order_relaxed); }
+
+	// Returns false, with the reason in GetError(), when the counters cannot be opened
+	bool Enable(bool enable);
+	const std::string& GetError();
+
+	// Counts of the calling thread so far, opening its counters on first use
+	bool Read(PerfCounts& counts);
+}
+
+// Counts the events from construction until Stop() on the calling thread
+class PerfScope
+{
+public:
+	PerfScope()
+	{
+		if (PerfCounters::IsEnabled())
+			running = PerfCounters::Read(start);
+	}
+	PerfCounts Stop()
+	{
+		PerfCounts end;
+		if (!running || !PerfCounters::Read(end))
+			return PerfCounts();
+		running = false;
+		end.cycles -= start.cycles;
+		end.instructions -= start.instructions;
+		end.cacheMisses -= start.cacheMisses;
+		end.branchMisses -= start.branchMisses;
+		return end;
+	}
+
+private:
+	PerfCounts start;
+	bool running = false;
+};
@@ -0,0 +1,462 @@
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+#include "PngWriter.h"
+#include "ImageBuffer.h"
+#include "OutputFile.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+namespace
+{
+    const int kWindow = 32768;
+    const int kMinMatch = 3;
+    const int kMaxMatch = 258;
+    const int kHashBits = 15;
+    // Filtered bytes per strip: plenty to deflate well, few enough to keep every thread busy
+    const size_t kStripBytes = 256 * 1024;
+
+    // How hard each level looks for matches, after zlib's configuration table: hash chain
+    // links followed, the match length that ends the search, and whether a match is put
+    // off when the next position has a longer one
+    struct LevelParams
+    {
+        int chain;
+        int nice;
+        bool lazy;
+    };
+    const LevelParams kLevels[10] = {
+        { 0, 0, false }, { 4, 8, false }, { 5, 16, false }, { 32, 32, false }, { 16, 16, true },
+        { 32, 32, true }, { 128, 128, true }, { 256, 128, true }, { 1024, 258, true }, { 4096, 258, true } };
+
+    const unsigned short kLengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59,
+        67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    const unsigned char kLengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    const unsigned short kDistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513,
+        769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+    const unsigned char kDistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10,
+        11, 11, 12, 12, 13, 13 };
+
+    unsigned ReverseBits(unsigned code, int length)
+    {
+        unsigned reversed = 0;
+        for (int i = 0; i < length; ++i)
+            reversed |= ((code >> i) & 1) << (length - 1 - i);
+        return reversed;
+    }
+
+    struct Tables
+    {
+        // The fixed Huffman codes, bit reversed since deflate writes them MSB first
+        unsigned short literalCode[288];
+        unsigned char literalLength[288];
+        unsigned short distanceCode[30];
+        unsigned char lengthSymbol[kMaxMatch + 1];
+        // zlib's trick: distances up to 256 directly, longer ones by (distance - 1) >> 7
+        unsigned char distanceSymbol[512];
+        unsigned crc[256];
+
+        Tables()
+        {
+            for (int s = 0; s < 288; ++s)
+            {
+                if (s < 144)
+                    literalLength[s] = 8, literalCode[s] = (unsigned short)ReverseBits(0x30 + s, 8);
+                else if (s < 256)
+                    literalLength[s] = 9, literalCode[s] = (unsigned short)ReverseBits(0x190 + s - 144, 9);
+                else if (s < 280)
+                    literalLength[s] = 7, literalCode[s] = (unsigned short)ReverseBits(s - 256, 7);
+                else
+                    literalLength[s] = 8, literalCode[s] = (unsigned short)ReverseBits(0xc0 + s - 280, 8);
+            }
+            for (int s = 0; s < 29; ++s)
+                for (int length = kLengthBase[s]; length < kLengthBase[s] + (1 << kLengthExtra[s]) && length <= kMaxMatch; ++length)
+                    lengthSymbol[length] = (unsigned char)s;
+            for (int s = 0; s < 30; ++s)
+            {
+                distanceCode[s] = (unsigned short)ReverseBits(s, 5);
+                for (int distance = kDistanceBase[s]; distance < kDistanceBase[s] + (1 << kDistanceExtra[s]); ++distance)
+                    distanceSymbol[distance <= 256 ? distance - 1 : 256 + ((distance - 1) >> 7)] = (unsigned char)s;
+            }
+            for (unsigned n = 0; n < 256; ++n)
+            {
+                unsigned c = n;
+                for (int k = 0; k < 8; ++k)
+                    c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                crc[n] = c;
+            }
+        }
+    };
+
+    const Tables& GetTables()
+    {
+        static const Tables tables;
+        return tables;
+    }
+
+    unsigned Crc32(const unsigned char* data, size_t length)
+    {
+        const Tables& tables = GetTables();
+        unsigned crc = 0xffffffffu;
+        for (size_t i = 0; i < length; ++i)
+            crc = tables.crc[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+        return crc ^ 0xffffffffu;
+    }
+
+    const unsigned kAdlerBase = 65521;
+
+    unsigned Adler32(const unsigned char* data, size_t length)
+    {
+        unsigned a = 1, b = 0;
+        while (length)
+        {
+            // The most bytes before b can overflow
+            size_t n = std::min<size_t>(length, 5552);
+            length -= n;
+            while (n--)
+            {
+                a += *data++;
+                b += a;
+            }
+            a %= kAdlerBase;
+            b %= kAdlerBase;
+        }
+        return a | (b << 16);
+    }
+
+    // Checksum of two byte sequences back to back from the checksums of each, as zlib's
+    // adler32_combine
+    unsigned CombineAdler32(unsigned first, unsigned second, size_t secondLength)
+    {
+        unsigned remainder = (unsigned)(secondLength % kAdlerBase);
+        unsigned a = first & 0xffff;
+        unsigned b = (unsigned)(((unsigned long long)remainder * a) % kAdlerBase);
+        a += (second & 0xffff) + kAdlerBase - 1;
+        b += (first >> 16) + (second >> 16) + kAdlerBase - remainder;
+        if (a >= kAdlerBase) a -= kAdlerBase;
+        if (a >= kAdlerBase) a -= kAdlerBase;
+        if (b >= kAdlerBase * 2) b -= kAdlerBase * 2;
+        if (b >= kAdlerBase) b -= kAdlerBase;
+        return a | (b << 16);
+    }
+
+    void Put32(std::vector<unsigned char>& out, unsigned value)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+            out.push_back((unsigned char)(value >> shift));
+    }
+
+    // Deflate's bit stream: values go in least significant bit first
+    struct BitWriter
+    {
+        std::vector<unsigned char>& out;
+        unsigned long long bits = 0;
+        int count = 0;
+
+        void Put(unsigned value, int length)
+        {
+            bits |= (unsigned long long)value << count;
+            count += length;
+            while (count >= 8)
+            {
+                out.push_back((unsigned char)bits);
+                bits >>= 8;
+                count -= 8;
+            }
+        }
+        void Align()
+        {
+            if (count)
+                Put(0, 8 - count);
+        }
+    };
+
+    // data[start, end) as stored blocks
+    void Store(const unsigned char* data, size_t start, size_t end, BitWriter& writer)
+    {
+        for (size_t at = start; at < end;)
+        {
+            unsigned length = (unsigned)std::min<size_t>(65535, end - at);
+            writer.Put(0, 3); // not the last block, stored
+            writer.Align();
+            writer.Put(length, 16);
+            writer.Put(~length & 0xffff, 16);
+            writer.out.insert(writer.out.end(), data + at, data + at + length);
+            at += length;
+        }
+    }
+
+    // data[start, end) as one block with the fixed Huffman codes. Bytes before start are
+    // only history for matches.
+    void Compress(const unsigned char* data, size_t start, size_t end, int level, BitWriter& writer)
+    {
+        const Tables& tables = GetTables();
+        const LevelParams& params = kLevels[level];
+        std::vector<int> head((size_t)1 << kHashBits, -1);
+        std::vector<int> previous(kWindow);
+        auto hash = [&](size_t i) {
+            unsigned v = data[i] | data[i + 1] << 8 | data[i + 2] << 16;
+            return (v * 2654435761u) >> (32 - kHashBits);
+        };
+        auto insert = [&](size_t i) {
+            if (i + kMinMatch > end)
+                return;
+            unsigned h = hash(i);
+            previous[i & (kWindow - 1)] = head[h];
+            head[h] = (int)i;
+        };
+        // Longest earlier match of the bytes at i, 0 when there is none of kMinMatch
+        auto find = [&](size_t i, int& distance) {
+            if (i + kMinMatch > end)
+                return 0;
+            int limit = (int)std::min<size_t>(kMaxMatch, end - i);
+            int best = 0;
+            int chain = params.chain;
+            for (int candidate = head[hash(i)]; candidate >= 0 && i - candidate <= kWindow && chain-- > 0;
+                candidate = previous[candidate & (kWindow - 1)])
+            {
+                const unsigned char* a = data + candidate;
+                const unsigned char* b = data + i;
+                if (a[best] != b[best])
+                    continue;
+                int length = 0;
+                while (length < limit && a[length] == b[length])
+                    length++;
+                if (length > best)
+                {
+                    best = length;
+                    distance = (int)(i - candidate);
+                    if (length >= params.nice || length == limit)
+                        break;
+                }
+            }
+            return best >= kMinMatch ? best : 0;
+        };
+        auto symbol = [&](int s) { writer.Put(tables.literalCode[s], tables.literalLength[s]); };
+
+        for (size_t i = start > (size_t)kWindow ? start - kWindow : 0; i < start; ++i)
+            insert(i);
+        writer.Put(0, 1); // not the last block
+        writer.Put(1, 2); // fixed Huffman codes
+        int length = 0, distance = 0;
+        bool found = false;
+        for (size_t i = start; i < end;)
+        {
+            if (!found)
+                length = find(i, distance);
+            found = false;
+            insert(i);
+            if (length && params.lazy && length < params.nice)
+            {
+                // A longer match one byte on is worth a literal
+                int nextDistance = 0;
+                int next = find(i + 1, nextDistance);
+                if (next > length)
+                {
+                    symbol(data[i++]);
+                    length = next;
+                    distance = nextDistance;
+                    found = true;
+                    continue;
+                }
+            }
+            if (!length)
+            {
+                symbol(data[i++]);
+                continue;
+            }
+            int ls = tables.lengthSymbol[length];
+            symbol(257 + ls);
+            writer.Put(length - kLengthBase[ls], kLengthExtra[ls]);
+            int ds = tables.distanceSymbol[distance <= 256 ? distance - 1 : 256 + ((distance - 1) >> 7)];
+            writer.Put(tables.distanceCode[ds], 5);
+            writer.Put(distance - kDistanceBase[ds], kDistanceExtra[ds]);
+            for (int j = 1; j < length; ++j)
+                insert(i + j);
+            i += length;
+        }
+        symbol(256); // end of block
+    }
+
+    // Deflates data[start, end) as blocks that are not the last, ending byte aligned so
+    // whatever comes next can start on a fresh byte
+    void DeflateStrip(const unsigned char* data, size_t start, size_t end, int level, std::vector<unsigned char>& out)
+    {
+        size_t before = out.size();
+        BitWriter writer{ out };
+        if (level > 0)
+            Compress(data, start, end, level, writer);
+        // Noise grows under the fixed codes, like zlib store it instead then
+        size_t storedSize = end - start + (end - start + 65534) / 65535 * 5;
+        if (level == 0 || out.size() - before > storedSize)
+        {
+            out.resize(before);
+            writer.bits = 0;
+            writer.count = 0;
+            Store(data, start, end, writer);
+        }
+        // An empty stored block, zlib's sync flush
+        writer.Put(0, 3);
+        writer.Align();
+        writer.Put(0, 16);
+        writer.Put(0xffff, 16);
+    }
+
+    int Paeth(int a, int b, int c)
+    {
+        int p = a + b - c;
+        int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+        return pa <= pb && pa <= pc ? a : pb <= pc ? b : c;
+    }
+
+    // One of the five PNG filters of row against the row above, into out
+    void ApplyFilter(int type, const unsigned char* row, const unsigned char* above, int bytes, unsigned char* out)
+    {
+        for (int i = 0; i < bytes; ++i)
+        {
+            int a = i >= 4 ? row[i - 4] : 0;
+            int b = above[i];
+            int c = i >= 4 ? above[i - 4] : 0;
+            int predicted = type == 0 ? 0 : type == 1 ? a : type == 2 ? b : type == 3 ? (a + b) >> 1 : Paeth(a, b, c);
+            out[i] = (unsigned char)(row[i] - predicted);
+        }
+    }
+
+    // A filtered row: its filter type byte and the filtered bytes
+    void FilterRow(const unsigned char* row, const unsigned char* above, int bytes, int filter, unsigned char* out, unsigned char* scratch)
+    {
+        int best = filter;
+        if (best < 0)
+        {
+            // Small signed values tend to compress best
+            long long bestSum = -1;
+            for (int type = 0; type < 5; ++type)
+            {
+                ApplyFilter(type, row, above, bytes, scratch);
+                long long sum = 0;
+                for (int i = 0; i < bytes; ++i)
+                    sum += abs((signed char)scratch[i]);
+                if (bestSum < 0 || sum < bestSum)
+                {
+                    bestSum = sum;
+                    best = type;
+                }
+            }
+        }
+        out[0] = (unsigned char)best;
+        ApplyFilter(best, row, above, bytes, out + 1);
+    }
+
+    // One strip of rows as a complete IDAT chunk
+    struct Strip
+    {
+        std::vector<unsigned char> chunk;
+        unsigned adler = 1;
+        size_t length = 0; // filtered bytes the checksum covers
+    };
+
+    void EncodeStrip(const ImageBuffer& image, int y0, int y1, int level, int filter, Strip& strip)
+    {
+        TraceScope trace("io", "PNG strip");
+        int width = image.width;
+        size_t stride = (size_t)width * 4;
+        size_t rowBytes = stride + 1;
+        // Rows before the strip are filtered again as the deflater's history, and one more
+        // row is read for filtering the first of them
+        int historyRows = (int)((kWindow + rowBytes - 1) / rowBytes);
+        int h0 = std::max(0, y0 - historyRows);
+        int r0 = std::max(0, h0 - 1);
+        std::vector<unsigned char> pixels(stride * (y1 - r0));
+        image.ReadRegion(Rect(0, r0, width, y1), pixels.data(), stride);
+
+        std::vector<unsigned char> filtered(rowBytes * (y1 - h0));
+        std::vector<unsigned char> zeros(stride), scratch(stride);
+        for (int y = h0; y < y1; ++y)
+        {
+            const unsigned char* above = y == 0 ? zeros.data() : &pixels[(y - 1 - r0) * stride];
+            FilterRow(&pixels[(y - r0) * stride], above, (int)stride, filter, &filtered[(y - h0) * rowBytes], scratch.data());
+        }
+
+        size_t start = (y0 - h0) * rowBytes;
+        size_t end = (y1 - h0) * rowBytes;
+        strip.adler = Adler32(&filtered[start], end - start);
+        strip.length = end - start;
+
+        std::vector<unsigned char>& chunk = strip.chunk;
+        chunk.assign(8, 0);
+        chunk[4] = 'I', chunk[5] = 'D', chunk[6] = 'A', chunk[7] = 'T';
+        if (y0 == 0)
+        {
+            // zlib header: deflate with a 32K window, and the level class
+            chunk.push_back(0x78);
+            chunk.push_back(level <= 1 ? 0x01 : level <= 5 ? 0x5e : level == 6 ? 0x9c : 0xda);
+        }
+        DeflateStrip(filtered.data(), start, end, level, chunk);
+        size_t length = chunk.size() - 8;
+        for (int i = 0; i < 4; ++i)
+            chunk[i] = (unsigned char)(length >> (24 - i * 8));
+        Put32(chunk, Crc32(&chunk[4], length + 4));
+    }
+
+    void AppendChunk(std::vector<unsigned char>& out, const char* type, const std::vector<unsigned char>& data)
+    {
+        Put32(out, (unsigned)data.size());
+        size_t at = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data.begin(), data.end());
+        Put32(out, Crc32(&out[at], data.size() + 4));
+    }
+}
+
+bool WritePng(const std::string& path, const ImageBuffer& image, int level, int filter, std::atomic<float>* progress)
+{
+    if (image.width <= 0 || image.height <= 0)
+        return false;
+    level = std::clamp(level, 0, 9);
+    filter = std::clamp(filter, -1, 4);
+
+    OutputFile file;
+    if (!file.Open(path))
+        return false;
+
+    std::vector<unsigned char> bytes = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    std::vector<unsigned char> header;
+    Put32(header, image.width);
+    Put32(header, image.height);
+    header.insert(header.end(), { 8, 6, 0, 0, 0 }); // 8 bit RGBA, deflate, adaptive filters, no interlace
+    AppendChunk(bytes, "IHDR", header);
+    bool ok = file.Write(bytes.data(), bytes.size());
+
+    // A few strips per thread at a time keeps the memory bounded for huge images
+    size_t rowBytes = (size_t)image.width * 4 + 1;
+    int stripRows = (int)std::max<size_t>(1, kStripBytes / rowBytes);
+    int stripCount = (image.height + stripRows - 1) / stripRows;
+    int waveSize = (ThreadPool::Shared().GetThreadCount() + 1) * 2;
+    std::vector<Strip> wave(std::min(waveSize, stripCount));
+    unsigned adler = 1;
+    for (int first = 0; first < stripCount && ok; first += waveSize)
+    {
+        int count = std::min(waveSize, stripCount - first);
+        ThreadPool::Shared().ParallelFor(count, [&](int i) {
+            int y0 = (first + i) * stripRows;
+            EncodeStrip(image, y0, std::min(image.height, y0 + stripRows), level, filter, wave[i]);
+        });
+        for (int i = 0; i < count && ok; ++i)
+        {
+            adler = CombineAdler32(adler, wave[i].adler, wave[i].length);
+            ok = file.Write(wave[i].chunk.data(), wave[i].chunk.size());
+        }
+        if (progress)
+            *progress = (float)(first + count) / stripCount;
+    }
+
+    // The stream ends with an empty last block (fixed codes, just the end of block code)
+    // and the checksum
+    std::vector<unsigned char> tail = { 0x03, 0x00 };
+    Put32(tail, adler);
+    bytes.clear();
+    AppendChunk(bytes, "IDAT", tail);
+    AppendChunk(bytes, "IEND", {});
+    ok = ok && file.Write(bytes.data(), bytes.size());
+    return ok && file.Commit();
+}
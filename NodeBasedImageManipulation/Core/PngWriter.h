@@ -0,0 +1,19 @@
+#pragma once
+#include <atomic>
+#include <string>
+
+class ImageBuffer;
+
+// 8 bit RGBA PNG encoding spread over the thread pool. The image is cut into strips of
+// rows that are filtered and deflated in parallel. Each strip ends on a byte boundary with
+// an empty stored block (what zlib's Z_SYNC_FLUSH does), so the strips simply follow each
+// other in one zlib stream, and the strips' Adler-32 checksums are combined at the end.
+// Matches may still reach back into the previous strip, since the decoder has it by then.
+// Out of core images are read a strip at a time.
+// progress, when given, is raised from 0 to 1 as the file is written.
+//
+// level 0 stores the rows uncompressed, 1 .. 9 trade speed for size like zlib's levels.
+// filter -1 picks the filter of each row by the smallest sum of absolute filtered values
+// (the heuristic the PNG specification suggests), 0 .. 4 uses that filter for every row.
+bool WritePng(const std::string& path, const ImageBuffer& image, int level = 6, int filter = -1,
+	std::atomic<float>* progress = nullptr);
@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <cstring>
+#include "QoiCodec.h"
+#include "ImageBuffer.h"
+#include "OutputFile.h"
+#include "Trace.h"
+
+namespace
+{
+    const unsigned char kOpIndex = 0x00;
+    const unsigned char kOpDiff = 0x40;
+    const unsigned char kOpLuma = 0x80;
+    const unsigned char kOpRun = 0xc0;
+    const unsigned char kOpRgb = 0xfe;
+    const unsigned char kOpRgba = 0xff;
+    const unsigned char kMask = 0xc0;
+    const int kHeaderBytes = 14;
+    const unsigned char kEnd[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+    // The reference implementation's limit, keeps a damaged header from asking for the moon
+    const size_t kMaxPixels = 400000000;
+
+    struct Pixel
+    {
+        unsigned char r, g, b, a;
+
+        bool operator==(const Pixel& o) const { return memcmp(this, &o, 4) == 0; }
+        int Hash() const { return (r * 3 + g * 5 + b * 7 + a * 11) % 64; }
+    };
+
+    unsigned ReadBigEndian32(const unsigned char* p)
+    {
+        return (unsigned)p[0] << 24 | (unsigned)p[1] << 16 | (unsigned)p[2] << 8 | p[3];
+    }
+
+    // Collects the encoder's output and passes it on in blocks
+    struct Output
+    {
+        bool (*write)(void*, const void*, size_t);
+        void* context;
+        unsigned char bytes[64 * 1024];
+        size_t used = 0;
+        bool ok = true;
+
+        // Room for a run followed by the longest op, flushing when there is not
+        unsigned char* Reserve()
+        {
+            if (used + 6 > sizeof(bytes))
+                Flush();
+            return bytes + used;
+        }
+        void Flush()
+        {
+            ok = ok && write(context, bytes, used);
+            used = 0;
+        }
+    };
+}
+
+bool ReadQoiHeader(const unsigned char* data, size_t size, int& width, int& height)
+{
+    if (size < kHeaderBytes + sizeof(kEnd) || memcmp(data, "qoif", 4) != 0)
+        return false;
+    unsigned w = ReadBigEndian32(data + 4), h = ReadBigEndian32(data + 8);
+    if (w == 0 || h == 0 || h > kMaxPixels / w || data[12] < 3 || data[12] > 4)
+        return false;
+    width = (int)w;
+    height = (int)h;
+    return true;
+}
+
+bool DecodeQoi(const unsigned char* data, size_t size, unsigned char* dst, size_t dstStride)
+{
+    int width, height;
+    if (!ReadQoiHeader(data, size, width, height))
+        return false;
+
+    // Ops never read past the end marker's 8 bytes, so only the op start needs checking
+    size_t at = kHeaderBytes;
+    size_t end = size - sizeof(kEnd);
+    Pixel index[64] = {};
+    Pixel px = { 0, 0, 0, 255 };
+    int run = 0;
+    for (int y = 0; y < height; ++y)
+    {
+        Pixel* row = (Pixel*)(dst + y * dstStride);
+        for (int x = 0; x < width; ++x)
+        {
+            if (run > 0)
+                run--;
+            else
+            {
+                if (at >= end)
+                    return false;
+                unsigned char op = data[at++];
+                if (op == kOpRgb)
+                {
+                    px.r = data[at];
+                    px.g = data[at + 1];
+                    px.b = data[at + 2];
+                    at += 3;
+                }
+                else if (op == kOpRgba)
+                {
+                    memcpy(&px, data + at, 4);
+                    at += 4;
+                }
+                else if ((op & kMask) == kOpIndex)
+                    px = index[op];
+                else if ((op & kMask) == kOpDiff)
+                {
+                    px.r += ((op >> 4) & 3) - 2;
+                    px.g += ((op >> 2) & 3) - 2;
+                    px.b += (op & 3) - 2;
+                }
+                else if ((op & kMask) == kOpLuma)
+                {
+                    int next = data[at++];
+                    int dg = (op & 0x3f) - 32;
+                    px.r += dg - 8 + (next >> 4);
+                    px.g += dg;
+                    px.b += dg - 8 + (next & 0x0f);
+                }
+                else
+                    run = op & 0x3f;
+                index[px.Hash()] = px;
+            }
+            row[x] = px;
+        }
+    }
+    return true;
+}
+
+bool EncodeQoi(const ImageBuffer& image, bool (*write)(void*, const void*, size_t), void* context,
+    std::atomic<float>* progress)
+{
+    TraceScope trace("io", "QOI encode");
+    if (image.width <= 0 || image.height <= 0)
+        return false;
+
+    Output out{ write, context, {}, 0, true };
+    unsigned char header[kHeaderBytes] = { 'q', 'o', 'i', 'f' };
+    for (int i = 0; i < 4; ++i)
+    {
+        header[4 + i] = (unsigned char)((unsigned)image.width >> (24 - i * 8));
+        header[8 + i] = (unsigned char)((unsigned)image.height >> (24 - i * 8));
+    }
+    header[12] = 4; // RGBA
+    header[13] = 0; // sRGB with linear alpha
+    memcpy(out.bytes, header, kHeaderBytes);
+    out.used = kHeaderBytes;
+
+    Pixel index[64] = {};
+    Pixel prev = { 0, 0, 0, 255 };
+    int run = 0;
+    // Out of core images are read in pieces of a row
+    Pixel piece[4096];
+    for (int y = 0; y < image.height && out.ok; ++y)
+    {
+        for (int x0 = 0; x0 < image.width; x0 += 4096)
+        {
+            int count = std::min(4096, image.width - x0);
+            const Pixel* pixels = piece;
+            if (image.imageData)
+                pixels = (const Pixel*)(image.imageData + ((size_t)y * image.width + x0) * 4);
+            else
+                image.ReadRegion(Rect(x0, y, x0 + count, y + 1), (unsigned char*)piece, sizeof(piece));
+
+            for (int i = 0; i < count; ++i)
+            {
+                Pixel px = pixels[i];
+                if (px == prev)
+                {
+                    if (++run == 62)
+                    {
+                        *out.Reserve() = kOpRun | (run - 1);
+                        out.used++;
+                        run = 0;
+                    }
+                    continue;
+                }
+                unsigned char* op = out.Reserve();
+                if (run > 0)
+                {
+                    *op++ = kOpRun | (run - 1);
+                    run = 0;
+                }
+
+                int hash = px.Hash();
+                if (index[hash] == px)
+                    *op++ = kOpIndex | hash;
+                else
+                {
+                    index[hash] = px;
+                    if (px.a == prev.a)
+                    {
+                        signed char dr = px.r - prev.r, dg = px.g - prev.g, db = px.b - prev.b;
+                        signed char drg = dr - dg, dbg = db - dg;
+                        if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+                            *op++ = kOpDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2);
+                        else if (drg >= -8 && drg <= 7 && dg >= -32 && dg <= 31 && dbg >= -8 && dbg <= 7)
+                        {
+                            *op++ = kOpLuma | (dg + 32);
+                            *op++ = (drg + 8) << 4 | (dbg + 8);
+                        }
+                        else
+                        {
+                            *op++ = kOpRgb;
+                            *op++ = px.r;
+                            *op++ = px.g;
+                            *op++ = px.b;
+                        }
+                    }
+                    else
+                    {
+                        *op++ = kOpRgba;
+                        memcpy(op, &px, 4);
+                        op += 4;
+                    }
+                }
+                out.used = op - out.bytes;
+                prev = px;
+            }
+        }
+        if (progress && (y & 63) == 63)
+            *progress = (float)(y + 1) / image.height;
+    }
+    if (run > 0)
+    {
+        *out.Reserve() = kOpRun | (run - 1);
+        out.used++;
+    }
+    if (out.used + sizeof(kEnd) > sizeof(out.bytes))
+        out.Flush();
+    memcpy(out.bytes + out.used, kEnd, sizeof(kEnd));
+    out.used += sizeof(kEnd);
+    out.Flush();
+    if (progress)
+        *progress = 1.0f;
+    return out.ok;
+}
+
+bool WriteQoi(const std::string& path, const ImageBuffer& image, std::atomic<float>* progress)
+{
+    OutputFile file;
+    if (!file.Open(path))
+        return false;
+    auto write = [](void* context, const void* data, size_t size) {
+        return static_cast<OutputFile*>(context)->Write(data, size);
+    };
+    return EncodeQoi(image, write, &file, progress) && file.Commit();
+}
@@ -0,0 +1,22 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+class ImageBuffer;
+
+// The Quite OK Image format (qoiformat.org): lossless RGBA at a fraction of PNG's cost and
+// usually well under half of BMP's size, meant for intermediate and scratch images. Neither
+// direction touches the heap. The encoder streams through fixed buffers on the stack, and
+// the decoder writes straight into the caller's pixels.
+
+// Size of a QOI file's image, false when data is not a QOI file
+bool ReadQoiHeader(const unsigned char* data, size_t size, int& width, int& height);
+// Decodes data into width x height RGBA pixels at dst. False when data is damaged.
+bool DecodeQoi(const unsigned char* data, size_t size, unsigned char* dst, size_t dstStride);
+
+// Encodes image, in memory or out of core, handing the file to write() a few KB at a time.
+// Stops and fails as soon as write() returns false.
+bool EncodeQoi(const ImageBuffer& image, bool (*write)(void* context, const void* data, size_t size), void* context,
+	std::atomic<float>* progress = nullptr);
+bool WriteQoi(const std::string& path, const ImageBuffer& image, std::atomic<float>* progress = nullptr);
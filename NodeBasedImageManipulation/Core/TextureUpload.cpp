@@ -0,0 +1,283 @@
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <GLFW/glfw3.h>
+#include "TextureUpload.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+
+// The system headers stop at GL 1.1 on Windows, so everything newer used here is declared
+// locally and loaded at run time.
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_PIXEL_UNPACK_BUFFER
+#define GL_PIXEL_UNPACK_BUFFER 0x88EC
+#endif
+#ifndef GL_STREAM_DRAW
+#define GL_STREAM_DRAW 0x88E0
+#endif
+#ifndef GL_MAP_WRITE_BIT
+#define GL_MAP_WRITE_BIT 0x0002
+#define GL_MAP_INVALIDATE_BUFFER_BIT 0x0008
+#define GL_MAP_UNSYNCHRONIZED_BIT 0x0020
+#endif
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
+#ifndef GL_SYNC_GPU_COMMANDS_COMPLETE
+#define GL_SYNC_GPU_COMMANDS_COMPLETE 0x9117
+#define GL_SYNC_FLUSH_COMMANDS_BIT 0x00000001
+#define GL_TIMEOUT_EXPIRED 0x911B
+#endif
+#ifndef GL_MAJOR_VERSION
+#define GL_MAJOR_VERSION 0x821B
+#define GL_MINOR_VERSION 0x821C
+#endif
+#ifndef GL_CLAMP_TO_EDGE
+#define GL_CLAMP_TO_EDGE 0x812F
+#endif
+#ifndef GL_NUM_EXTENSIONS
+#define GL_NUM_EXTENSIONS 0x821D
+#endif
+
+typedef struct __GLsync* GLsync;
+
+namespace
+{
+    struct Functions
+    {
+        void (APIENTRY* GenBuffers)(GLsizei count, GLuint* buffers);
+        void (APIENTRY* DeleteBuffers)(GLsizei count, const GLuint* buffers);
+        void (APIENTRY* BindBuffer)(GLenum target, GLuint buffer);
+        void (APIENTRY* BufferData)(GLenum target, ptrdiff_t size, const void* data, GLenum usage);
+        void (APIENTRY* BufferStorage)(GLenum target, ptrdiff_t size, const void* data, GLbitfield flags);
+        void* (APIENTRY* MapBufferRange)(GLenum target, ptrdiff_t offset, ptrdiff_t length, GLbitfield access);
+        GLboolean (APIENTRY* UnmapBuffer)(GLenum target);
+        GLsync (APIENTRY* FenceSync)(GLenum condition, GLbitfield flags);
+        GLenum (APIENTRY* ClientWaitSync)(GLsync sync, GLbitfield flags, unsigned long long timeout);
+        void (APIENTRY* DeleteSync)(GLsync sync);
+        const GLubyte* (APIENTRY* GetStringi)(GLenum name, GLuint index);
+    };
+    Functions gl;
+
+    enum Mode { Direct, Ring, PersistentRing };
+    Mode g_mode = Direct;
+
+    // Two buffers: the next image is copied into one while the driver may still be
+    // reading the previous one out of the other
+    struct Slot
+    {
+        GLuint buffer = 0;
+        size_t capacity = 0;
+        unsigned char* mapped = nullptr; // persistent mapping, PersistentRing only
+        GLsync fence = nullptr;          // signalled once the texture has read the buffer
+    };
+    const int RingSize = 2;
+    Slot g_ring[RingSize];
+    int g_next = 0;
+
+    template<typename Fn>
+    bool Load(Fn& fn, TextureUpload::GetProcAddress getProc, const char* name)
+    {
+        fn = reinterpret_cast<Fn>(getProc(name));
+        return fn != nullptr;
+    }
+
+    bool HasExtension(const char* name)
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; ++i)
+        {
+            const char* extension = (const char*)gl.GetStringi(GL_EXTENSIONS, i);
+            if (extension && strcmp(extension, name) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    void Release(Slot& slot)
+    {
+        if (slot.fence)
+            gl.DeleteSync(slot.fence);
+        // Deleting a buffer unmaps it
+        if (slot.buffer)
+            gl.DeleteBuffers(1, &slot.buffer);
+        slot = Slot();
+    }
+
+    // Large images are copied by the pool, one memcpy is far from saturating memory bandwidth
+    void CopyPixels(unsigned char* dst, const unsigned char* src, size_t bytes)
+    {
+        const size_t chunk = (size_t)4 << 20;
+        int chunks = (int)((bytes + chunk - 1) / chunk);
+        if (chunks <= 2)
+        {
+            memcpy(dst, src, bytes);
+            return;
+        }
+        ThreadPool::Shared().ParallelFor(chunks, [&](int i) {
+            size_t offset = (size_t)i * chunk;
+            memcpy(dst + offset, src + offset, bytes - offset < chunk ? bytes - offset : chunk);
+        });
+    }
+
+    // Copies the pixels into the next buffer of the ring and leaves it bound for the texture
+    // call to read from. Returns null, with nothing bound, when that did not work out.
+    Slot* Stage(const unsigned char* pixels, size_t bytes)
+    {
+        Slot& slot = g_ring[g_next];
+        g_next = (g_next + 1) % RingSize;
+        if (slot.fence)
+        {
+            TraceScope trace("gl", "Wait for buffer");
+            while (gl.ClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000) == GL_TIMEOUT_EXPIRED) {}
+            gl.DeleteSync(slot.fence);
+            slot.fence = nullptr;
+        }
+
+        if (slot.capacity < bytes)
+        {
+            Release(slot);
+            gl.GenBuffers(1, &slot.buffer);
+            gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+            if (g_mode == PersistentRing)
+            {
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                gl.BufferStorage(GL_PIXEL_UNPACK_BUFFER, (ptrdiff_t)bytes, nullptr, flags);
+                slot.mapped = (unsigned char*)gl.MapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (ptrdiff_t)bytes, flags);
+                if (!slot.mapped)
+                {
+                    // Keep streaming, just without the persistent mapping
+                    gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                    Release(slot);
+                    g_mode = Ring;
+                    return nullptr;
+                }
+            }
+            else
+                gl.BufferData(GL_PIXEL_UNPACK_BUFFER, (ptrdiff_t)bytes, nullptr, GL_STREAM_DRAW);
+            slot.capacity = bytes;
+        }
+        else
+            gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+
+        // The fence has been waited for, so mapping needs no further synchronisation
+        unsigned char* dst = slot.mapped;
+        if (g_mode == Ring)
+            dst = (unsigned char*)gl.MapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, (ptrdiff_t)bytes,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        if (!dst)
+        {
+            gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return nullptr;
+        }
+        {
+            TraceScope trace("gl", "Copy to buffer");
+            CopyPixels(dst, pixels, bytes);
+        }
+        // Unmapping fails when the contents were lost, e.g. on a mode switch
+        if (g_mode == Ring && !gl.UnmapBuffer(GL_PIXEL_UNPACK_BUFFER))
+        {
+            gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            return nullptr;
+        }
+        return &slot;
+    }
+}
+
+namespace TextureUpload
+{
+    void Init(GetProcAddress getProc)
+    {
+        Shutdown();
+
+        // GL_MAJOR_VERSION is only known from GL 3 / GLES 3 on, earlier contexts leave 0
+        GLint major = 0, minor = 0;
+        glGetIntegerv(GL_MAJOR_VERSION, &major);
+        glGetIntegerv(GL_MINOR_VERSION, &minor);
+        while (glGetError() != GL_NO_ERROR) {}
+        const char* version = (const char*)glGetString(GL_VERSION);
+        bool es = version && strncmp(version, "OpenGL ES", 9) == 0;
+        int number = major * 10 + minor;
+        if (number < (es ? 30 : 32))
+            return;
+
+        bool loaded = Load(gl.GenBuffers, getProc, "glGenBuffers") &&
+            Load(gl.DeleteBuffers, getProc, "glDeleteBuffers") &&
+            Load(gl.BindBuffer, getProc, "glBindBuffer") &&
+            Load(gl.BufferData, getProc, "glBufferData") &&
+            Load(gl.MapBufferRange, getProc, "glMapBufferRange") &&
+            Load(gl.UnmapBuffer, getProc, "glUnmapBuffer") &&
+            Load(gl.FenceSync, getProc, "glFenceSync") &&
+            Load(gl.ClientWaitSync, getProc, "glClientWaitSync") &&
+            Load(gl.DeleteSync, getProc, "glDeleteSync") &&
+            Load(gl.GetStringi, getProc, "glGetStringi");
+        if (!loaded)
+            return;
+
+        // NBIP_TEXTURE_UPLOAD=direct or =pbo picks a slower path, to compare or to work
+        // around a driver
+        const char* forced = getenv("NBIP_TEXTURE_UPLOAD");
+        std::string force = forced ? forced : "";
+        if (force == "direct")
+            return;
+        g_mode = Ring;
+        if (force == "pbo")
+            return;
+
+        bool storage = es ? HasExtension("GL_EXT_buffer_storage") : number >= 44 || HasExtension("GL_ARB_buffer_storage");
+        if (storage && Load(gl.BufferStorage, getProc, es ? "glBufferStorageEXT" : "glBufferStorage"))
+            g_mode = PersistentRing;
+    }
+
+    void Shutdown()
+    {
+        if (g_mode == Direct)
+            return;
+        for (Slot& slot : g_ring)
+            Release(slot);
+        g_next = 0;
+        g_mode = Direct;
+    }
+
+    const char* GetMode()
+    {
+        switch (g_mode)
+        {
+        case PersistentRing: return "persistent PBO ring";
+        case Ring: return "PBO ring";
+        default: return "direct";
+        }
+    }
+
+    void Upload(unsigned int texture, int width, int height, const unsigned char* pixels, bool allocate)
+    {
+        TraceScope trace("gl", allocate ? "glTexImage2D" : "glTexSubImage2D", -1,
+            Trace::IsRecording() ? (std::to_string(width) + " x " + std::to_string(height) + ", " + GetMode()).c_str() : nullptr);
+        size_t bytes = (size_t)width * height * 4;
+        Slot* slot = g_mode != Direct && bytes ? Stage(pixels, bytes) : nullptr;
+        // With a buffer bound the pointer is an offset into it
+        const void* source = slot ? nullptr : pixels;
+
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        if (allocate)
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, source);
+        else
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, source);
+        if (slot)
+        {
+            slot->fence = gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+
+        // Set texture filtering parameters, edges must not wrap around into the other side
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+// Fills preview textures. Where the context has pixel buffer objects and fences (desktop
+// GL 3.2+, GLES 3) the pixels are copied into a ring of buffers and the texture is filled
+// from there: the driver transfers them asynchronously instead of stalling the frame, and
+// a fence per buffer keeps it from being overwritten while a transfer still reads it.
+// With GL 4.4 / ARB_buffer_storage the buffers stay mapped for good. Without any of this
+// glTexImage2D / glTexSubImage2D read straight from client memory.
+namespace TextureUpload
+{
+	typedef void (*GLProc)();
+	typedef GLProc(*GetProcAddress)(const char* name);
+
+	// With the context current, before the first Upload (glfwGetProcAddress will do)
+	void Init(GetProcAddress getProc);
+	// Deletes the buffers, call while the context is still current
+	void Shutdown();
+	// "persistent PBO ring", "PBO ring" or "direct"
+	const char* GetMode();
+
+	// Copies width x height RGBA pixels into texture. allocate (re)defines the texture at
+	// that size, otherwise it must already have it.
+	void Upload(unsigned int texture, int width, int height, const unsigned char* pixels, bool allocate);
+}
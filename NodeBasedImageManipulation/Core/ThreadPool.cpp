@@ -0,0 +1,137 @@
+#include "ThreadPool.h"
+#include "Trace.h"
+#include <algorithm>
+#include <atomic>
+
+ThreadPool::ThreadPool(int threadCount)
+{
+    if (threadCount <= 0)
+        threadCount = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+
+    for (int i = 0; i < threadCount; ++i)
+        workers.emplace_back(&ThreadPool::WorkerLoop, this);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& t : workers)
+        t.join();
+}
+
+ThreadPool& ThreadPool::Shared()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::Submit(std::function<void()> job)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        jobs.push(std::move(job));
+    }
+    wake.notify_one();
+}
+
+ThreadPool::Region* ThreadPool::FindRegion()
+{
+    for (Region* region = regions; region; region = region->nextRegion)
+    {
+        if (region->helpersWanted > 0 && region->next < region->count)
+            return region;
+    }
+    return nullptr;
+}
+
+void ThreadPool::Region::Drain()
+{
+    for (int i = next++; i < count; i = next++)
+        call(context, i);
+}
+
+void ThreadPool::WorkerLoop()
+{
+    static std::atomic<int> workerCount{ 0 };
+    Trace::SetThreadName("pool worker " + std::to_string(++workerCount));
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        Region* region = nullptr;
+        wake.wait(lock, [&] { return stopping || !jobs.empty() || (region = FindRegion()) != nullptr; });
+
+        // Loops in progress first, their callers are waiting on them
+        if (region)
+        {
+            region->helpersWanted--;
+            region->helpersActive++;
+            lock.unlock();
+            region->Drain();
+            lock.lock();
+            // Notified under the lock, the region is gone as soon as its caller sees 0
+            if (--region->helpersActive == 0)
+                region->done.notify_all();
+        }
+        else if (!jobs.empty())
+        {
+            std::function<void()> job = std::move(jobs.front());
+            jobs.pop();
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+        else if (stopping)
+            return;
+    }
+}
+
+void ThreadPool::ParallelFor(int count, void (*call)(void*, int), void* context, int maxThreads)
+{
+    if (count <= 0)
+        return;
+
+    int helpers = GetThreadCount();
+    if (maxThreads > 0)
+        helpers = std::min(helpers, maxThreads - 1);
+    helpers = std::min(helpers, count - 1);
+
+    if (helpers <= 0)
+    {
+        for (int i = 0; i < count; ++i)
+            call(context, i);
+        return;
+    }
+
+    // Indices are handed out from a shared counter so uneven work balances itself. Workers
+    // join while indices are left, the calling thread works through them too.
+    Region region;
+    region.call = call;
+    region.context = context;
+    region.count = count;
+    region.helpersWanted = helpers;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Region** tail = &regions;
+        while (*tail)
+            tail = &(*tail)->nextRegion;
+        *tail = &region;
+    }
+    wake.notify_all();
+
+    region.Drain();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (Region** link = &regions; *link; link = &(*link)->nextRegion)
+    {
+        if (*link == &region)
+        {
+            *link = region.nextRegion;
+            break;
+        }
+    }
+    region.done.wait(lock, [&region] { return region.helpersActive == 0; });
+}
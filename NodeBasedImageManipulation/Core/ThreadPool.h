@@ -0,0 +1,65 @@
+#pragma once
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <type_traits>
+
+// Fixed set of worker threads shared by everything that wants to run work off the
+// calling thread.
+class ThreadPool
+{
+public:
+	explicit ThreadPool(int threadCount = 0);
+	~ThreadPool();
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	static ThreadPool& Shared();
+
+	int GetThreadCount() const { return (int)workers.size(); }
+
+	void Submit(std::function<void()> job);
+
+	// Runs fn(0) .. fn(count - 1) across the workers and the calling thread and returns
+	// once every index has finished. maxThreads limits the number of threads taking part
+	// (0 = all of them). Must not be called from inside one of this pool's own jobs.
+	// fn is only referenced, never copied, so a call does not touch the heap.
+	template<typename Fn>
+	void ParallelFor(int count, Fn&& fn, int maxThreads = 0)
+	{
+		using Callable = std::remove_reference_t<Fn>;
+		ParallelFor(count, [](void* context, int i) { (*static_cast<Callable*>(context))(i); },
+			const_cast<void*>(static_cast<const void*>(&fn)), maxThreads);
+	}
+	void ParallelFor(int count, void (*call)(void* context, int index), void* context, int maxThreads);
+
+private:
+	// One ParallelFor in progress, it lives on the stack of the thread that called it
+	struct Region
+	{
+		void (*call)(void*, int) = nullptr;
+		void* context = nullptr;
+		int count = 0;
+		std::atomic<int> next{ 0 };
+		int helpersWanted = 0;  // guarded by mutex, like the rest below
+		int helpersActive = 0;
+		Region* nextRegion = nullptr;
+		std::condition_variable done;
+
+		void Drain();
+	};
+
+	void WorkerLoop();
+	Region* FindRegion();
+
+	std::vector<std::thread> workers;
+	std::queue<std::function<void()>> jobs;
+	Region* regions = nullptr; // in progress, oldest first
+	std::mutex mutex;
+	std::condition_variable wake;
+	bool stopping = false;
+};
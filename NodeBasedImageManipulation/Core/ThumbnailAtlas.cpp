@@ -0,0 +1,94 @@
+#include <GLFW/glfw3.h>
+#include "imgui.h"
+#include "ThumbnailAtlas.h"
+#include "ImageBuffer.h"
+#include "ImageResample.h"
+
+ThumbnailAtlas& ThumbnailAtlas::Shared()
+{
+    static ThumbnailAtlas atlas;
+    return atlas;
+}
+
+void ThumbnailAtlas::NewFrame()
+{
+    frame++;
+    updates = 0;
+}
+
+void ThumbnailAtlas::Clear()
+{
+    if (texture)
+        glDeleteTextures(1, &texture);
+    texture = 0;
+    slots.clear();
+    slotOfNode.clear();
+}
+
+int ThumbnailAtlas::FindSlot(unsigned int nodeId)
+{
+    auto found = slotOfNode.find(nodeId);
+    if (found != slotOfNode.end())
+        return found->second;
+
+    if ((int)slots.size() < SlotCount)
+    {
+        slots.emplace_back();
+        slots.back().nodeId = nodeId;
+        slotOfNode[nodeId] = (int)slots.size() - 1;
+        return (int)slots.size() - 1;
+    }
+    int oldest = -1;
+    for (int i = 0; i < (int)slots.size(); ++i)
+    {
+        if (slots[i].lastUsed < frame && (oldest < 0 || slots[i].lastUsed < slots[oldest].lastUsed))
+            oldest = i;
+    }
+    if (oldest < 0)
+        return -1;
+    slotOfNode.erase(slots[oldest].nodeId);
+    slots[oldest] = Slot();
+    slots[oldest].nodeId = nodeId;
+    slotOfNode[nodeId] = oldest;
+    return oldest;
+}
+
+void ThumbnailAtlas::Draw(unsigned int nodeId, const ImageBuffer* image)
+{
+    if (!image || (!image->imageData && !image->IsOutOfCore()) || image->width <= 0 || image->height <= 0)
+        return;
+    int index = FindSlot(nodeId);
+    if (index < 0)
+        return;
+    Slot& slot = slots[index];
+    slot.lastUsed = frame;
+
+    // A stale thumbnail still beats none while the budget is used up
+    if (slot.version != image->contentVersion && updates < MaxUpdatesPerFrame)
+    {
+        if (!texture)
+        {
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            // Thumbnails are drawn at their size, nearest keeps the slots from bleeding
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, AtlasSize, AtlasSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+        }
+        scratch.resize((size_t)SlotSize * SlotSize * 4);
+        MakeThumbnail(*image, SlotSize, scratch.data(), slot.width, slot.height);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, index % SlotsPerRow * SlotSize, index / SlotsPerRow * SlotSize,
+            slot.width, slot.height, GL_RGBA, GL_UNSIGNED_BYTE, scratch.data());
+        slot.version = image->contentVersion;
+        updates++;
+    }
+    if (!slot.width)
+        return;
+
+    float x = (float)(index % SlotsPerRow * SlotSize) / AtlasSize;
+    float y = (float)(index / SlotsPerRow * SlotSize) / AtlasSize;
+    ImGui::Image((ImTextureID)(intptr_t)texture, ImVec2((float)slot.width, (float)slot.height), ImVec2(x, y),
+        ImVec2(x + (float)slot.width / AtlasSize, y + (float)slot.height / AtlasSize));
+}
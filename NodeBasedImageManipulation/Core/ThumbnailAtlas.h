@@ -0,0 +1,53 @@
+#pragma once
+#include <unordered_map>
+#include <vector>
+
+class ImageBuffer;
+
+// Node thumbnails, all in slots of one shared texture so a canvas full of nodes draws them
+// without a texture per node. A thumbnail is made again only when the image's
+// contentVersion changes, and at most MaxUpdatesPerFrame of them per frame. When every
+// slot is taken the least recently drawn one goes. Needs a GL context.
+class ThumbnailAtlas
+{
+public:
+	static const int AtlasSize = 2048;
+	static const int SlotSize = 80;              // thumbnails fit in SlotSize x SlotSize
+	static const int SlotsPerRow = AtlasSize / SlotSize;
+	static const int SlotCount = SlotsPerRow * SlotsPerRow;
+	static const int MaxUpdatesPerFrame = 8;     // the rest waits for the next frame
+
+	static ThumbnailAtlas& Shared();
+
+	ThumbnailAtlas(const ThumbnailAtlas&) = delete;
+	ThumbnailAtlas& operator=(const ThumbnailAtlas&) = delete;
+
+	// Once per frame, before the nodes are drawn
+	void NewFrame();
+	// Draws nodeId's thumbnail of image as an ImGui item, nothing when there is none yet
+	void Draw(unsigned int nodeId, const ImageBuffer* image);
+	// Deletes the texture, call while the context is still current
+	void Clear();
+
+private:
+	ThumbnailAtlas() {};
+
+	struct Slot
+	{
+		unsigned int nodeId = 0;
+		unsigned int version = 0;  // contentVersion the pixels came from
+		int width = 0, height = 0;
+		unsigned long long lastUsed = 0;
+	};
+
+	// nodeId's slot, taken over from the least recently drawn node when it has none.
+	// -1 when every slot was drawn this frame.
+	int FindSlot(unsigned int nodeId);
+
+	unsigned int texture = 0;
+	std::vector<Slot> slots;
+	std::unordered_map<unsigned int, int> slotOfNode;
+	std::vector<unsigned char> scratch;
+	unsigned long long frame = 0;
+	int updates = 0;
+};
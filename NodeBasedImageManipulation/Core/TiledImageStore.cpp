@@ -0,0 +1,266 @@
+#include "TiledImageStore.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const size_t kTileBytes = (size_t)TiledImageStore::kTileSize * TiledImageStore::kTileSize * 4;
+
+    // Shared by every store, the resident limit is for the whole process
+    std::mutex g_mutex;
+    size_t g_residentLimit = (size_t)512 << 20;
+    size_t g_residentBytes = 0;
+    size_t g_peakResidentBytes = 0;
+    std::string g_scratchDirectory;
+
+    std::string ScratchDirectory()
+    {
+        if (!g_scratchDirectory.empty())
+            return g_scratchDirectory;
+        if (const char* dir = getenv("NBIP_SCRATCH_DIR"))
+            return dir;
+#ifdef _WIN32
+        char path[MAX_PATH];
+        DWORD length = GetTempPathA(MAX_PATH, path);
+        return length ? std::string(path, length) : std::string(".");
+#else
+        return "/var/tmp";
+#endif
+    }
+}
+
+TiledImageStore::Tile* TiledImageStore::lruFirst = nullptr;
+TiledImageStore::Tile* TiledImageStore::lruLast = nullptr;
+
+void TiledImageStore::LinkUnpinned(Tile& tile)
+{
+    tile.lruPrev = lruLast;
+    tile.lruNext = nullptr;
+    (lruLast ? lruLast->lruNext : lruFirst) = &tile;
+    lruLast = &tile;
+}
+
+void TiledImageStore::UnlinkUnpinned(Tile& tile)
+{
+    (tile.lruPrev ? tile.lruPrev->lruNext : lruFirst) = tile.lruNext;
+    (tile.lruNext ? tile.lruNext->lruPrev : lruLast) = tile.lruPrev;
+    tile.lruPrev = tile.lruNext = nullptr;
+}
+
+TiledImageStore::TiledImageStore(int width, int height)
+    : width(width), height(height)
+{
+    tilesX = (width + kTileSize - 1) / kTileSize;
+    tilesY = (height + kTileSize - 1) / kTileSize;
+    tiles.resize((size_t)tilesX * tilesY);
+    for (Tile& tile : tiles)
+        tile.owner = this;
+    unsigned long long fileSize = (unsigned long long)tiles.size() * kTileBytes;
+    std::string directory;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        directory = ScratchDirectory();
+    }
+
+    // The file only lives as long as the store and is never seen by anyone else. Tiles
+    // that are never written take no disk space.
+#ifdef _WIN32
+    char path[MAX_PATH];
+    if (!GetTempFileNameA(directory.c_str(), "nbi", 0, path))
+        return;
+    HANDLE handle = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS,
+        FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, nullptr);
+    if (handle == INVALID_HANDLE_VALUE)
+        return;
+    file = handle;
+    DWORD sparse = 0;
+    DeviceIoControl(handle, FSCTL_SET_SPARSE, nullptr, 0, nullptr, 0, &sparse, nullptr);
+    fileMapping = CreateFileMappingA(handle, nullptr, PAGE_READWRITE, (DWORD)(fileSize >> 32), (DWORD)fileSize, nullptr);
+    valid = fileMapping != nullptr;
+#else
+    std::string path = directory + "/nbip-tiles-XXXXXX";
+    file = mkstemp(&path[0]);
+    if (file < 0)
+        return;
+    unlink(path.c_str());
+    valid = ftruncate(file, (off_t)fileSize) == 0;
+#endif
+    if (!valid)
+        std::cerr << "Cannot create a " << (fileSize >> 20) << " MB scratch file in " << directory << std::endl;
+}
+
+TiledImageStore::~TiledImageStore()
+{
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        for (int i = 0; i < (int)tiles.size(); ++i)
+        {
+            if (tiles[i].mapping)
+            {
+                UnlinkUnpinned(tiles[i]);
+                UnmapTile(i);
+            }
+        }
+    }
+#ifdef _WIN32
+    if (fileMapping)
+        CloseHandle(fileMapping);
+    if (file)
+        CloseHandle(file);
+#else
+    if (file >= 0)
+        close(file);
+#endif
+}
+
+bool TiledImageStore::MapTile(int tileIndex)
+{
+    unsigned long long offset = (unsigned long long)tileIndex * kTileBytes;
+#ifdef _WIN32
+    void* mapping = MapViewOfFile(fileMapping, FILE_MAP_ALL_ACCESS, (DWORD)(offset >> 32), (DWORD)offset, kTileBytes);
+    if (!mapping)
+        return false;
+#else
+    void* mapping = mmap(nullptr, kTileBytes, PROT_READ | PROT_WRITE, MAP_SHARED, file, (off_t)offset);
+    if (mapping == MAP_FAILED)
+        return false;
+#endif
+    tiles[tileIndex].mapping = (unsigned char*)mapping;
+    g_residentBytes += kTileBytes;
+    g_peakResidentBytes = std::max(g_peakResidentBytes, g_residentBytes);
+    return true;
+}
+
+void TiledImageStore::UnmapTile(int tileIndex)
+{
+#ifdef _WIN32
+    UnmapViewOfFile(tiles[tileIndex].mapping);
+#else
+    munmap(tiles[tileIndex].mapping, kTileBytes);
+#endif
+    tiles[tileIndex].mapping = nullptr;
+    g_residentBytes -= kTileBytes;
+}
+
+void TiledImageStore::EvictFor(size_t bytes)
+{
+    // Tiles in use are never in the list, if they alone exceed the limit it is overrun
+    while (g_residentBytes + bytes > g_residentLimit && lruFirst)
+    {
+        Tile& victim = *lruFirst;
+        UnlinkUnpinned(victim);
+        victim.owner->UnmapTile((int)(&victim - victim.owner->tiles.data()));
+    }
+}
+
+unsigned char* TiledImageStore::Pin(int tileIndex)
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    Tile& tile = tiles[tileIndex];
+    if (tile.mapping)
+    {
+        if (tile.pins == 0)
+            UnlinkUnpinned(tile);
+    }
+    else
+    {
+        EvictFor(kTileBytes);
+        if (!MapTile(tileIndex))
+            return nullptr;
+    }
+    tile.pins++;
+    return tile.mapping;
+}
+
+void TiledImageStore::Unpin(int tileIndex)
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    Tile& tile = tiles[tileIndex];
+    if (--tile.pins == 0)
+        LinkUnpinned(tile);
+}
+
+template<typename Fn>
+void TiledImageStore::ForEachTile(const Rect& region, Fn&& fn)
+{
+    Rect clipped = region.Intersect(Rect(0, 0, width, height));
+    if (clipped.Empty() || !valid)
+        return;
+
+    for (int ty = clipped.y0 / kTileSize; ty <= (clipped.y1 - 1) / kTileSize; ++ty)
+    {
+        for (int tx = clipped.x0 / kTileSize; tx <= (clipped.x1 - 1) / kTileSize; ++tx)
+        {
+            int index = ty * tilesX + tx;
+            Rect tileRect(tx * kTileSize, ty * kTileSize, (tx + 1) * kTileSize, (ty + 1) * kTileSize);
+            unsigned char* pixels = Pin(index);
+            if (!pixels)
+            {
+                std::cerr << "Cannot map image tile " << tx << ", " << ty << std::endl;
+                continue;
+            }
+            ImageView tileView{ pixels, tileRect, kTileSize * 4, width, height };
+            fn(tileView, clipped.Intersect(tileRect));
+            Unpin(index);
+        }
+    }
+}
+
+void TiledImageStore::Read(const Rect& region, unsigned char* dst, size_t dstStride)
+{
+    ForEachTile(region, [&](const ImageView& tile, const Rect& part) {
+        size_t rowBytes = (size_t)part.Width() * 4;
+        for (int y = part.y0; y < part.y1; ++y)
+            memcpy(dst + (size_t)(y - region.y0) * dstStride + (size_t)(part.x0 - region.x0) * 4, tile.Pixel(part.x0, y), rowBytes);
+    });
+}
+
+void TiledImageStore::Write(const Rect& region, const unsigned char* src, size_t srcStride)
+{
+    ForEachTile(region, [&](const ImageView& tile, const Rect& part) {
+        size_t rowBytes = (size_t)part.Width() * 4;
+        for (int y = part.y0; y < part.y1; ++y)
+            memcpy(tile.Pixel(part.x0, y), src + (size_t)(y - region.y0) * srcStride + (size_t)(part.x0 - region.x0) * 4, rowBytes);
+    });
+}
+
+void TiledImageStore::SetResidentLimit(size_t bytes)
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_residentLimit = bytes;
+    EvictFor(0);
+}
+
+size_t TiledImageStore::GetResidentLimit()
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return g_residentLimit;
+}
+
+size_t TiledImageStore::GetResidentBytes()
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return g_residentBytes;
+}
+
+size_t TiledImageStore::GetPeakResidentBytes()
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return g_peakResidentBytes;
+}
+
+void TiledImageStore::SetScratchDirectory(const std::string& directory)
+{
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_scratchDirectory = directory;
+}
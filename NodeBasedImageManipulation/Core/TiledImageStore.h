@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "ImageRegion.h"
+
+// RGBA pixels kept in a scratch file instead of the heap, for images too big to hold in
+// memory. The file is split into kTileSize x kTileSize tiles that are memory mapped one by
+// one when touched. All stores share one resident limit: once the mapped tiles add up to
+// more than it, the least recently used tiles that nobody is reading or writing are
+// unmapped again and the OS writes them back to the file.
+//
+// Read and Write may be called from several threads at once, for different regions.
+class TiledImageStore
+{
+public:
+	static const int kTileSize = 256;
+
+	TiledImageStore(int width, int height);
+	~TiledImageStore();
+	TiledImageStore(const TiledImageStore&) = delete;
+	TiledImageStore& operator=(const TiledImageStore&) = delete;
+
+	// False when the scratch file could not be created
+	bool IsValid() const { return valid; }
+	int Width() const { return width; }
+	int Height() const { return height; }
+
+	// Copy region between the store and packed RGBA memory with the given row stride
+	void Read(const Rect& region, unsigned char* dst, size_t dstStride);
+	void Write(const Rect& region, const unsigned char* src, size_t srcStride);
+
+	// Bytes of tiles allowed to stay mapped across every store (default 512 MB)
+	static void SetResidentLimit(size_t bytes);
+	static size_t GetResidentLimit();
+	static size_t GetResidentBytes();
+	static size_t GetPeakResidentBytes();
+	// Where scratch files go. Defaults to $NBIP_SCRATCH_DIR, else the system temp folder
+	// (/var/tmp on Linux since /tmp is often RAM backed).
+	static void SetScratchDirectory(const std::string& directory);
+
+private:
+	// Mapped tiles nobody uses are linked in one list across every store, least recently
+	// used first. The links live in the tiles so pinning and unpinning never allocate.
+	struct Tile
+	{
+		unsigned char* mapping = nullptr;
+		int pins = 0;
+		TiledImageStore* owner = nullptr;
+		Tile* lruPrev = nullptr;
+		Tile* lruNext = nullptr;
+	};
+	static Tile* lruFirst;
+	static Tile* lruLast;
+	static void LinkUnpinned(Tile& tile);
+	static void UnlinkUnpinned(Tile& tile);
+
+	template<typename Fn>
+	void ForEachTile(const Rect& region, Fn&& fn);
+	unsigned char* Pin(int tileIndex);
+	void Unpin(int tileIndex);
+	bool MapTile(int tileIndex);
+	void UnmapTile(int tileIndex);
+	static void EvictFor(size_t bytes);
+
+	int width = 0, height = 0;
+	int tilesX = 0, tilesY = 0;
+	bool valid = false;
+	std::vector<Tile> tiles;
+#ifdef _WIN32
+	void* file = nullptr;
+	void* fileMapping = nullptr;
+#else
+	int file = -1;
+#endif
+};
@@ -0,0 +1,205 @@
+#include "Trace.h"
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+    // A few hundred bytes each, so a recording left running tops out at a few hundred MB
+    const size_t kMaxEventsPerThread = (size_t)1 << 20;
+
+    struct Event
+    {
+        const char* category;
+        std::string name;
+        std::string detail;
+        int nodeId;
+        long long startNs;
+        long long durationNs;
+    };
+
+    // Each thread appends to its own buffer, the lock is only contended while writing out
+    struct ThreadBuffer
+    {
+        int tid = 0;
+        std::string name;
+        std::mutex mutex;
+        std::vector<Event> events;
+        size_t dropped = 0;
+    };
+
+    std::mutex g_mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> g_buffers; // kept after their thread exits
+    std::atomic<long long> g_epochNs{ 0 }; // steady clock time of Start()
+
+    long long SteadyNs()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    ThreadBuffer& CurrentBuffer()
+    {
+        thread_local std::shared_ptr<ThreadBuffer> buffer;
+        if (!buffer)
+        {
+            buffer = std::make_shared<ThreadBuffer>();
+            std::lock_guard<std::mutex> lock(g_mutex);
+            buffer->tid = (int)g_buffers.size() + 1;
+            buffer->name = "thread " + std::to_string(buffer->tid);
+            g_buffers.push_back(buffer);
+        }
+        return *buffer;
+    }
+
+    void WriteEscaped(std::ostream& out, const std::string& text)
+    {
+        out << '"';
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                out << '\\' << c;
+            else if ((unsigned char)c < 0x20)
+            {
+                char code[8];
+                snprintf(code, sizeof(code), "\\u%04x", (unsigned char)c);
+                out << code;
+            }
+            else
+                out << c;
+        }
+        out << '"';
+    }
+}
+
+namespace Trace
+{
+    std::atomic<bool> recording{ false };
+
+    void Start()
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        for (auto& buffer : g_buffers)
+        {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            buffer->events.clear();
+            buffer->dropped = 0;
+        }
+        g_epochNs = SteadyNs();
+        recording = true;
+    }
+
+    void Stop()
+    {
+        recording = false;
+    }
+
+    size_t GetEventCount()
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        size_t count = 0;
+        for (auto& buffer : g_buffers)
+        {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            count += buffer->events.size();
+        }
+        return count;
+    }
+
+    bool WriteJson(const std::string& path)
+    {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+
+        int pid = (int)getpid();
+        size_t dropped = 0;
+        bool first = true;
+        auto separator = [&]() -> std::ostream& {
+            out << (first ? "\n" : ",\n");
+            first = false;
+            return out;
+        };
+
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+        std::lock_guard<std::mutex> lock(g_mutex);
+        for (auto& buffer : g_buffers)
+        {
+            std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+            dropped += buffer->dropped;
+            separator() << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": " << pid << ", \"tid\": " << buffer->tid
+                        << ", \"args\": {\"name\": ";
+            WriteEscaped(out, buffer->name);
+            out << "}}";
+
+            // Microseconds with the nanoseconds kept as decimals
+            char times[64];
+            for (const Event& e : buffer->events)
+            {
+                snprintf(times, sizeof(times), "\"ts\": %.3f, \"dur\": %.3f", e.startNs / 1000.0, e.durationNs / 1000.0);
+                separator() << "{\"ph\": \"X\", \"cat\": \"" << e.category << "\", \"name\": ";
+                WriteEscaped(out, e.name);
+                out << ", \"pid\": " << pid << ", \"tid\": " << buffer->tid << ", " << times;
+                if (e.nodeId >= 0 || !e.detail.empty())
+                {
+                    out << ", \"args\": {";
+                    if (e.nodeId >= 0)
+                        out << "\"node\": " << e.nodeId << (e.detail.empty() ? "" : ", ");
+                    if (!e.detail.empty())
+                    {
+                        out << "\"detail\": ";
+                        WriteEscaped(out, e.detail);
+                    }
+                    out << "}";
+                }
+                out << "}";
+            }
+        }
+        out << "\n], \"otherData\": {\"droppedEvents\": " << dropped << "}}\n";
+        return (bool)out;
+    }
+
+    void SetThreadName(const std::string& name)
+    {
+        ThreadBuffer& buffer = CurrentBuffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        buffer.name = name;
+    }
+
+    long long NowNs()
+    {
+        return SteadyNs() - g_epochNs.load(std::memory_order_relaxed);
+    }
+
+    void Record(const char* category, std::string&& name, int nodeId, std::string&& detail, long long startNs)
+    {
+        long long endNs = NowNs();
+        ThreadBuffer& buffer = CurrentBuffer();
+        std::lock_guard<std::mutex> lock(buffer.mutex);
+        if (buffer.events.size() >= kMaxEventsPerThread)
+        {
+            buffer.dropped++;
+            return;
+        }
+        buffer.events.push_back({ category, std::move(name), std::move(detail), nodeId, startNs, endNs - startNs });
+    }
+}
+
+void TraceScope::Begin(const char* category, const char* name, int nodeId, const char* detail)
+{
+    this->category = category;
+    this->name = name;
+    if (detail)
+        this->detail = detail;
+    this->nodeId = nodeId;
+    startNs = Trace::NowNs();
+}
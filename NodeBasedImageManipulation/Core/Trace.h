@@ -0,0 +1,54 @@
+#pragma once
+#include <atomic>
+#include <string>
+
+// Begin/end events of graph evaluation, file IO and texture uploads, written out in
+// the Chrome Trace Event format that chrome://tracing and ui.perfetto.dev open.
+// Nothing is recorded until Trace::Start(); until then a TraceScope costs one relaxed
+// atomic load.
+namespace Trace
+{
+	extern std::atomic<bool> recording;
+
+	inline bool IsRecording() { return recording.load(std::memory_order_relaxed); }
+
+	// Drops the events of an earlier recording
+	void Start();
+	void Stop();
+	size_t GetEventCount();
+	// {"traceEvents": [...]} with one complete ("X") event per scope
+	bool WriteJson(const std::string& path);
+	// Shown instead of "thread <n>" in trace viewers
+	void SetThreadName(const std::string& name);
+
+	// Used by TraceScope
+	long long NowNs();
+	void Record(const char* category, std::string&& name, int nodeId, std::string&& detail, long long startNs);
+}
+
+// Records the time from construction to destruction as one event on the calling thread
+class TraceScope
+{
+public:
+	TraceScope(const char* category, const char* name, int nodeId = -1, const char* detail = nullptr)
+	{
+		if (Trace::IsRecording())
+			Begin(category, name, nodeId, detail);
+	}
+	~TraceScope()
+	{
+		if (startNs >= 0)
+			Trace::Record(category, std::move(name), nodeId, std::move(detail), startNs);
+	}
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	void Begin(const char* category, const char* name, int nodeId, const char* detail);
+
+	const char* category = nullptr;
+	std::string name;
+	std::string detail;
+	int nodeId = -1;
+	long long startNs = -1;
+};
@@ -1,6 +1,12 @@
 #pragma once
 
 #include "graph.h"
+#include "Core/EditorUtils.h"
+#include "Core/Trace.h"
+#include "Core/TextureUpload.h"
+#include "Core/ImagePreview.h"
+#include "Core/ThumbnailAtlas.h"
+#include "imnodes.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 #include <GLFW/glfw3.h> // Will drag system OpenGL headers
@@ -9,6 +15,7 @@ using namespace std;
 
 int main()
 {
+    Trace::SetThreadName("main");
     if (!glfwInit())
         return 1;
 
@@ -81,6 +88,7 @@ int main()
     ImGui_ImplGlfw_InstallEmscriptenCallbacks(window, "#canvas");
 #endif
     ImGui_ImplOpenGL3_Init(glsl_version);
+    TextureUpload::Init(glfwGetProcAddress);
 
     // Our state
     bool show_demo_window = true;
@@ -88,7 +96,12 @@ int main()
 
     // Make graph a singleton
     Graph graph;
-    ImageBuffer* buffer = nullptr;
+    ImagePreview preview;
+    // Opening a file must not freeze the window while it decodes
+    InputNode::loadInBackground = true;
+    // Nor while it encodes and writes an export
+    OutputNode::exportInBackground = true;
+    Node::drawThumbnail = [](unsigned int nodeId, const ImageBuffer* image) { ThumbnailAtlas::Shared().Draw(nodeId, image); };
 
     while (!glfwWindowShouldClose(window))
     {
@@ -116,6 +129,7 @@ int main()
         // 1. Node Canvas
         {
             ImGui::Begin("Canvas");
+            ThumbnailAtlas::Shared().NewFrame();
             ImNodes::BeginNodeEditor();
 
             // Creates all nodes on the canvas
@@ -181,6 +195,50 @@ int main()
                 //ThresholdNode* inputN = new ThresholdNode(graph.GetNewId());
                 //graph.AddNode(inputN);
             //}
+
+            ImGui::Separator();
+            bool tiled = graph.IsTiledEvaluation();
+            if (ImGui::Checkbox("Tiled evaluation", &tiled))
+                graph.SetTiledEvaluation(tiled);
+            ImGui::SameLine();
+            HelpMarker("Runs chains of nodes 256x256 tiles at a time across all cores,\n"
+                "so intermediate images stay in cache.");
+
+            int proxyMode = static_cast<int>(graph.GetProxyMode());
+            const char* proxyModes[] = { "Off", "Auto", "1/4", "1/8" };
+            ImGui::SetNextItemWidth(100.0f);
+            if (ImGui::Combo("Interactive proxy", &proxyMode, proxyModes, IM_ARRAYSIZE(proxyModes)))
+                graph.SetProxyMode(static_cast<ProxyMode>(proxyMode));
+            ImGui::SameLine();
+            HelpMarker("While a slider is dragged the graph runs on a downscaled copy\n"
+                "of the inputs, full resolution follows once you let go.");
+
+            int pagedMegapixels = (int)(graph.GetOutOfCore() / 1000000);
+            ImGui::SetNextItemWidth(100.0f);
+            if (ImGui::InputInt("Out of core above (MP)", &pagedMegapixels, 16) && pagedMegapixels >= 0)
+                graph.SetOutOfCore((size_t)pagedMegapixels * 1000000);
+            ImGui::SameLine();
+            HelpMarker("Images of at least this many megapixels are kept in memory mapped\n"
+                "scratch files and paged in tile by tile, so huge scans fit.\n"
+                "0 keeps everything in memory. Needs tiled evaluation.");
+
+            ImGui::Separator();
+            if (ImGui::Button("Save Graph"))
+            {
+                string path = SaveFileDialog("nbg", GRAPH_FILE_FILTER);
+                if (!path.empty())
+                {
+                    graph.CaptureNodePositions();
+                    graph.Save(path);
+                }
+            }
+            ImGui::SameLine();
+            if (ImGui::Button("Load Graph"))
+            {
+                string path = OpenFileDialog(GRAPH_FILE_FILTER);
+                if (!path.empty())
+                    graph.Load(path);
+            }
             ImGui::End();
         }
 
@@ -193,6 +251,13 @@ int main()
             ImGui::End();
         }
 
+        // Time and memory spent in each node, see NodeStats
+        {
+            ImGui::Begin("Profiler");
+            graph.ShowProfiler();
+            ImGui::End();
+        }
+
         vector<int> selectedNodeIds = graph.GetSelectedNodes();
         vector<int> selectedLinkIds = graph.GetSelectedLinks();
  
@@ -210,19 +275,26 @@ int main()
             {
                 Node* selectedNode = graph.GetNodeFromId(selectedNodeIds[0]);
                 if (selectedNode)
-                    buffer = selectedNode->GetImageBuffer();
+                    graph.SetPreview(selectedNode, nullptr);
             }
             else if (selectedLinkIds.size())
             {
                 Link* selectedLink = graph.GetLinkFromId(selectedLinkIds[0]);
                 if (selectedLink)
-                    buffer = (ImageBuffer*)selectedLink->GetPropogatedData();
+                    graph.SetPreview(selectedLink->from_node, selectedLink->from_channel);
             }
 
-            ImGui::Begin("Image Preview");
+            // The wheel zooms the preview instead of scrolling the window
+            ImGui::Begin("Image Preview", nullptr, ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
 
+            // Only what is visible here gets computed until an export needs the rest
+            ImageBuffer* buffer = graph.GetPreviewBuffer();
             if (buffer)
-                buffer->ShowImage();
+            {
+                float displayScale = 1.0f;
+                Rect visible = preview.Show(buffer, &displayScale);
+                graph.SetPreviewRegion(visible, displayScale);
+            }
 
             ImGui::End();
         }
@@ -253,7 +325,11 @@ int main()
     EMSCRIPTEN_MAINLOOP_END;
 #endif
 
-    // Cleanup
+    // Cleanup, letting exports still in flight reach the disk
+    ExportQueue::Shared().WaitAll();
+    preview.Clear();
+    ThumbnailAtlas::Shared().Clear();
+    TextureUpload::Shutdown();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
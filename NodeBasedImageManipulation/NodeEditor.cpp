@@ -0,0 +1,866 @@
+#include "graph.h"
+#include "imnodes.h"
+#include "Core/EditorUtils.h"
+#include "Core/Trace.h"
+#include <algorithm>
+#include <map>
+
+// Node editor UI: the ImGui / ImNodes side of nodes and the graph.
+
+void Graph::InitiateLinks()
+{
+    for (Link* link : links)
+    {
+        ImNodes::Link(link->id, link->from_channel->id, link->to_channel->id);
+    }
+}
+
+void Graph::CreateNodesOnCanvas()
+{
+    for (Node* node : nodes)
+    {
+        // Nodes read from a saved graph go back where they were
+        if (node->positionPending)
+        {
+            ImNodes::SetNodeGridSpacePos(node->id, ImVec2(node->posX, node->posY));
+            node->positionPending = false;
+        }
+        // A group around the node tells whether one of its widgets is held
+        ImGui::BeginGroup();
+        node->CreateImNode();
+        ImGui::EndGroup();
+        m_editingParams |= ImGui::IsItemActive();
+    }
+}
+
+void Graph::CaptureNodePositions()
+{
+    for (Node* node : nodes)
+    {
+        ImVec2 pos = ImNodes::GetNodeGridSpacePos(node->id);
+        node->posX = pos.x;
+        node->posY = pos.y;
+    }
+}
+
+vector<int> Graph::GetSelectedNodes()
+{
+    int nSelNodes = ImNodes::NumSelectedNodes();
+    vector<int> selectedNodeIds;
+    if (nSelNodes)
+    {
+        selectedNodeIds.resize(nSelNodes);
+        ImNodes::GetSelectedNodes(&selectedNodeIds[0]);
+    }
+    return selectedNodeIds;
+}
+
+vector<int> Graph::GetSelectedLinks()
+{
+    int nSelLinks = ImNodes::NumSelectedLinks();
+    vector<int> selectedLinkIds;
+    if (nSelLinks)
+    {
+        selectedLinkIds.resize(nSelLinks);
+        ImNodes::GetSelectedLinks(&selectedLinkIds[0]);
+    }
+    return selectedLinkIds;
+}
+
+void Graph::ShowProperties()
+{
+    vector<int> nodeIds = GetSelectedNodes();
+    if (!nodeIds.size())
+        return;
+    Node* node = GetNodeFromId(nodeIds[0]);
+    if (node)
+    {
+        ImGui::BeginGroup();
+        node->CreateImNodeProperties();
+        ImGui::EndGroup();
+        m_editingParams |= ImGui::IsItemActive();
+    }
+}
+
+void Graph::ResetStats()
+{
+    for (Node* node : nodes)
+        node->stats.Reset();
+}
+
+void Graph::ShowProfiler()
+{
+    ImGui::Checkbox("Show in nodes", &NodeStats::showOverlay);
+    ImGui::SameLine();
+    if (ImGui::Button("Reset"))
+        ResetStats();
+
+    // Chrome trace of everything evaluated while recording, open it in ui.perfetto.dev
+    bool recording = Trace::IsRecording();
+    if (ImGui::Checkbox("Record trace", &recording))
+        recording ? Trace::Start() : Trace::Stop();
+    ImGui::SameLine();
+    ImGui::TextDisabled("%zu events", Trace::GetEventCount());
+    ImGui::SameLine();
+    static string traceStatus;
+    if (ImGui::Button("Save Trace"))
+    {
+        string path = SaveFileDialog("json", "Trace Files\0*.json\0");
+        if (path.empty())
+            path = "nbip-trace.json";
+        traceStatus = Trace::WriteJson(path) ? "Saved " + path : "Cannot write " + path;
+    }
+    if (!traceStatus.empty())
+        ImGui::TextDisabled("%s", traceStatus.c_str());
+
+    // IPC and misses per thousand instructions tell compute bound kernels from memory bound ones
+    bool counters = PerfCounters::IsEnabled();
+    if (ImGui::Checkbox("Hardware counters", &counters))
+        PerfCounters::Enable(counters);
+    if (!PerfCounters::GetError().empty())
+    {
+        ImGui::SameLine();
+        ImGui::TextDisabled("unavailable: %s", PerfCounters::GetError().c_str());
+    }
+    ImGui::SameLine();
+    HelpMarker("Cycles, instructions, last level cache misses and branch misses of every node evaluation "
+        "(Linux perf_event_open). LLC/ki and Br/ki are misses per thousand instructions.");
+
+    // Once buffers have their size, evaluating again should not touch the heap
+    const AllocationCounts& last = m_lastEvaluationHeap;
+    ImGui::Text("Last evaluation: %zu heap allocations, %s, peak %s", last.allocations, FormatBytes(last.bytes).c_str(),
+        FormatBytes(last.peakBytes).c_str());
+    static string steadyStatus;
+    if (ImGui::Button("Check steady state"))
+    {
+        AllocationCounts counts = CheckSteadyState();
+        steadyStatus = counts.allocations ? "Re-evaluation allocated " + std::to_string(counts.allocations) + " times, " +
+            FormatBytes(counts.bytes) : "Re-evaluation allocated nothing";
+    }
+    ImGui::SameLine();
+    HelpMarker("Evaluates the graph again with nothing changed (output nodes are skipped). The Heap column then "
+        "shows which nodes still allocated.");
+    if (!steadyStatus.empty())
+    {
+        ImGui::SameLine();
+        ImGui::TextDisabled("%s", steadyStatus.c_str());
+    }
+
+    if (ImGui::CollapsingHeader("By kernel"))
+    {
+        struct KernelTotals { int evaluations = 0; double wallMs = 0; PerfCounts perf; };
+        std::map<string, KernelTotals> kernels;
+        for (Node* n : nodes)
+        {
+            KernelTotals& totals = kernels[n->GetName()];
+            totals.evaluations += n->stats.evaluations;
+            totals.wallMs += n->stats.totalWallMs;
+            totals.perf += n->stats.totalPerf;
+        }
+        if (ImGui::BeginTable("Kernels", 6, ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders))
+        {
+            for (const char* header : { "Kernel", "Evals", "Total ms", "IPC", "LLC/ki", "Br/ki" })
+                ImGui::TableSetupColumn(header);
+            ImGui::TableHeadersRow();
+            for (auto& [name, totals] : kernels)
+            {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::TextUnformatted(name.c_str());
+                ImGui::TableNextColumn();
+                ImGui::Text("%d", totals.evaluations);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.1f", totals.wallMs);
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f", totals.perf.Ipc());
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f", totals.perf.CacheMissesPerKiloInstruction());
+                ImGui::TableNextColumn();
+                ImGui::Text("%.2f", totals.perf.BranchMissesPerKiloInstruction());
+            }
+            ImGui::EndTable();
+        }
+    }
+
+    enum Column { NameColumn, EvalsColumn, LastColumn, CpuColumn, TotalColumn, AllocatedColumn, ReadColumn, WrittenColumn,
+        HeapColumn, IpcColumn, CacheColumn, BranchColumn };
+    ImGuiTableFlags flags = ImGuiTableFlags_Sortable | ImGuiTableFlags_RowBg | ImGuiTableFlags_Borders |
+        ImGuiTableFlags_Resizable | ImGuiTableFlags_ScrollY;
+    if (!ImGui::BeginTable("Profiler", 12, flags))
+        return;
+    ImGui::TableSetupScrollFreeze(0, 1);
+    ImGui::TableSetupColumn("Node");
+    ImGui::TableSetupColumn("Evals");
+    ImGui::TableSetupColumn("Last ms");
+    ImGui::TableSetupColumn("CPU ms");
+    ImGui::TableSetupColumn("Total ms", ImGuiTableColumnFlags_DefaultSort | ImGuiTableColumnFlags_PreferSortDescending);
+    ImGui::TableSetupColumn("Allocated");
+    ImGui::TableSetupColumn("Read");
+    ImGui::TableSetupColumn("Written");
+    ImGui::TableSetupColumn("Heap");
+    ImGui::TableSetupColumn("IPC");
+    ImGui::TableSetupColumn("LLC/ki");
+    ImGui::TableSetupColumn("Br/ki");
+    ImGui::TableHeadersRow();
+
+    vector<Node*> rows(nodes.begin(), nodes.end());
+    if (ImGuiTableSortSpecs* specs = ImGui::TableGetSortSpecs())
+    {
+        if (specs->SpecsCount > 0)
+        {
+            const ImGuiTableColumnSortSpecs& sort = specs->Specs[0];
+            auto key = [&](const Node* n) -> double {
+                const NodeStats& s = n->stats;
+                switch (sort.ColumnIndex)
+                {
+                case EvalsColumn: return s.evaluations;
+                case LastColumn: return s.wallMs;
+                case CpuColumn: return s.cpuMs;
+                case TotalColumn: return s.totalWallMs;
+                case AllocatedColumn: return (double)s.bytesAllocated;
+                case ReadColumn: return (double)s.bytesRead;
+                case WrittenColumn: return (double)s.bytesWritten;
+                case HeapColumn: return (double)s.heap.allocations;
+                case IpcColumn: return s.perf.Ipc();
+                case CacheColumn: return s.perf.CacheMissesPerKiloInstruction();
+                case BranchColumn: return s.perf.BranchMissesPerKiloInstruction();
+                default: return n->id;
+                }
+            };
+            bool ascending = sort.SortDirection == ImGuiSortDirection_Ascending;
+            std::stable_sort(rows.begin(), rows.end(), [&](const Node* a, const Node* b) {
+                return ascending ? key(a) < key(b) : key(a) > key(b);
+            });
+        }
+    }
+
+    for (Node* n : rows)
+    {
+        const NodeStats& s = n->stats;
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("%s %u", n->GetName().c_str(), n->id);
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", s.evaluations);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2f", s.wallMs);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2f", s.cpuMs);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.1f", s.totalWallMs);
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(FormatBytes(s.bytesAllocated).c_str());
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(FormatBytes(s.bytesRead).c_str());
+        ImGui::TableNextColumn();
+        ImGui::TextUnformatted(FormatBytes(s.bytesWritten).c_str());
+        ImGui::TableNextColumn();
+        ImGui::Text("%zu", s.heap.allocations);
+        if (ImGui::IsItemHovered())
+            ImGui::SetTooltip("%s in the last evaluation, peak %s\n%zu allocations in total", FormatBytes(s.heap.bytes).c_str(),
+                FormatBytes(s.heap.peakBytes).c_str(), s.totalHeap.allocations);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2f", s.perf.Ipc());
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2f", s.perf.CacheMissesPerKiloInstruction());
+        ImGui::TableNextColumn();
+        ImGui::Text("%.2f", s.perf.BranchMissesPerKiloInstruction());
+    }
+    ImGui::EndTable();
+}
+
+void Node::ShowStatsOverlay()
+{
+    if (!NodeStats::showOverlay || stats.evaluations == 0)
+        return;
+    ImGui::TextDisabled("%.1f ms (cpu %.1f) | %s", stats.wallMs, stats.cpuMs, FormatBytes(stats.bytesAllocated).c_str());
+    if (ImGui::IsItemHovered())
+        ImGui::SetTooltip("%d evaluations, %.1f ms in total\nread %s, wrote %s", stats.evaluations, stats.totalWallMs,
+            FormatBytes(stats.bytesRead).c_str(), FormatBytes(stats.bytesWritten).c_str());
+}
+
+void Node::ShowThumbnail()
+{
+    if (drawThumbnail)
+        drawThumbnail(id, GetImageBuffer());
+}
+
+static int InputTextCallback(ImGuiInputTextCallbackData* data)
+{
+    if (data->EventFlag == ImGuiInputTextFlags_CallbackResize)
+    {
+        std::string* str = (std::string*)data->UserData;
+        str->resize(data->BufTextLen);
+        data->Buf = &(*str)[0];
+    }
+    return 0;
+}
+
+void InputNode::CreateImNode()
+{
+    ImNodes::BeginNode(id);
+
+    ImNodes::BeginNodeTitleBar();
+    ImGui::TextUnformatted(GetName().c_str());
+    ImNodes::EndNodeTitleBar();
+
+    int width = 0, height = 0;
+    if (data)
+    {
+        width = data->width;
+        height = data->height;
+    }
+
+    ImGui::Text("File Extention = %s ", fileExt.c_str());
+    if (IsLoading())
+        ImGui::TextDisabled(reduced ? "Loading full resolution..." : "Loading...");
+    else
+        ImGui::Text("Size = %d x %d", width, height);
+
+    ImGui::SetNextItemWidth(100.0f);
+    static ImGuiInputTextFlags flags = ImGuiInputTextFlags_ElideLeft | ImGuiInputTextFlags_CallbackResize;
+    if (ImGui::InputTextWithHint("File Path", "Enter path here...", &filePath[0], filePath.size() + 1, flags,
+        InputTextCallback, (void*)&filePath))
+    {
+        MarkDirty();
+    }
+
+    if (ImGui::Button("Open File"))
+    {
+        filePath = OpenFileDialog();
+        MarkDirty();
+    }
+
+    for (Channel* c : outputs)
+    {
+        ImNodes::BeginOutputAttribute(c->id);
+        ImGui::Indent(60);
+        ImGui::Text(c->name.c_str());
+        ImNodes::EndOutputAttribute();
+    }
+
+    ShowThumbnail();
+    ShowStatsOverlay();
+    ImNodes::EndNode();
+}
+
+void InputNode::CreateImNodeProperties()
+{
+    int width = 0, height = 0;
+    if (data)
+    {
+        width = data->width;
+        height = data->height;
+    }
+    ImGuiTableFlags flags = ImGuiTableFlags_BordersInnerV;
+    if (ImGui::BeginTable("table3", 2, flags))
+    {
+        ImGui::TableNextColumn();
+        ImGui::Text("File Path");
+        ImGui::TableNextColumn();
+        ImGui::Text(filePath.c_str());
+        ImGui::TableNextColumn();
+        ImGui::Text("File Extention");
+        ImGui::TableNextColumn();
+        ImGui::Text(fileExt.c_str());
+        ImGui::TableNextColumn();
+        ImGui::Text("Width");
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", width);
+        ImGui::TableNextColumn();
+        ImGui::Text("Height");
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", height);
+
+        ImGui::EndTable();
+    }
+    ImGui::PushItemWidth(100);
+    ImGui::PopItemWidth();
+}
+
+void OutputNode::CreateImNode()
+{
+    ImNodes::BeginNode(id);
+    ImNodes::BeginNodeTitleBar();
+    ImGui::TextUnformatted(GetName().c_str());
+    ImNodes::EndNodeTitleBar();
+
+    for (Channel* c : inputs)
+    {
+        ImNodes::BeginInputAttribute(c->id);
+        ImGui::Text(c->name.c_str());
+        ImNodes::EndInputAttribute();
+    }
+
+    ImGui::Spacing();
+    if (ImGui::Button("Save File"))
+    {
+        string path = SaveFileDialog();
+        // The graph exports on its next evaluation, after bringing the whole image up to date
+        if (!path.empty())
+            SetSavePath(path);
+    }
+    if (skippedLast)
+        ImGui::TextDisabled("Unchanged, not written again");
+    else if (exporting)
+    {
+        ExportQueue::State state = exporting->state;
+        if (state == ExportQueue::State::Queued)
+            ImGui::TextDisabled("Export queued");
+        else if (state == ExportQueue::State::Writing)
+        {
+            char label[32];
+            snprintf(label, sizeof(label), "Exporting %d%%", (int)(exporting->progress * 100));
+            ImGui::ProgressBar(exporting->progress, ImVec2(120.0f, 0.0f), label);
+        }
+        else if (state == ExportQueue::State::Done)
+            ImGui::Text("Saved");
+        else if (state == ExportQueue::State::Failed)
+            ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "Export failed");
+    }
+    ShowThumbnail();
+    ShowStatsOverlay();
+    ImNodes::EndNode();
+}
+
+void OutputNode::CreateImNodeProperties()
+{
+    int width = 0, height = 0;
+    if (outputs.size() && outputs[0]->data)
+    {
+        auto buffer = (ImageBuffer*)(outputs[0]->data);
+        width = buffer->width;
+        height = buffer->height;
+    }
+    ImGuiTableFlags flags = ImGuiTableFlags_BordersInnerV;
+    if (ImGui::BeginTable("table3", 2, flags))
+    {
+        ImGui::TableNextColumn();
+        ImGui::Text("Width");
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", width);
+        ImGui::TableNextColumn();
+        ImGui::Text("Height");
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", height);
+        ImGui::TableNextColumn();
+        ImGui::Text("PNG level");
+        ImGui::TableNextColumn();
+
+        ImGui::PushItemWidth(-FLT_MIN);
+        ImGui::PushID("propPngLevel");
+        if (ImGui::SliderInt("", &encodeOptions.pngLevel, 0, 9))
+        {
+            MarkDirty();
+        }
+        ImGui::PopID();
+        ImGui::TableNextColumn();
+        ImGui::Text("PNG filter");
+        ImGui::TableNextColumn();
+
+        // Adaptive picks a filter per row
+        const char* filters[] = { "Adaptive", "None", "Sub", "Up", "Average", "Paeth" };
+        int selectedFilter = encodeOptions.pngFilter + 1;
+        ImGui::PushItemWidth(-FLT_MIN);
+        ImGui::PushID("propPngFilter");
+        if (ImGui::Combo("", &selectedFilter, filters, IM_ARRAYSIZE(filters)))
+        {
+            encodeOptions.pngFilter = selectedFilter - 1;
+            MarkDirty();
+        }
+        ImGui::PopID();
+        ImGui::TableNextColumn();
+        ImGui::Text("JPEG quality");
+        ImGui::TableNextColumn();
+
+        ImGui::PushItemWidth(-FLT_MIN);
+        ImGui::PushID("propJpgQuality");
+        if (ImGui::SliderInt("", &encodeOptions.jpgQuality, 1, 100))
+        {
+            MarkDirty();
+        }
+        ImGui::PopID();
+        ImGui::TableNextColumn();
+        ImGui::Text("JPEG chroma");
+        ImGui::TableNextColumn();
+
+        const char* chromaModes[] = { "4:4:4", "4:2:2", "4:2:0" };
+        const int chromaValues[] = { 444, 422, 420 };
+        int selectedChroma = 2;
+        for (int i = 0; i < IM_ARRAYSIZE(chromaValues); ++i)
+            if (encodeOptions.jpgSubsampling == chromaValues[i])
+                selectedChroma = i;
+        ImGui::PushItemWidth(-FLT_MIN);
+        ImGui::PushID("propJpgChroma");
+        if (ImGui::Combo("", &selectedChroma, chromaModes, IM_ARRAYSIZE(chromaModes)))
+        {
+            encodeOptions.jpgSubsampling = chromaValues[selectedChroma];
+            MarkDirty();
+        }
+        ImGui::PopID();
+
+        ImGui::EndTable();
+    }
+    ImGui::PushItemWidth(100);
+    ImGui::PopItemWidth();
+}
+
+void BrightnessContrastNode::CreateImNode()
+{
+    ImNodes::BeginNode(id);
+    ImNodes::BeginNodeTitleBar();
+    ImGui::TextUnformatted(GetName().c_str());
+    ImNodes::EndNodeTitleBar();
+
+    for (Channel* c : inputs)
+    {
+        ImNodes::BeginInputAttribute(c->id);
+        ImGui::Text(c->name.c_str());
+        ImNodes::EndInputAttribute();
+    }
+
+    HelpMarker("Click to reset the Brightness");
+
+    ImGui::SameLine();
+    ImGui::PushID("Reset Brightness");
+    if (ImGui::Button(".."))
+    {
+        if (brightness != 0.0f)
+        {
+            brightness = 0.0f;
+            MarkDirty();
+        }
+    }
+    ImGui::PopID();
+
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(100.0f);
+    if (ImGui::SliderFloat("Brightness", &brightness, -100.0f, 100.0f, "%.3f"))
+    {
+        MarkDirty();
+    }
+
+    HelpMarker("Click to reset the Contrast");
+
+    ImGui::SameLine();
+    ImGui::PushID("Reset Contrast");
+    if (ImGui::Button(".."))
+    {
+        if (contrast != 1.0f)
+        {
+            contrast = 1.0f;
+            MarkDirty();
+        }
+    }
+    ImGui::PopID();
+
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(100.0f);
+    if (ImGui::SliderFloat("Contrast", &contrast, 0.0f, 3.0f, "%.3f"))
+    {
+        MarkDirty();
+    }
+
+    for (Channel* c : outputs)
+    {
+        ImNodes::BeginOutputAttribute(c->id);
+        ImGui::Indent(200);
+        ImGui::Text(c->name.c_str());
+        ImNodes::EndOutputAttribute();
+    }
+
+    ShowThumbnail();
+    ShowStatsOverlay();
+    ImNodes::EndNode();
+}
+
+void BrightnessContrastNode::CreateImNodeProperties()
+{
+    int width = 0, height = 0;
+    if (outputs[0]->data)
+    {
+        auto buffer = (ImageBuffer*)(outputs[0]->data);
+        width = buffer->width;
+        height = buffer->height;
+    }
+    ImGuiTableFlags flags = ImGuiTableFlags_BordersInnerV;
+    if (ImGui::BeginTable("table3", 2, flags))
+    {
+        ImGui::TableNextColumn();
+        ImGui::Text("Brightness");
+        ImGui::TableNextColumn();
+
+        ImGui::PushItemWidth(-FLT_MIN);
+        ImGui::PushID("propBrightness");
+        if (ImGui::SliderFloat("", &brightness, -100.0f, 100.0f, "%.3f"))
+        {
+            MarkDirty();
+        }
+        ImGui::PopID();
+        ImGui::TableNextColumn();
+        ImGui::Text("Contrast");
+        ImGui::TableNextColumn();
+
+        ImGui::PushItemWidth(-FLT_MIN);
+        ImGui::PushID("propContrast");
+        if (ImGui::SliderFloat("", &contrast, 0.0f, 3.0f, "%.3f"))
+        {
+            MarkDirty();
+        }
+        ImGui::PopID();
+        ImGui::TableNextColumn();
+        ImGui::Text("Width");
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", width);
+        ImGui::TableNextColumn();
+        ImGui::Text("Height");
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", height);
+
+        ImGui::EndTable();
+    }
+}
+
+void ColorChannelSplitterNode::CreateImNode()
+{
+    ImNodes::BeginNode(id);
+
+    ImNodes::BeginNodeTitleBar();
+    ImGui::TextUnformatted(GetName().c_str());
+    ImNodes::EndNodeTitleBar();
+
+    for (Channel* c : inputs)
+    {
+        ImNodes::BeginInputAttribute(c->id);
+        ImGui::Text(c->name.c_str());
+        ImNodes::EndInputAttribute();
+    }
+
+    for (size_t i = 0; i < outputs.size(); i++)
+    {
+        HelpMarker(
+            "Tick the checkbox for greyscale \n"
+            "representation of the channel.");
+
+        ImGui::SameLine();
+        ImGui::PushID(greyFlagNames[i].c_str());
+        if (ImGui::Checkbox(greyFlagName.c_str(), &greyFlags[i]))
+            MarkDirty();
+        ImGui::PopID();
+
+        ImGui::SameLine();
+        ImNodes::BeginOutputAttribute(outputs[i]->id);
+        ImGui::Indent(10);
+        ImGui::Text(outputs[i]->name.c_str());
+        ImNodes::EndOutputAttribute();
+    }
+
+    ShowThumbnail();
+    ShowStatsOverlay();
+    ImNodes::EndNode();
+}
+
+void ColorChannelSplitterNode::CreateImNodeProperties()
+{
+    int width = 0, height = 0;
+    if (outputs[0]->data)
+    {
+        auto buffer = (ImageBuffer*)(outputs[0]->data);
+        width = buffer->width;
+        height = buffer->height;
+    }
+    ImGuiTableFlags flags = ImGuiTableFlags_BordersInnerV;
+    if (ImGui::BeginTable("table3", 2, flags))
+    {
+        for (size_t i = 0; i < outputs.size(); i++)
+        {
+            ImGui::TableNextColumn();
+            ImGui::Text(greyFlagNames[i].c_str());
+
+            ImGui::TableNextColumn();
+            ImGui::PushID(greyFlagNames[i].c_str());
+            if (ImGui::Checkbox("", &greyFlags[i]))
+                MarkDirty();
+            ImGui::PopID();
+        }
+        ImGui::TableNextColumn();
+        ImGui::Text("Width");
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", width);
+        ImGui::TableNextColumn();
+        ImGui::Text("Height");
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", height);
+
+        ImGui::EndTable();
+    }
+}
+
+void BlurNode::CreateImNode()
+{
+    ImNodes::BeginNode(id);
+    ImNodes::BeginNodeTitleBar();
+    ImGui::TextUnformatted(GetName().c_str());
+    ImNodes::EndNodeTitleBar();
+
+    for (Channel* c : inputs)
+    {
+        ImNodes::BeginInputAttribute(c->id);
+        ImGui::Text(c->name.c_str());
+        ImNodes::EndInputAttribute();
+    }
+
+    int currentMode = static_cast<int>(direction);
+    const char* modes[] = { "Uniform", "Horizontal", "Vertical" };
+    ImGui::SetNextItemWidth(100.0f);
+    if (ImGui::Combo("Direction", &currentMode, modes, IM_ARRAYSIZE(modes)))
+    {
+        direction = static_cast<BlurDirection>(currentMode);
+        MarkDirty();
+    }
+
+    HelpMarker("Click to reset the Blur Radius");
+
+    ImGui::SameLine();
+    ImGui::PushID("Reset Blur Radius");
+    if (ImGui::Button(".."))
+    {
+        if (blurRadius != 0.0f)
+        {
+            blurRadius = 0.0f;
+            MarkDirty();
+        }
+    }
+    ImGui::PopID();
+
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(100.0f);
+    if (ImGui::SliderInt("Blur Radius", &blurSliderValue, 0, 20))
+    {
+        blurRadius = blurSliderValue;
+        MarkDirty();
+    }
+
+    for (Channel* c : outputs)
+    {
+        ImNodes::BeginOutputAttribute(c->id);
+        ImGui::Indent(150);
+        ImGui::Text(c->name.c_str());
+        ImNodes::EndOutputAttribute();
+    }
+
+    ShowThumbnail();
+    ShowStatsOverlay();
+    ImNodes::EndNode();
+}
+
+void BlurNode::CreateImNodeProperties()
+{
+    int width = 0, height = 0;
+    if (outputs[0]->data)
+    {
+        auto buffer = (ImageBuffer*)(outputs[0]->data);
+        width = buffer->width;
+        height = buffer->height;
+    }
+    ImGuiTableFlags flags = ImGuiTableFlags_BordersInnerV;
+    if (ImGui::BeginTable("table3", 2, flags))
+    {
+        ImGui::TableNextColumn();
+        ImGui::Text("Blur Radius");
+        ImGui::TableNextColumn();
+
+        ImGui::PushItemWidth(-FLT_MIN);
+        ImGui::PushID("propBlurRadius");
+        if (ImGui::SliderInt("", &blurSliderValue, 0, 20))
+        {
+            blurRadius = blurSliderValue;
+            MarkDirty();
+        }
+        ImGui::PopID();
+        ImGui::TableNextColumn();
+        ImGui::Text("Width");
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", width);
+        ImGui::TableNextColumn();
+        ImGui::Text("Height");
+        ImGui::TableNextColumn();
+        ImGui::Text("%d", height);
+
+        ImGui::EndTable();
+    }
+}
+
+void ThresholdNode::CreateImNode()
+{
+    ImNodes::BeginNode(id);
+    ImNodes::BeginNodeTitleBar();
+    ImGui::TextUnformatted(GetName().c_str());
+    ImNodes::EndNodeTitleBar();
+
+    for (Channel* c : inputs)
+    {
+        ImNodes::BeginInputAttribute(c->id);
+        ImGui::Text(c->name.c_str());
+        ImNodes::EndInputAttribute();
+    }
+
+    int currentMethod = static_cast<int>(thresholdMethod);
+    const char* methods[] = { "Binary", "Adaptive", "Otsu" };
+    ImGui::SetNextItemWidth(100.0f);
+    if (ImGui::Combo("Method", &currentMethod, methods, IM_ARRAYSIZE(methods)))
+    {
+        thresholdMethod = static_cast<ThresholdMethod>(currentMethod);
+        MarkDirty();
+    }
+
+    HelpMarker("Click to reset the Threshold");
+
+    ImGui::SameLine();
+    ImGui::PushID("Reset Threshold");
+    if (ImGui::Button(".."))
+    {
+        thresholdValue = 128;
+        if (thresholdValue != 128)
+        {
+            thresholdValue = 128;
+            MarkDirty();
+        }
+    }
+    ImGui::PopID();
+
+    ImGui::SameLine();
+    ImGui::SetNextItemWidth(100.0f);
+    if (ImGui::SliderInt("Threshold", &thresholdValue, 0, 256))
+    {
+        MarkDirty();
+    }
+
+    for (Channel* c : outputs)
+    {
+        ImNodes::BeginOutputAttribute(c->id);
+        ImGui::Indent(150);
+        ImGui::Text(c->name.c_str());
+        ImNodes::EndOutputAttribute();
+    }
+
+    float histogram[256];
+    float maxValue = 0;
+    if (outputs[0]->data)
+    {
+        ImageBuffer* buffer = ((ImageBuffer*)outputs[0]->data);
+        ComputeHistogram(buffer->imageData, buffer->width, buffer->height, histogram, maxValue);
+    }
+    ImGui::Text("Histogram");
+    ImGui::PushID("Threshold Histogram");
+    ImGui::SetNextItemWidth(200.0f);
+    ImGui::PlotHistogram("", histogram, 256, 0, nullptr, 0.0f, maxValue, ImVec2(0, 80.0f));
+    ImGui::PopID();
+    ShowThumbnail();
+    ShowStatsOverlay();
+    ImNodes::EndNode();
+}
+
+void ThresholdNode::CreateImNodeProperties()
+{
+}
\ No newline at end of file
@@ -1,59 +1,48 @@
-#include "Graph.h"
+#include "graph.h"
+#include <algorithm>
 #include <queue>
+#include <climits>
+#include <memory>
+#include <fstream>
+#include <sstream>
+#include "Core/ThreadPool.h"
+#include "Core/CpuTime.h"
+#include "Core/Trace.h"
 
-void Graph::InitiateLinks()
-{
-    for (Link* link : links)
-    {
-        ImNodes::Link(link->id, link->from_channel->id, link->to_channel->id);
-    }
-}
-
-void Graph::CreateNodesOnCanvas()
-{
-    for (Node* node : nodes)
-    {
-        node->CreateImNode();
-    }
-}
+static const Rect kFullFrame(INT_MIN / 4, INT_MIN / 4, INT_MAX / 4, INT_MAX / 4);
 
 void Graph::TopoSort(vector<Node*>& nodes)
 {
-    std::unordered_map<Node*, int> indegree;
-    for (Node* node : nodes) {
-        indegree[node] = 0;
-    }
-
-    std::unordered_map<Node*, std::vector<Node*>> deps;
-
-    for (Link* link : links) {
-        Node* from = link->from_node;
-        Node* to = link->to_node;
-        deps[from].push_back(to);  // from -> to (to depends on from)
-        indegree[link->to_node]++;
-    }
+    TraceScope trace("graph", "TopoSort");
+
+    // Runs on every evaluation, so everything works in place on reused vectors. Graphs
+    // are small enough for the linear searches.
+    auto indexOf = [&nodes](Node* node) {
+        return (size_t)(std::find(nodes.begin(), nodes.end(), node) - nodes.begin());
+    };
+    m_sortIndegree.assign(nodes.size(), 0);
+    for (Link* link : links)
+        m_sortIndegree[indexOf(link->to_node)]++;
 
-    std::queue<Node*> q;
-    for (auto& item : indegree) {
-        if (item.second == 0) q.push(item.first);
+    // Kahn's algorithm, the sorted list doubles as the queue
+    m_sorted.clear();
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        if (m_sortIndegree[i] == 0)
+            m_sorted.push_back(nodes[i]);
     }
-
-    std::vector<Node*> sorted;
-    while (!q.empty()) {
-        Node* current = q.front(); 
-        q.pop();
-        sorted.push_back(current);
-
-        for (Node* dep : deps[current]) {
-            indegree[dep]--;
-            if (indegree[dep] == 0) q.push(dep);
+    for (size_t head = 0; head < m_sorted.size(); ++head)
+    {
+        for (Link* link : links)
+        {
+            if (link->from_node == m_sorted[head] && --m_sortIndegree[indexOf(link->to_node)] == 0)
+                m_sorted.push_back(link->to_node);
         }
     }
 
-    if (sorted.size() != nodes.size()) {
-        // Cycle detected
-    }
-    nodes = sorted;
+    // A cycle leaves nodes unsorted, keep the old order rather than lose them
+    if (m_sorted.size() == nodes.size())
+        nodes.swap(m_sorted);
 }
 
 bool Graph::WouldCreateCycle(Node* from, Node* to) {
@@ -129,6 +118,9 @@ void Graph::DeleteNodes(vector<int>& nodeIDs)
             }),
         links.end());
 
+    if (m_previewNode && nodeIDSet.contains(m_previewNode->id))
+        SetPreview(nullptr, nullptr);
+
     // Delete nodes and remove from list
     nodes.erase(
         std::remove_if(nodes.begin(), nodes.end(),
@@ -175,14 +167,13 @@ void Graph::DeleteLinks(vector<int>& linkIDs)
 
 void Graph::PropagateData(Node* node)
 {
+    TraceScope trace("graph", "PropagateData", node->id);
     for (Channel* outPutChannel : node->outputs) {
         // Find all links starting from this output channel
         for (Link* link : links) {
             if (link->from_channel == outPutChannel) {
-                // Only propagate if output has valid data
-                if (outPutChannel->data != nullptr) {
-                    link->to_channel->data = outPutChannel->data;
-                }
+                // Propagate missing data too, so nothing downstream keeps a released buffer
+                link->to_channel->data = outPutChannel->data;
             }
         }
     }
@@ -190,59 +181,532 @@ void Graph::PropagateData(Node* node)
 
 bool Graph::Evaluate()
 {
+    for (Node* n : nodes)
+        n->Poll();
+    bool edited = false;
     for (Node* n : nodes)
     {
         if (n->IsDirty())
         {
+            edited = true;
             SetChanged(true);
             break;
         }
     }
+    UpdateProxyLevel(edited);
     if (!IsChanged()) return false;
 
-    TopoSort(nodes);
+    // Idle frames return above and leave no events
+    TraceScope trace("graph", "Graph::Evaluate");
+    AllocationScope heap;
+    m_workerHeap.Reset();
 
+    // Only the tiled path knows how to work on paged images
     for (Node* n : nodes)
+        n->SetOutOfCoreThreshold(m_tiledEvaluation ? m_outOfCorePixels : 0);
+
+    TopoSort(nodes);
+
+    if (m_tiledEvaluation)
     {
-        n->Evaluate();
-        PropagateData(n);
+        EvaluateTiled();
+    }
+    else
+    {
+        for (Node* n : nodes)
+        {
+            EvaluateNode(n);
+            PropagateData(n);
+        }
     }
     SetChanged(false);
-    return true;;
+    m_lastEvaluationHeap = heap.Stop();
+    m_lastEvaluationHeap += m_workerHeap.Load();
+    return true;
 }
 
-vector<int> Graph::GetSelectedNodes()
+AllocationCounts Graph::CheckSteadyState()
 {
-    int nSelNodes = ImNodes::NumSelectedNodes();
-    vector<int> selectedNodeIds;
-    if (nSelNodes)
+    Evaluate();
+    for (Node* n : nodes)
+        n->MarkDirty();
+    for (Node* n : nodes)
     {
-        selectedNodeIds.resize(nSelNodes);
-        ImNodes::GetSelectedNodes(&selectedNodeIds[0]);
+        if (n->type == NodeType::Output)
+            n->MarkClean();
     }
-    return selectedNodeIds;
+    SetChanged(true);
+    Evaluate();
+    return m_lastEvaluationHeap;
 }
 
-vector<int> Graph::GetSelectedLinks()
+static size_t ImageBytes(const vector<Channel*>& channels)
 {
-    int nSelLinks = ImNodes::NumSelectedLinks();
-    vector<int> selectedLinkIds;
-    if (nSelLinks)
+    size_t bytes = 0;
+    for (Channel* c : channels)
     {
-        selectedLinkIds.resize(nSelLinks);
-        ImNodes::GetSelectedLinks(&selectedLinkIds[0]);
+        ImageBuffer* image = static_cast<ImageBuffer*>(c->data);
+        if (image)
+            bytes += (size_t)image->width * image->height * 4;
+    }
+    return bytes;
+}
+
+bool Graph::EvaluateNode(Node* n)
+{
+    if (!n->IsDirty())
+        return n->Evaluate();
+
+    // GetName() builds a string, only worth it while recording
+    TraceScope trace("node", Trace::IsRecording() ? n->GetName().c_str() : "", n->id);
+    auto start = std::chrono::steady_clock::now();
+    double cpuStart = ThreadCpuSeconds();
+    AllocationScope heap;
+    PerfScope perf;
+    bool result = n->Evaluate();
+    n->stats.RecordPerf(perf.Stop());
+    n->stats.RecordHeap(heap.Stop());
+    double cpu = ThreadCpuSeconds() - cpuStart;
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Whole images in and out, the nodes evaluated here never work on part of one
+    n->stats.Record(wall * 1000.0, cpu * 1000.0, n->TakeAllocatedBytes(), ImageBytes(n->inputs), ImageBytes(n->outputs));
+    return result;
+}
+
+void Graph::SetOutOfCore(size_t thresholdPixels)
+{
+    m_outOfCorePixels = thresholdPixels;
+    // Every buffer has to be reallocated the other way
+    for (Node* n : nodes)
+        n->MarkDirty();
+}
+
+void Graph::SetPreview(Node* node, Channel* channel)
+{
+    if (node == m_previewNode && channel == m_previewChannel)
+        return;
+
+    m_previewNode = node;
+    m_previewChannel = channel;
+    m_previewRegion = Rect();
+    SetChanged(true);
+}
+
+void Graph::SetPreviewRegion(const Rect& region, float displayScale)
+{
+    m_previewScale = displayScale;
+    if (region == m_previewRegion)
+        return;
+
+    m_previewRegion = region;
+    SetChanged(true);
+}
+
+void Graph::UpdateProxyLevel(bool edited)
+{
+    // Only node parameters changed under a held widget count, a new preview region or
+    // scale marks no node dirty and so never starts or extends the interaction
+    auto now = std::chrono::steady_clock::now();
+    if (m_editingParams && edited)
+        m_lastInteractiveEdit = now;
+    m_editingParams = false;
+
+    int shift = 0;
+    bool settled = now - m_lastInteractiveEdit > std::chrono::milliseconds(250);
+    if (!settled)
+    {
+        switch (m_proxyMode)
+        {
+        case ProxyMode::Off: shift = 0; break;
+        case ProxyMode::Auto: shift = m_previewScale <= 0.125f ? 3 : 2; break;
+        case ProxyMode::Quarter: shift = 2; break;
+        case ProxyMode::Eighth: shift = 3; break;
+        }
+    }
+    for (Node* n : nodes)
+        shift = std::max(shift, n->GetProxyFloor());
+    if (shift == m_proxyShift)
+        return;
+
+    // Every image changes resolution, so everything is recomputed at the new level
+    m_proxyShift = shift;
+    for (Node* n : nodes)
+    {
+        n->SetProxyShift(shift);
+        n->MarkDirty();
+    }
+    SetChanged(true);
+}
+
+ImageBuffer* Graph::GetPreviewBuffer()
+{
+    if (!m_previewNode)
+        return nullptr;
+    if (m_previewChannel)
+        return static_cast<ImageBuffer*>(m_previewChannel->data);
+    return m_previewNode->GetImageBuffer();
+}
+
+void Graph::ComputeDemand()
+{
+    // Seed with what has to be shown or saved, then walk upstream growing each region by
+    // the footprint of the node reading it. Nodes left without a demand are not evaluated.
+    m_demand.assign(nodes.size(), Rect());
+    m_demanded.assign(nodes.size(), 0);
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        if (!m_previewNode || nodes[i]->WantsFullFrame())
+        {
+            m_demand[i] = kFullFrame;
+            m_demanded[i] = 1;
+        }
+    }
+    if (m_previewNode)
+    {
+        // The preview region is in full resolution pixels
+        int s = m_proxyShift;
+        Rect region(m_previewRegion.x0 >> s, m_previewRegion.y0 >> s,
+            (m_previewRegion.x1 + (1 << s) - 1) >> s, (m_previewRegion.y1 + (1 << s) - 1) >> s);
+        size_t p = NodeIndex(m_previewNode);
+        m_demand[p] = m_demand[p].Union(region);
+        m_demanded[p] = 1;
+    }
+
+    for (size_t i = nodes.size(); i-- > 0;)
+    {
+        if (!m_demanded[i])
+            continue;
+
+        Rect needed = m_demand[i].Expand(std::max(0, nodes[i]->GetFootprint()));
+        for (Channel* in : nodes[i]->inputs)
+        {
+            for (Link* link : links)
+            {
+                if (link->to_channel == in)
+                {
+                    size_t from = NodeIndex(link->from_node);
+                    m_demand[from] = m_demand[from].Union(needed);
+                    m_demanded[from] = 1;
+                }
+            }
+        }
+    }
+}
+
+size_t Graph::NodeIndex(Node* node)
+{
+    return (size_t)(std::find(nodes.begin(), nodes.end(), node) - nodes.begin());
+}
+
+void Graph::EvaluateTiled()
+{
+    ComputeDemand();
+
+    // Consecutive tileable nodes are collected into one batch and run tile by tile,
+    // any other node that needs evaluating flushes the batch first since it may read it.
+    thread_local vector<Node*> batch;
+    batch.clear();
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        Node* n = nodes[i];
+        if (!m_demanded[i])
+            continue; // Nothing wants it yet, it stays dirty until something does
+
+        if (n->SupportsTiling())
+        {
+            ImageBuffer* out = n->outputs.size() ? static_cast<ImageBuffer*>(n->outputs[0]->data) : nullptr;
+            bool upToDate = !n->IsDirty() && out && out->validRect.Contains(m_demand[i].Intersect(out->GetRect()));
+            if (!upToDate)
+            {
+                batch.push_back(n);
+                continue;
+            }
+        }
+        else if (n->IsDirty())
+        {
+            RunTiledBatch(batch);
+        }
+
+        EvaluateNode(n);
+        PropagateData(n);
     }
-    return selectedLinkIds;
+    RunTiledBatch(batch);
+}
+
+namespace
+{
+    struct TileStage
+    {
+        Node* node = nullptr;
+        int footprint = 0;
+        Rect bounds;
+        Rect target;                    // part of the outputs to compute
+        vector<int> inSlots;            // slot of the batch output feeding each input, or -1
+        vector<ImageBuffer*> inBuffers; // full frame input when it comes from outside the batch
+        vector<int> outSlots;
+        vector<ImageBuffer*> outBuffers;
+        vector<int> consumers;          // later stages reading one of our outputs
+        double prepareWall = 0, prepareCpu = 0;
+        AllocationCounts prepareHeap;
+        string name;                    // for trace events, only set while recording
+
+        void Reset(Node* n)
+        {
+            node = n;
+            inSlots.clear();
+            inBuffers.clear();
+            outSlots.clear();
+            outBuffers.clear();
+            consumers.clear();
+            name.clear();
+        }
+    };
+
+    // Totals of one stage over all of its tiles
+    struct StageCounters
+    {
+        std::atomic<long long> cpuNs{ 0 }, bytesRead{ 0 }, bytesWritten{ 0 };
+        AtomicPerfCounts perf;
+        AtomicAllocationCounts heap;
+
+        void Reset()
+        {
+            cpuNs = 0;
+            bytesRead = 0;
+            bytesWritten = 0;
+            perf.Reset();
+            heap.Reset();
+        }
+    };
 }
 
-void Graph::ShowProperties()
+void Graph::RunTiledBatch(vector<Node*>& batch)
 {
-    vector<int> nodeIds = GetSelectedNodes();
-    if (!nodeIds.size())
+    if (batch.empty())
         return;
-    Node* node = GetNodeFromId(nodeIds[0]);
-    if (node)
-        node->CreateImNodeProperties();
+    TraceScope trace("graph", "RunTiledBatch");
+
+    // Stages are recycled along with their vectors, in the same order, so once the graph
+    // has run a steady state evaluation allocates nothing here. The tile lambda runs on
+    // other threads and has to see this thread's instances, hence the references.
+    thread_local vector<TileStage> stagePool, spareStages;
+    thread_local vector<Channel*> slotChannelPool; // the output channel written to each slot
+    vector<TileStage>& stages = stagePool;
+    vector<Channel*>& slotChannels = slotChannelPool;
+    for (auto it = stages.rbegin(); it != stages.rend(); ++it)
+        spareStages.push_back(std::move(*it));
+    stages.clear();
+    slotChannels.clear();
+
+    // Size every output up front, in order, so downstream nodes see their input sizes
+    Rect frame;
+    for (Node* n : batch)
+    {
+        auto prepareStart = std::chrono::steady_clock::now();
+        double prepareCpuStart = ThreadCpuSeconds();
+        AllocationScope prepareHeap;
+        bool active = n->PrepareOutputs();
+        PropagateData(n);
+        if (!active)
+        {
+            n->MarkClean();
+            continue;
+        }
+
+        if (spareStages.empty())
+            spareStages.emplace_back();
+        TileStage stage = std::move(spareStages.back());
+        spareStages.pop_back();
+        stage.Reset(n);
+        if (Trace::IsRecording())
+            stage.name = n->GetName();
+        stage.footprint = std::max(0, n->GetFootprint());
+        stage.prepareCpu = ThreadCpuSeconds() - prepareCpuStart;
+        stage.prepareHeap = prepareHeap.Stop();
+        stage.prepareWall = std::chrono::duration<double>(std::chrono::steady_clock::now() - prepareStart).count();
+        for (Channel* in : n->inputs)
+        {
+            int slot = -1;
+            for (Link* link : links)
+            {
+                auto found = std::find(slotChannels.begin(), slotChannels.end(), link->from_channel);
+                if (link->to_channel == in && found != slotChannels.end())
+                    slot = (int)(found - slotChannels.begin());
+            }
+            stage.inSlots.push_back(slot);
+            stage.inBuffers.push_back(static_cast<ImageBuffer*>(in->data));
+        }
+        for (Channel* out : n->outputs)
+        {
+            stage.outSlots.push_back((int)slotChannels.size());
+            slotChannels.push_back(out);
+            stage.outBuffers.push_back(static_cast<ImageBuffer*>(out->data));
+        }
+        stage.bounds = stage.outBuffers[0]->GetRect();
+        stage.target = m_demand[NodeIndex(n)].Intersect(stage.bounds);
+        frame = frame.Union(stage.target);
+
+        int index = (int)stages.size();
+        for (int slot : stage.inSlots)
+        {
+            for (TileStage& producer : stages)
+            {
+                if (std::find(producer.outSlots.begin(), producer.outSlots.end(), slot) != producer.outSlots.end())
+                    producer.consumers.push_back(index);
+            }
+        }
+        stages.push_back(std::move(stage));
+    }
+    batch.clear();
+
+    if (stages.empty())
+        return;
+
+    const int tileSize = m_tileSize;
+    const int slotCount = (int)slotChannels.size();
+    const int tilesX = (frame.Width() + tileSize - 1) / tileSize;
+    const int tilesY = (frame.Height() + tileSize - 1) / tileSize;
+
+    thread_local std::unique_ptr<StageCounters[]> counterPool;
+    thread_local size_t counterCapacity = 0;
+    if (counterCapacity < stages.size())
+    {
+        counterPool.reset(new StageCounters[stages.size()]);
+        counterCapacity = stages.size();
+    }
+    StageCounters* counters = counterPool.get();
+    for (size_t i = 0; i < stages.size(); ++i)
+        counters[i].Reset();
+    auto batchStart = std::chrono::steady_clock::now();
+
+    const std::thread::id caller = std::this_thread::get_id();
+    ThreadPool::Shared().ParallelFor(tilesX * tilesY, [&](int tileIndex) {
+        Rect tile(frame.x0 + (tileIndex % tilesX) * tileSize, frame.y0 + (tileIndex / tilesX) * tileSize, 0, 0);
+        tile.x1 = std::min(tile.x0 + tileSize, frame.x1);
+        tile.y1 = std::min(tile.y0 + tileSize, frame.y1);
+
+        // Per thread working memory, reused from tile to tile
+        thread_local vector<Rect> needed;
+        thread_local vector<vector<unsigned char>> scratch;
+        thread_local vector<vector<unsigned char>> gathered;
+        thread_local vector<ImageView> slotViews;
+        thread_local vector<ImageView> in, out;
+        needed.assign(stages.size(), Rect());
+        scratch.resize(std::max((int)scratch.size(), slotCount));
+        slotViews.assign(slotCount, ImageView());
+
+        // Walk backwards growing each stage's region by the halo its consumers sample
+        for (int i = (int)stages.size() - 1; i >= 0; --i)
+        {
+            Rect region = tile.Intersect(stages[i].target);
+            for (int c : stages[i].consumers)
+            {
+                if (!needed[c].Empty())
+                    region = region.Union(needed[c].Expand(stages[c].footprint).Intersect(stages[i].bounds));
+            }
+            needed[i] = region;
+        }
+
+        for (size_t i = 0; i < stages.size(); ++i)
+        {
+            const TileStage& stage = stages[i];
+            const Rect& region = needed[i];
+            if (region.Empty())
+                continue;
+
+            AllocationScope heap;
+            in.clear();
+            gathered.resize(std::max(gathered.size(), stage.inSlots.size()));
+            for (size_t k = 0; k < stage.inSlots.size(); ++k)
+            {
+                ImageBuffer* source = stage.inBuffers[k];
+                if (stage.inSlots[k] >= 0)
+                    in.push_back(slotViews[stage.inSlots[k]]);
+                else if (source->IsOutOfCore())
+                {
+                    // Paged inputs are copied in, as much of them as the region reads
+                    Rect reads = region.Expand(stage.footprint).Intersect(source->GetRect());
+                    gathered[k].resize((size_t)reads.Width() * reads.Height() * 4);
+                    source->ReadRegion(reads, gathered[k].data(), (size_t)reads.Width() * 4);
+                    in.push_back(ImageView{ gathered[k].data(), reads, reads.Width() * 4, source->width, source->height });
+                }
+                else
+                    in.push_back(source->GetView());
+            }
+
+            // Regions without a halo go straight to the output, others through scratch
+            Rect core = tile.Intersect(stage.target);
+            bool direct = region == core && !stage.outBuffers[0]->IsOutOfCore();
+            out.clear();
+            for (size_t k = 0; k < stage.outSlots.size(); ++k)
+            {
+                ImageView view = stage.outBuffers[k]->GetView();
+                if (!direct)
+                {
+                    vector<unsigned char>& mem = scratch[stage.outSlots[k]];
+                    mem.resize((size_t)region.Width() * region.Height() * 4);
+                    view = ImageView{ mem.data(), region, region.Width() * 4, view.imageWidth, view.imageHeight };
+                }
+                out.push_back(view);
+                slotViews[stage.outSlots[k]] = view;
+            }
+
+            TraceScope tileTrace("tile", stage.name.c_str(), stage.node->id);
+            double cpuStart = ThreadCpuSeconds();
+            PerfScope perf;
+            stage.node->ProcessRegion(in, out, region);
+            counters[i].perf.Add(perf.Stop());
+            counters[i].cpuNs += (long long)((ThreadCpuSeconds() - cpuStart) * 1e9);
+            long long readBytes = 0;
+            for (const ImageView& view : in)
+            {
+                Rect reads = region.Expand(stage.footprint).Intersect(view.rect);
+                readBytes += (long long)reads.Width() * reads.Height() * 4;
+            }
+            counters[i].bytesRead += readBytes;
+            counters[i].bytesWritten += (long long)region.Width() * region.Height() * 4 * (long long)out.size();
+
+            if (!direct && !core.Empty())
+            {
+                for (size_t k = 0; k < stage.outBuffers.size(); ++k)
+                {
+                    if (stage.outBuffers[k]->IsOutOfCore())
+                        stage.outBuffers[k]->WriteRegion(core, out[k].Pixel(core.x0, core.y0), out[k].stride);
+                    else
+                        CopyRegion(out[k], stage.outBuffers[k]->GetView(), core);
+                }
+            }
+            AllocationCounts tileHeap = heap.Stop();
+            counters[i].heap.Add(tileHeap);
+            if (std::this_thread::get_id() != caller)
+                m_workerHeap.Add(tileHeap);
+        }
+    }, m_tileThreads);
+
+    // The stages ran interleaved, so each is charged a share of the batch's wall time
+    // matching its share of the CPU time
+    double batchWall = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+    long long batchCpu = 0;
+    for (size_t i = 0; i < stages.size(); ++i)
+        batchCpu += counters[i].cpuNs;
+
+    for (size_t i = 0; i < stages.size(); ++i)
+    {
+        TileStage& stage = stages[i];
+        for (ImageBuffer* out : stage.outBuffers)
+            out->MarkWritten(stage.target);
+        stage.node->FinishOutputs();
+
+        double cpu = counters[i].cpuNs * 1e-9;
+        double wall = stage.prepareWall + (batchCpu ? batchWall * counters[i].cpuNs / batchCpu : batchWall / stages.size());
+        stage.node->stats.Record(wall * 1000.0, (stage.prepareCpu + cpu) * 1000.0, stage.node->TakeAllocatedBytes(),
+            (size_t)counters[i].bytesRead, (size_t)counters[i].bytesWritten);
+        stage.node->stats.RecordPerf(counters[i].perf.Load());
+        AllocationCounts heap = stage.prepareHeap;
+        heap += counters[i].heap.Load();
+        stage.node->stats.RecordHeap(heap);
+    }
 }
 
 Node* Graph::GetNodeFromChannelID(int channelId, Channel*& channel)
@@ -297,3 +761,109 @@ Link* Graph::GetLinkFromId(int nodeId)
     return nullptr;
 }
 
+
+
+void Graph::Clear()
+{
+    SetPreview(nullptr, nullptr);
+    for (Link* link : links)
+        delete link;
+    links.clear();
+    for (Node* node : nodes)
+        delete node;
+    nodes.clear();
+    m_demand.clear();
+    m_demanded.clear();
+    lastId = 0;
+    SetChanged(true);
+}
+
+bool Graph::Save(const string& path)
+{
+    std::ofstream file(path);
+    if (!file)
+        return false;
+
+    file << "nbip-graph 1\n";
+    for (Node* node : nodes)
+    {
+        file << "node " << node->id << " " << GetNodeTypeName(node->type) << " " << node->posX << " " << node->posY << "\n";
+        node->SaveParams(file);
+        file << "end\n";
+    }
+    for (Link* link : links)
+        file << "link " << link->from_channel->id << " " << link->to_channel->id << "\n";
+
+    return (bool)file;
+}
+
+bool Graph::Load(const string& path)
+{
+    std::ifstream file(path);
+    string header;
+    int version = 0;
+    if (!(file >> header >> version) || header != "nbip-graph" || version != 1)
+    {
+        cerr << "Not a graph file: " << path << endl;
+        return false;
+    }
+
+    Clear();
+
+    string line;
+    Node* current = nullptr;
+    while (getline(file, line))
+    {
+        std::istringstream fields(line);
+        string key;
+        if (!(fields >> key))
+            continue;
+
+        if (current)
+        {
+            if (key == "end")
+                current = nullptr;
+            else
+                current->LoadParam(key, fields);
+        }
+        else if (key == "node")
+        {
+            unsigned int id = 0;
+            string typeName;
+            NodeType type;
+            float x = 0.0f, y = 0.0f;
+            fields >> id >> typeName >> x >> y;
+            if (!fields || !GetNodeTypeFromName(typeName, type) || GetNodeFromId(id))
+            {
+                cerr << "Bad node in " << path << ": " << line << endl;
+                Clear();
+                return false;
+            }
+            current = CreateNode(type, id);
+            current->posX = x;
+            current->posY = y;
+            current->positionPending = true;
+            current->MarkDirty();
+            lastId = std::max(lastId, id);
+            AddNode(current);
+        }
+        else if (key == "link")
+        {
+            int from = 0, to = 0;
+            fields >> from >> to;
+            Channel* fromChannel = nullptr;
+            Channel* toChannel = nullptr;
+            if (!fields || !GetNodeFromChannelID(from, fromChannel) || !GetNodeFromChannelID(to, toChannel)
+                || fromChannel->type != Channel::ChannelType::Output || toChannel->type != Channel::ChannelType::Input
+                || !toChannel->attachedLinks.empty() || !Connect(from, to))
+            {
+                cerr << "Bad link in " << path << ": " << line << endl;
+                Clear();
+                return false;
+            }
+        }
+    }
+
+    SetChanged(true);
+    return true;
+}
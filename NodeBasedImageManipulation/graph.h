@@ -2,25 +2,64 @@
 #include "node.h"
 #include <unordered_set>
 #include <unordered_map>
+#include <chrono>
 #include "Link.h"
 
+enum class ProxyMode
+{
+    Off,
+    Auto,       // 1/4, or 1/8 when the preview shows the image at 1/8 or smaller anyway
+    Quarter,
+    Eighth
+};
+
 class Graph
 {
 private:
     bool m_changed = false;
+    bool m_tiledEvaluation = true;
+    int m_tileSize = 256;
+    int m_tileThreads = 0;
+    size_t m_outOfCorePixels = 0;
     unsigned int lastId = 0;
+    Node* m_previewNode = nullptr;
+    Channel* m_previewChannel = nullptr;
+    Rect m_previewRegion;
+    float m_previewScale = 1.0f;
+    // Region each node has to compute, parallel to nodes, see ComputeDemand()
+    vector<Rect> m_demand;
+    vector<char> m_demanded;
+    ProxyMode m_proxyMode = ProxyMode::Auto;
+    int m_proxyShift = 0;
+    // A node parameter widget was held in the last frame drawn, on the canvas or in the
+    // properties. Cleared by every Evaluate().
+    bool m_editingParams = false;
+    std::chrono::steady_clock::time_point m_lastInteractiveEdit;
+    AllocationCounts m_lastEvaluationHeap;
+    // TopoSort's working memory, kept between evaluations
+    vector<int> m_sortIndegree;
+    vector<Node*> m_sorted;
+    AtomicAllocationCounts m_workerHeap; // tile work on other threads than Evaluate's
 public:
     vector<Node*> nodes;
     vector<Link*> links;
 
 public:
+    Graph() {}
+    Graph(const Graph&) = delete;
+    Graph& operator=(const Graph&) = delete;
+    ~Graph() { Clear(); }
+
     unsigned int GetNewId() { return lastId += 5; }
     void AddNode(Node* node) 
     { 
+        node->SetProxyShift(m_proxyShift);
         nodes.push_back(node); 
     }
     void InitiateLinks();
     void CreateNodesOnCanvas();
+    // Copies the editor's node positions into the nodes, before saving
+    void CaptureNodePositions();
     void TopoSort(vector<Node*>& nodes);
     bool WouldCreateCycle(Node* from, Node* to);
     bool Connect(int from, int to);
@@ -34,10 +73,53 @@ public:
     void DeleteNodes(vector<int>& nodeIDs);
     void DeleteLinks(vector<int>& linkIDs);
     void PropagateData(Node* node);
+    // Returns false when nothing needed evaluating
     bool Evaluate();
+    // threads limits the threads working on the tiles of one evaluation (0 = all of them)
+    void SetTiledEvaluation(bool tiled, int tileSize = 256, int threads = 0)
+    {
+        m_tiledEvaluation = tiled;
+        m_tileSize = tileSize;
+        m_tileThreads = threads;
+    }
+    bool IsTiledEvaluation() { return m_tiledEvaluation; }
+    // Images of at least this many pixels are kept in memory mapped tiles instead of the
+    // heap, see TiledImageStore (0 = never). Needs tiled evaluation.
+    void SetOutOfCore(size_t thresholdPixels);
+    size_t GetOutOfCore() { return m_outOfCorePixels; }
+
+    // Region of interest evaluation: while something is previewed, tiled evaluation only
+    // computes the previewed region of that node and what it needs upstream. Exports
+    // still get whole images. A null channel previews node->GetImageBuffer().
+    void SetPreview(Node* node, Channel* channel);
+    void SetPreviewRegion(const Rect& region, float displayScale);
+    ImageBuffer* GetPreviewBuffer();
+
+    // Proxy evaluation: parameter edits made while their widget is held are evaluated on
+    // downscaled copies of the inputs, the full resolution pass runs once the edits settle.
+    // Panning or zooming the preview is not an edit.
+    void SetProxyMode(ProxyMode mode) { m_proxyMode = mode; }
+    ProxyMode GetProxyMode() { return m_proxyMode; }
     vector<int> GetSelectedNodes();
     vector<int> GetSelectedLinks();
     void ShowProperties();
+    // Contents of the "Profiler" window: every node's NodeStats in a sortable table and
+    // the trace recording controls
+    void ShowProfiler();
+    void ResetStats();
+    // Heap allocations of the last Evaluate() that did something, on every thread
+    const AllocationCounts& GetLastEvaluationHeap() { return m_lastEvaluationHeap; }
+    // Evaluates everything again with nothing changed and returns what that allocated,
+    // which should be nothing once buffers have their size. Output nodes are skipped so
+    // no file is written twice.
+    AllocationCounts CheckSteadyState();
+
+    // Plain text graph files: the nodes with their parameters and editor positions, then
+    // the links between channels. Load replaces the current graph.
+    bool Save(const string& path);
+    bool Load(const string& path);
+    void Clear();
+
     void SetChanged(bool changed) { m_changed = changed; }
     bool IsChanged() { return m_changed; }
     Node* GetNodeFromChannelID(int channelId, Channel*& channel);
@@ -46,6 +128,14 @@ public:
     Link* GetLinkFromId(int linkId);
 
 private:
+    // Evaluates one node outside a tiled batch and records its NodeStats
+    bool EvaluateNode(Node* n);
     bool HasPath(Node* start, Node* target, std::unordered_set<Node*>& visited);
+    // edited: some node was dirty when the evaluation started
+    void UpdateProxyLevel(bool edited);
+    void ComputeDemand();
+    size_t NodeIndex(Node* node);
+    void EvaluateTiled();
+    void RunTiledBatch(vector<Node*>& batch);
 };
 
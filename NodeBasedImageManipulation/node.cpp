@@ -1,16 +1,11 @@
-#pragma once
-#include <Windows.h>
 #include <algorithm>
+#include <cmath>
+#include <cassert>
 #include "node.h"
-#include "imgui_impl_glfw.h"
-#include "imgui_impl_opengl3.h"
 #include "Link.h"
 #include "Core/NodeUtils.h"
+#include "Core/ImageResample.h"
 
-//#define STB_IMAGE_IMPLEMENTATION
-#define STB_IMAGE_WRITE_IMPLEMENTATION
-//#include "stb_image.h"
-#include "stb_image_write.h"
 
 //static void HelpMarker(const char* desc)
 //{
@@ -215,415 +210,457 @@ void Node::MarkDirty()
     }
 }
 
-InputNode::InputNode(int id)
+const char* GetNodeTypeName(NodeType type)
 {
-    this->id = id;
-    outputs.push_back(new Channel(id + 1, "Image", Channel::ChannelType::Output, Channel::ChannelDataType::Image));
-};
+    switch (type)
+    {
+    case NodeType::Input: return "Input";
+    case NodeType::Output: return "Output";
+    case NodeType::BrightnessContrast: return "BrightnessContrast";
+    case NodeType::ColourSplitter: return "ColourSplitter";
+    case NodeType::Blur: return "Blur";
+    }
+    return "";
+}
 
-static int InputTextCallback(ImGuiInputTextCallbackData* data)
+bool GetNodeTypeFromName(const string& name, NodeType& type)
 {
-    if (data->EventFlag == ImGuiInputTextFlags_CallbackResize)
+    for (NodeType t : { NodeType::Input, NodeType::Output, NodeType::BrightnessContrast, NodeType::ColourSplitter, NodeType::Blur })
     {
-        std::string* str = (std::string*)data->UserData;
-        str->resize(data->BufTextLen);
-        data->Buf = &(*str)[0];
+        if (name == GetNodeTypeName(t))
+        {
+            type = t;
+            return true;
+        }
     }
-    return 0;
+    return false;
 }
 
-void InputNode::CreateImNode()
+Node* CreateNode(NodeType type, int id)
 {
-    ImNodes::BeginNode(id);
-
-    ImNodes::BeginNodeTitleBar();
-    ImGui::TextUnformatted(GetName().c_str());
-    ImNodes::EndNodeTitleBar();
-
-    int width = 0, height = 0;
-    if (outputs[0]->data)
+    switch (type)
     {
-        auto buffer = (ImageBuffer*)(outputs[0]->data);
-        width = buffer->width;
-        height= buffer->height;
+    case NodeType::Input: return new InputNode(id);
+    case NodeType::Output: return new OutputNode(id);
+    case NodeType::BrightnessContrast: return new BrightnessContrastNode(id);
+    case NodeType::ColourSplitter: return new ColorChannelSplitterNode(id);
+    case NodeType::Blur: return new BlurNode(id);
     }
+    return nullptr;
+}
 
-    ImGui::Text("File Extention = %s ", fileExt.c_str());
-    ImGui::Text("Size = %d x %d", width, height);
+// Rest of the line after the key, without the separating space
+static string ReadRestOfLine(istream& value)
+{
+    string text;
+    getline(value >> ws, text);
+    return text;
+}
 
-    ImGui::SetNextItemWidth(100.0f);
-    static ImGuiInputTextFlags flags = ImGuiInputTextFlags_ElideLeft | ImGuiInputTextFlags_CallbackResize;
-    if (ImGui::InputTextWithHint("File Path", "Enter path here...", &filePath[0], filePath.size() + 1, flags,
-        InputTextCallback, (void*)&filePath))
-    {
-        MarkDirty();
-    }
+void Node::FinishOutputs()
+{
+    MarkClean();
+}
 
-    if (ImGui::Button("Open File"))
+bool Node::EvaluateFullFrame()
+{
+    if (!PrepareOutputs())
     {
-        filePath = OpenFileDialog();
-        MarkDirty();
+        MarkClean();
+        return false;
     }
 
+    // Kept per thread so evaluating again does not allocate
+    thread_local vector<ImageView> in, out;
+    in.clear();
+    out.clear();
+    for (Channel* c : inputs)
+        in.push_back(static_cast<ImageBuffer*>(c->data)->GetView());
     for (Channel* c : outputs)
-    {
-        ImNodes::BeginOutputAttribute(c->id);
-        ImGui::Indent(60);
-        ImGui::Text(c->name.c_str());
-        ImNodes::EndOutputAttribute();
-    }
+        out.push_back(static_cast<ImageBuffer*>(c->data)->GetView());
 
-    ImNodes::EndNode();
+    ProcessRegion(in, out, out[0].rect);
+    for (Channel* c : outputs)
+        static_cast<ImageBuffer*>(c->data)->MarkWritten(out[0].rect);
+    FinishOutputs();
+    return true;
 }
 
-void InputNode::CreateImNodeProperties()
+ImageBuffer* Node::PrepareImageOutput(Channel* channel, int width, int height)
 {
-    int width = 0, height = 0;
-    if (outputs[0]->data)
+    ImageBuffer* buffer = static_cast<ImageBuffer*>(channel->data);
+    if (!buffer)
     {
-        auto buffer = (ImageBuffer*)(outputs[0]->data);
-        width = buffer->width;
-        height = buffer->height;
+        buffer = new ImageBuffer();
+        channel->data = buffer;
     }
-    ImGuiTableFlags flags = ImGuiTableFlags_BordersInnerV;
-    if (ImGui::BeginTable("table3", 2, flags))
+    if (buffer->Resize(width, height, WantsOutOfCore(width, height)) && !buffer->IsOutOfCore())
+        allocatedBytes += (size_t)width * height * 4;
+
+    ImageBuffer* source = inputs.size() ? static_cast<ImageBuffer*>(inputs[0]->data) : nullptr;
+    buffer->proxyShift = source ? source->proxyShift : 0;
+    return buffer;
+}
+
+void Node::ReleaseOutputs()
+{
+    for (Channel* outChannel : outputs)
     {
-        ImGui::TableNextColumn();
-        ImGui::Text("File Path");
-        ImGui::TableNextColumn();
-        ImGui::Text(filePath.c_str());
-        ImGui::TableNextColumn();
-        ImGui::Text("File Extention");
-        ImGui::TableNextColumn();
-        ImGui::Text(fileExt.c_str());
-        ImGui::TableNextColumn();
-        ImGui::Text("Width");
-        ImGui::TableNextColumn();
-        ImGui::Text("%d", width);
-        ImGui::TableNextColumn();
-        ImGui::Text("Height");
-        ImGui::TableNextColumn();
-        ImGui::Text("%d", height);
-
-        ImGui::EndTable();
+        if (outChannel->data != nullptr)
+        {
+            if (outChannel->dataType == Channel::ChannelDataType::Image)
+                delete (ImageBuffer*)outChannel->data;
+            outChannel->data = nullptr;
+        }
     }
-    ImGui::PushItemWidth(100);
-    ImGui::PopItemWidth();
+}
+
+InputNode::InputNode(int id)
+{
+    this->id = id;
+    this->type = NodeType::Input;
+    outputs.push_back(new Channel(id + 1, "Image", Channel::ChannelType::Output, Channel::ChannelDataType::Image));
+};
+
+InputNode::~InputNode()
+{
+    // The output channel only ever points at one of our own images
+    outputs[0]->data = nullptr;
+    ReleaseImages();
 }
 
 bool InputNode::Evaluate()
 {
     if (!IsDirty()) return false;
-    ImageBuffer* buffer = CreateBuffer(filePath);
 
-    if (buffer == nullptr)
+    // Only decode when the path changed, proxy level switches reuse what is loaded
+    if (filePath != requestedPath)
+    {
+        // Nothing downstream should keep showing (or exporting) the previous file
+        outputs[0]->data = nullptr;
+        ReleaseImages();
+        loadedPath = "";
+        requestedPath = filePath;
+        pending.reset();
+        pendingReduced.reset();
+        if (loadInBackground)
+            pendingReduced = ImageCache::Shared().Load(filePath, true, true);
+        else
+            pending = ImageCache::Shared().Load(filePath, false);
+    }
+    // The full decode is only wanted once the stand-in (or the lack of one) is known
+    if (pendingReduced && pendingReduced->IsReady())
+    {
+        reduced = pendingReduced->Get();
+        pendingReduced.reset();
+        pending = ImageCache::Shared().Load(filePath, loadInBackground);
+    }
+    if (pending && pending->IsReady())
+    {
+        // The stand-in and the proxies made from it make way for the real image
+        outputs[0]->data = nullptr;
+        ReleaseProxies();
+        reduced.reset();
+        data = pending->Get();
+        pending.reset();
+        if (data)
+        {
+            // Only the first node to use a decode pays for it
+            if (data.use_count() <= 2)
+                allocatedBytes += (size_t)data->width * data->height * 4;
+            loadedPath = filePath;
+            size_t dot = filePath.find_last_of('.');
+            fileExt = dot == string::npos ? "" : filePath.substr(dot);
+        }
+    }
+    if (!data && !reduced)
     {
+        // Poll() makes the node dirty again when a decode is done
         MarkClean();
         return false;
     }
 
-    outputs[0]->data = (void*)buffer;
-    fileExt = filePath.substr(filePath.find_last_of('.'));
+    // stb_image can only decode whole images, but at least the decoded copy does not
+    // have to stay in memory for the rest of the graph's life
+    if (data && !data->IsOutOfCore() && WantsOutOfCore(data->width, data->height))
+    {
+        auto paged = std::make_shared<ImageBuffer>();
+        paged->Resize(data->width, data->height, true);
+        paged->WriteRegion(data->GetRect(), data->imageData, (size_t)data->width * 4);
+        paged->MarkWritten(paged->GetRect());
+        data = paged;
+    }
+
+    outputs[0]->data = (void*)GetProxy(proxyShift);
     MarkClean();
     return true;
 }
 
-ImageBuffer* InputNode::GetImageBuffer()
+void InputNode::Poll()
 {
-    if (outputs[0]->data == nullptr)
-        return nullptr;
-
-    return static_cast<ImageBuffer*>(outputs[0]->data);
+    if ((pending && pending->IsReady()) || (pendingReduced && pendingReduced->IsReady()))
+        MarkDirty();
 }
 
-OutputNode::OutputNode(int id)
+int InputNode::GetProxyFloor()
 {
-    this->id = id;
-    inputs.push_back(new Channel(id + 1, "Image", Channel::ChannelType::Input, Channel::ChannelDataType::Image));
-};
+    // Decodes that are done count already, Evaluate takes them at the level set from this
+    if (data || (pending && pending->IsReady() && pending->Get()))
+        return 0;
+    if (reduced)
+        return reduced->proxyShift;
+    if (pendingReduced && pendingReduced->IsReady() && pendingReduced->Get())
+        return pendingReduced->Get()->proxyShift;
+    return 0;
+}
 
-void OutputNode::CreateImNode()
+void InputNode::SetImage(const string& path, ImageBuffer* image)
 {
-    ImNodes::BeginNode(id);
-    ImNodes::BeginNodeTitleBar();
-    ImGui::TextUnformatted(GetName().c_str());
-    ImNodes::EndNodeTitleBar();
+    outputs[0]->data = nullptr;
+    ReleaseImages();
+    pending.reset();
+    pendingReduced.reset();
+    data.reset(image);
+    filePath = loadedPath = requestedPath = path;
+    size_t dot = path.find_last_of('.');
+    fileExt = dot == string::npos ? "" : path.substr(dot);
+    MarkDirty();
+}
 
-    for (Channel* c : inputs)
+ImageBuffer* InputNode::GetProxy(int shift)
+{
+    // Without the full image the stand-in is the finest level there is
+    ImageBuffer* base = data ? data.get() : reduced.get();
+    int baseShift = data || !reduced ? 0 : reduced->proxyShift;
+    shift = std::min(shift, 3);
+    if (!base || shift <= baseShift)
+        return base;
+
+    // Each level is built from the one above it the first time it is asked for
+    if (!proxies[shift])
     {
-        ImNodes::BeginInputAttribute(c->id);
-        ImGui::Text(c->name.c_str());
-        ImNodes::EndInputAttribute();
+        ImageBuffer* parent = GetProxy(shift - 1);
+        ImageBuffer* proxy = new ImageBuffer();
+        Downsample2x(*parent, *proxy);
+        if (!proxy->IsOutOfCore())
+            allocatedBytes += (size_t)proxy->width * proxy->height * 4;
+        proxy->proxyShift = shift;
+        proxies[shift] = proxy;
     }
+    return proxies[shift];
+}
 
-    ImGui::Spacing();
-    if (ImGui::Button("Save File"))
+void InputNode::ReleaseProxies()
+{
+    for (ImageBuffer*& proxy : proxies)
     {
-        saveFilePath = SaveFileDialog();
-        saveFileExt = saveFilePath.substr(saveFilePath.find_last_of('.'));
-        MarkDirty();
-        Evaluate();
+        delete proxy;
+        proxy = nullptr;
     }
-    ImNodes::EndNode();
 }
 
-void OutputNode::CreateImNodeProperties()
+void InputNode::ReleaseImages()
 {
-    int width = 0, height = 0;
-    if (outputs.size() && outputs[0]->data)
-    {
-        auto buffer = (ImageBuffer*)(outputs[0]->data);
-        width = buffer->width;
-        height = buffer->height;
-    }
-    ImGuiTableFlags flags = ImGuiTableFlags_BordersInnerV;
-    if (ImGui::BeginTable("table3", 2, flags))
-    {
-        ImGui::TableNextColumn();
-        ImGui::Text("Width");
-        ImGui::TableNextColumn();
-        ImGui::Text("%d", width);
-        ImGui::TableNextColumn();
-        ImGui::Text("Height");
-        ImGui::TableNextColumn();
-        ImGui::Text("%d", height);
-
-        ImGui::EndTable();
-    }
-    ImGui::PushItemWidth(100);
-    ImGui::PopItemWidth();
+    ReleaseProxies();
+    data.reset();
+    reduced.reset();
 }
 
-bool OutputNode::Evaluate()
+void InputNode::SaveParams(ostream& out)
 {
-    if (!IsDirty()) return false;
-    if (saveFilePath == "")
-        return false;
-    if (saveFileExt == ".png")
-        stbi_write_png(saveFilePath.c_str(), GetImageBuffer()->width, GetImageBuffer()->height, 4, GetImageBuffer()->imageData, GetImageBuffer()->width * 4);
-    if (saveFileExt == ".jpg")
-        stbi_write_jpg(saveFilePath.c_str(), GetImageBuffer()->width, GetImageBuffer()->height, 4, GetImageBuffer()->imageData, GetImageBuffer()->width * 4);
-    if (saveFileExt == ".bmp")
-        stbi_write_bmp(saveFilePath.c_str(), GetImageBuffer()->width, GetImageBuffer()->height, 4, GetImageBuffer()->imageData);
+    out << "path " << filePath << "\n";
+}
 
-    MarkClean();
-    return false;
+void InputNode::LoadParam(const string& key, istream& value)
+{
+    if (key == "path")
+        SetFilePath(ReadRestOfLine(value));
 }
 
-ImageBuffer* OutputNode::GetImageBuffer()
+ImageBuffer* InputNode::GetImageBuffer()
 {
-    if (!inputs.size() || inputs[0]->data == nullptr)
+    if (outputs[0]->data == nullptr)
         return nullptr;
 
-    return static_cast<ImageBuffer*>(inputs[0]->data);
+    return static_cast<ImageBuffer*>(outputs[0]->data);
 }
 
-BrightnessContrastNode::BrightnessContrastNode(int id)
+OutputNode::OutputNode(int id)
 {
     this->id = id;
+    this->type = NodeType::Output;
     inputs.push_back(new Channel(id + 1, "Image", Channel::ChannelType::Input, Channel::ChannelDataType::Image));
-    outputs.push_back(new Channel(id + 2, "Image", Channel::ChannelType::Output, Channel::ChannelDataType::Image));
 };
 
-void BrightnessContrastNode::CreateImNode()
+bool OutputNode::Evaluate()
 {
-    ImNodes::BeginNode(id);
-    ImNodes::BeginNodeTitleBar();
-    ImGui::TextUnformatted(GetName().c_str());
-    ImNodes::EndNodeTitleBar();
+    if (!IsDirty()) return false;
+    if (saveFilePath == "")
+        return false;
+    if (!GetImageBuffer())
+        return false;
+    // Never export a proxy, stay dirty until the full resolution pass comes through
+    if (GetImageBuffer()->proxyShift != 0)
+        return false;
 
-    for (Channel* c : inputs)
+    // Upstream changes that end in the same pixels (a parameter set back, say) leave the
+    // file as it is
+    uint64_t hash = HashExport(*GetImageBuffer(), saveFileExt, encodeOptions);
+    bool queued = exporting && !exporting->IsFinished() && exporting->path == saveFilePath && exportingHash == hash;
+    if (queued || IsExportCurrent(lastRecord, saveFilePath, hash)
+        || (useSidecar && ReadExportSidecar(saveFilePath, lastRecord) && IsExportCurrent(lastRecord, saveFilePath, hash)))
     {
-        ImNodes::BeginInputAttribute(c->id);
-        ImGui::Text(c->name.c_str());
-        ImNodes::EndInputAttribute();
+        if (!queued)
+            lastExport = saveFilePath;
+        skippedLast = true;
+        skippedExports++;
+        MarkClean();
+        return true;
     }
+    skippedLast = false;
 
-    HelpMarker("Click to reset the Brightness");
-
-    ImGui::SameLine();
-    ImGui::PushID("Reset Brightness");
-    if (ImGui::Button(".."))
+    if (exportInBackground)
     {
-        if (brightness != 0.0f)
-        {
-            brightness = 0.0f;
-            MarkDirty();
-        }
+        exporting = ExportQueue::Shared().Submit(saveFilePath, saveFileExt, *GetImageBuffer(), encodeOptions);
+        exportingHash = hash;
+        MarkClean();
+        return exporting->state != ExportQueue::State::Failed;
     }
-    ImGui::PopID();
-
-    ImGui::SameLine();
-    ImGui::SetNextItemWidth(100.0f);
-    if (ImGui::SliderFloat("Brightness", &brightness, -100.0f, 100.0f, "%.3f"))
+    bool written = SaveImageToFile(saveFilePath, saveFileExt, GetImageBuffer(), encodeOptions);
+    if (written)
     {
-        MarkDirty();
+        lastExport = saveFilePath;
+        Record(saveFilePath, hash);
     }
+    MarkClean();
+    return written;
+}
 
-    HelpMarker("Click to reset the Contrast");
-
-    ImGui::SameLine();
-    ImGui::PushID("Reset Contrast");
-    if (ImGui::Button(".."))
+void OutputNode::Poll()
+{
+    if (!exporting || exporting->state != ExportQueue::State::Done)
+        return;
+    if (exportingHash)
     {
-        if (contrast != 1.0f)
-        {
-            contrast = 1.0f;
-            MarkDirty();
-        }
+        Record(exporting->path, exportingHash);
+        exportingHash = 0;
     }
-    ImGui::PopID();
+    if (exporting->path == saveFilePath)
+        lastExport = saveFilePath;
+}
 
-    ImGui::SameLine();
-    ImGui::SetNextItemWidth(100.0f);
-    if (ImGui::SliderFloat("Contrast", &contrast, 0.0f, 3.0f, "%.3f"))
-    {
-        MarkDirty();
-    }
+void OutputNode::Record(const string& path, uint64_t hash)
+{
+    if (RecordExport(path, hash, lastRecord) && useSidecar)
+        WriteExportSidecar(lastRecord);
+}
 
-    for (Channel* c : outputs)
-    {
-        ImNodes::BeginOutputAttribute(c->id);
-        ImGui::Indent(200);
-        ImGui::Text(c->name.c_str());
-        ImNodes::EndOutputAttribute();
-    }
+void OutputNode::SetSavePath(const string& path)
+{
+    saveFilePath = path;
+    lastExport = "";
+    size_t dot = path.find_last_of('.');
+    saveFileExt = dot == string::npos ? "" : path.substr(dot);
+    MarkDirty();
+}
 
-    ImNodes::EndNode();
+void OutputNode::SaveParams(ostream& out)
+{
+    out << "path " << saveFilePath << "\n";
+    out << "png_level " << encodeOptions.pngLevel << "\n";
+    out << "png_filter " << encodeOptions.pngFilter << "\n";
+    out << "jpg_quality " << encodeOptions.jpgQuality << "\n";
+    out << "jpg_subsampling " << encodeOptions.jpgSubsampling << "\n";
 }
 
-void BrightnessContrastNode::CreateImNodeProperties()
+void OutputNode::LoadParam(const string& key, istream& value)
 {
-    int width = 0, height = 0;
-    if (outputs[0]->data)
-    {
-        auto buffer = (ImageBuffer*)(outputs[0]->data);
-        width = buffer->width;
-        height = buffer->height;
-    }
-    ImGuiTableFlags flags = ImGuiTableFlags_BordersInnerV;
-    if (ImGui::BeginTable("table3", 2, flags))
-    {
-        ImGui::TableNextColumn();
-        ImGui::Text("Brightness");
-        ImGui::TableNextColumn();
+    if (key == "path")
+        SetSavePath(ReadRestOfLine(value));
+    else if (key == "png_level")
+        value >> encodeOptions.pngLevel;
+    else if (key == "png_filter")
+        value >> encodeOptions.pngFilter;
+    else if (key == "jpg_quality")
+        value >> encodeOptions.jpgQuality;
+    else if (key == "jpg_subsampling")
+        value >> encodeOptions.jpgSubsampling;
+}
 
-        ImGui::PushItemWidth(-FLT_MIN);
-        ImGui::PushID("propBrightness");
-        if (ImGui::SliderFloat("", &brightness, -100.0f, 100.0f, "%.3f"))
-        {
-            MarkDirty();
-        }
-        ImGui::PopID();
-        ImGui::TableNextColumn();
-        ImGui::Text("Contrast");
-        ImGui::TableNextColumn();
-
-        ImGui::PushItemWidth(-FLT_MIN);
-        ImGui::PushID("propContrast");
-        if (ImGui::SliderFloat("", &contrast, 0.0f, 3.0f, "%.3f"))
-        {
-            MarkDirty();
-        }
-        ImGui::PopID();
-        ImGui::TableNextColumn();
-        ImGui::Text("Width");
-        ImGui::TableNextColumn();
-        ImGui::Text("%d", width);
-        ImGui::TableNextColumn();
-        ImGui::Text("Height");
-        ImGui::TableNextColumn();
-        ImGui::Text("%d", height);
-
-        ImGui::EndTable();
-    }
+ImageBuffer* OutputNode::GetImageBuffer()
+{
+    if (!inputs.size() || inputs[0]->data == nullptr)
+        return nullptr;
+
+    return static_cast<ImageBuffer*>(inputs[0]->data);
 }
 
+BrightnessContrastNode::BrightnessContrastNode(int id)
+{
+    this->id = id;
+    this->type = NodeType::BrightnessContrast;
+    inputs.push_back(new Channel(id + 1, "Image", Channel::ChannelType::Input, Channel::ChannelDataType::Image));
+    outputs.push_back(new Channel(id + 2, "Image", Channel::ChannelType::Output, Channel::ChannelDataType::Image));
+};
+
 
 bool BrightnessContrastNode::Evaluate()
 {
     if (!IsDirty()) 
         return false;
 
+    return EvaluateFullFrame();
+}
+
+bool BrightnessContrastNode::PrepareOutputs()
+{
     ImageBuffer* buffer = (ImageBuffer*)inputs[0]->data;
-    if (!buffer) 
+    if (!buffer)
     {
-        Channel* outChannel = outputs[0];
-        if (outChannel->data != nullptr)
-        {
-            if (outChannel->type == Channel::ChannelType::Output && outChannel->dataType == Channel::ChannelDataType::Image)
-                delete (ImageBuffer*)outChannel->data;
-            outChannel->data = nullptr;
-        }
-        MarkClean();
+        ReleaseOutputs();
         return false;
     }
 
-    Channel* outChannel = outputs[0];
-    ImageBuffer* outbuffer = nullptr;
-    bool isNewImageData = false;
-    if (outChannel->data)
-    {
-        outbuffer = (ImageBuffer*)outChannel->data;
-
-        if (outbuffer->width != buffer->width || outbuffer->height != buffer->height)
-        {
-            delete[] outbuffer->imageData;
-            outbuffer->imageData = new unsigned char[buffer->width * buffer->height * 4];
-            outbuffer->width = buffer->width;
-            outbuffer->height = buffer->height;
-        }
-    }
-    else
-    {
-        outbuffer = new ImageBuffer();
-        outbuffer->width = buffer->width;
-        outbuffer->height = buffer->height;
-        outbuffer->imageData = new unsigned char[buffer->width * buffer->height * 4];
-
-        glGenTextures(1, &outbuffer->texture);
-        isNewImageData = true;
-    }
-
-    memcpy(outbuffer->imageData, buffer->imageData, buffer->width * buffer->height * 4);
-
-    auto width = outbuffer->width;
-    auto height = outbuffer->height;
-    auto editedData = outbuffer->imageData;
+    PrepareImageOutput(outputs[0], buffer->width, buffer->height);
+    return true;
+}
 
-    int num_pixels = width * height;
-    for (int i = 0; i < num_pixels; ++i)
+void BrightnessContrastNode::ProcessRegion(const vector<ImageView>& in, const vector<ImageView>& out, const Rect& region)
+{
+    for (int y = region.y0; y < region.y1; ++y)
     {
-        int index = i * 4;  // 4 bytes per pixel (RGBA)
-        for (int c = 0; c < 3; ++c) // R, G, B only
+        const unsigned char* src = in[0].Pixel(region.x0, y);
+        unsigned char* dst = out[0].Pixel(region.x0, y);
+        for (int x = 0; x < region.Width(); ++x)
         {
-            //int value = editedData[index + c] + (int)(brightness * 255.0f);
-            /*if (value < 0 || value > 255)
-                value = abs(value - 0) <= abs(value - 255) ? 0 : 255;*/
-            //editedData[index + c] = (unsigned char)value;
-            
-            float color = (float)editedData[index + c];
-            color += brightness * 2.55f; // 255/100
-            color /= 255.0f;
-            color = (color - 0.5f) * contrast + 0.5f;
-            color *= 255.0f;
-
-            auto color2 = Clamp(color, 0.0f, 255.0f);
-            if (color < 0 || color > 255)
-                color = abs(color - 0.0f) <= abs(color - 255.0f) ? 0.0f : 255.0f;
-
-            assert(color == color2);
-            editedData[index + c] = (unsigned char)color;
+            int index = x * 4;  // 4 bytes per pixel (RGBA)
+            for (int c = 0; c < 3; ++c) // R, G, B only
+            {
+                float color = (float)src[index + c];
+                color += brightness * 2.55f; // 255/100
+                color /= 255.0f;
+                color = (color - 0.5f) * contrast + 0.5f;
+                color *= 255.0f;
+
+                dst[index + c] = (unsigned char)Clamp(color, 0.0f, 255.0f);
+            }
+            dst[index + 3] = src[index + 3];
         }
     }
+}
 
-    if (isNewImageData)
-        UploadTextureToOpenGL(width, height, outbuffer->texture, editedData, false);
-
-    outChannel->data = outbuffer;
+void BrightnessContrastNode::SaveParams(ostream& out)
+{
+    out << "brightness " << brightness << "\n";
+    out << "contrast " << contrast << "\n";
+}
 
-    MarkClean();
-    return true;
+void BrightnessContrastNode::LoadParam(const string& key, istream& value)
+{
+    if (key == "brightness")
+        value >> brightness;
+    else if (key == "contrast")
+        value >> contrast;
 }
 
 ImageBuffer* BrightnessContrastNode::GetImageBuffer()
@@ -637,6 +674,7 @@ ImageBuffer* BrightnessContrastNode::GetImageBuffer()
 ColorChannelSplitterNode::ColorChannelSplitterNode(int id)
 {
     this->id = id;
+    this->type = NodeType::ColourSplitter;
     inputs.push_back(new Channel(id + 1, "Image", Channel::ChannelType::Input, Channel::ChannelDataType::Image));
     outputs.push_back(new Channel(id + 2, "Red", Channel::ChannelType::Output, Channel::ChannelDataType::Image));
     outputs.push_back(new Channel(id + 3, "Green", Channel::ChannelType::Output, Channel::ChannelDataType::Image));
@@ -644,177 +682,85 @@ ColorChannelSplitterNode::ColorChannelSplitterNode(int id)
     outputs.push_back(new Channel(id + 5, "Alpha", Channel::ChannelType::Output, Channel::ChannelDataType::Image));
 }
 
-void ColorChannelSplitterNode::CreateImNode()
+bool ColorChannelSplitterNode::Evaluate()
 {
-    ImNodes::BeginNode(id);
-
-    ImNodes::BeginNodeTitleBar();
-    ImGui::TextUnformatted(GetName().c_str());
-    ImNodes::EndNodeTitleBar();
+    if (!IsDirty())
+        return false;
 
-    for (Channel* c : inputs)
-    {
-        ImNodes::BeginInputAttribute(c->id);
-        ImGui::Text(c->name.c_str());
-        ImNodes::EndInputAttribute();
-    }
+    EvaluateFullFrame();
+    return true;
+}
 
-    for (size_t i = 0; i < outputs.size(); i++)
+bool ColorChannelSplitterNode::PrepareOutputs()
+{
+    ImageBuffer* inputBuffer = (ImageBuffer*)inputs[0]->data;
+    if (!inputBuffer)
     {
-        HelpMarker(
-            "Tick the checkbox for greyscale \n"
-            "representation of the channel.");
-
-        ImGui::SameLine();
-        ImGui::PushID(greyFlagNames[i].c_str());
-        if (ImGui::Checkbox(greyFlagName.c_str(), &greyFlags[i]))
-            MarkDirty();
-        ImGui::PopID();
-
-        ImGui::SameLine();
-        ImNodes::BeginOutputAttribute(outputs[i]->id);
-        ImGui::Indent(10);
-        ImGui::Text(outputs[i]->name.c_str());
-        ImNodes::EndOutputAttribute();
+        ReleaseOutputs();
+        return false;
     }
 
-    ImNodes::EndNode();
+    for (Channel* outChannel : outputs)
+        PrepareImageOutput(outChannel, inputBuffer->width, inputBuffer->height);
+    return true;
 }
 
-void ColorChannelSplitterNode::CreateImNodeProperties()
+void ColorChannelSplitterNode::ProcessRegion(const vector<ImageView>& in, const vector<ImageView>& out, const Rect& region)
 {
-    int width = 0, height = 0;
-    if (outputs[0]->data)
+    for (int y = region.y0; y < region.y1; ++y)
     {
-        auto buffer = (ImageBuffer*)(outputs[0]->data);
-        width = buffer->width;
-        height = buffer->height;
-    }
-    ImGuiTableFlags flags = ImGuiTableFlags_BordersInnerV;
-    if (ImGui::BeginTable("table3", 2, flags))
-    {
-        for (size_t i = 0; i < outputs.size(); i++)
+        const unsigned char* srcData = in[0].Pixel(region.x0, y);
+        unsigned char* redImageData = out[0].Pixel(region.x0, y);
+        unsigned char* greenImageData = out[1].Pixel(region.x0, y);
+        unsigned char* blueImageData = out[2].Pixel(region.x0, y);
+        unsigned char* alphaImageData = out[3].Pixel(region.x0, y);
+
+        // Split channels
+        for (int i = 0; i < region.Width(); i++)
         {
-            ImGui::TableNextColumn();
-            ImGui::Text(greyFlagNames[i].c_str());
-
-            ImGui::TableNextColumn();
-            ImGui::PushID(greyFlagNames[i].c_str());
-            if (ImGui::Checkbox("", &greyFlags[i]))
-                MarkDirty();
-            ImGui::PopID();
+            int index = i * 4;
+
+            unsigned char r = srcData[index + 0];
+            unsigned char g = srcData[index + 1];
+            unsigned char b = srcData[index + 2];
+            unsigned char a = srcData[index + 3];
+
+            // Red channel image (only red, keep alpha)
+            redImageData[index + 0] = r;
+            redImageData[index + 1] = greyFlags[0] ? r : 0;
+            redImageData[index + 2] = greyFlags[0] ? r : 0;
+            redImageData[index + 3] = a;
+
+            // Green channel image (only green, keep alpha)
+            greenImageData[index + 0] = greyFlags[1] ? g : 0;
+            greenImageData[index + 1] = g;
+            greenImageData[index + 2] = greyFlags[1] ? g : 0;
+            greenImageData[index + 3] = a;
+
+            // Blue channel image (only blue, keep alpha)
+            blueImageData[index + 0] = greyFlags[2] ? b : 0;
+            blueImageData[index + 1] = greyFlags[2] ? b : 0;
+            blueImageData[index + 2] = b;
+            blueImageData[index + 3] = a;
+
+            // Blue channel image (only blue, keep alpha)
+            alphaImageData[index + 0] = greyFlags[3] ? a :0;
+            alphaImageData[index + 1] = greyFlags[3] ? a :0;
+            alphaImageData[index + 2] = greyFlags[3] ? a :0;
+            alphaImageData[index + 3] = greyFlags[2] ? a : 255;
         }
-        ImGui::TableNextColumn();
-        ImGui::Text("Width");
-        ImGui::TableNextColumn();
-        ImGui::Text("%d", width);
-        ImGui::TableNextColumn();
-        ImGui::Text("Height");
-        ImGui::TableNextColumn();
-        ImGui::Text("%d", height);
-
-        ImGui::EndTable();
     }
 }
 
-bool ColorChannelSplitterNode::Evaluate()
+void ColorChannelSplitterNode::SaveParams(ostream& out)
 {
-    if (!IsDirty())
-        return false;
-
-    ImageBuffer* inputBuffer = (ImageBuffer*)inputs[0]->data;
-    if (!inputBuffer)
-    {
-        for (Channel* outChannel : outputs)
-        {
-            if (outChannel->data != nullptr)
-            {
-                if (outChannel->dataType == Channel::ChannelDataType::Image)
-                    delete (ImageBuffer*)outChannel->data;
-                outChannel->data = nullptr;
-            }
-        }
-        MarkClean();
-        return true;
-    }
-
-    auto width = inputBuffer->width;
-    auto height = inputBuffer->height;
-    int num_pixels = width * height;
-    unsigned char* srcData = inputBuffer->imageData;
-
-    unsigned char* redImageData = new unsigned char[width * height * 4];
-    unsigned char* greenImageData = new unsigned char[width * height * 4];
-    unsigned char* blueImageData = new unsigned char[width * height * 4];
-    unsigned char* alphaImageData = new unsigned char[width * height * 4];
-
-    // Split channels
-    for (int i = 0; i < num_pixels; i++)
-    {
-        int index = i * 4;
-
-        unsigned char r = srcData[index + 0];
-        unsigned char g = srcData[index + 1];
-        unsigned char b = srcData[index + 2];
-        unsigned char a = srcData[index + 3];
-
-        // Red channel image (only red, keep alpha)
-        redImageData[index + 0] = r;
-        redImageData[index + 1] = greyFlags[0] ? r : 0;
-        redImageData[index + 2] = greyFlags[0] ? r : 0;
-        redImageData[index + 3] = a;
-
-        // Green channel image (only green, keep alpha)
-        greenImageData[index + 0] = greyFlags[1] ? g : 0;
-        greenImageData[index + 1] = g;
-        greenImageData[index + 2] = greyFlags[1] ? g : 0;
-        greenImageData[index + 3] = a;
-
-        // Blue channel image (only blue, keep alpha)
-        blueImageData[index + 0] = greyFlags[2] ? b : 0;
-        blueImageData[index + 1] = greyFlags[2] ? b : 0;
-        blueImageData[index + 2] = b;
-        blueImageData[index + 3] = a;
-
-        // Blue channel image (only blue, keep alpha)
-        alphaImageData[index + 0] = greyFlags[3] ? a :0;
-        alphaImageData[index + 1] = greyFlags[3] ? a :0;
-        alphaImageData[index + 2] = greyFlags[3] ? a :0;
-        alphaImageData[index + 3] = greyFlags[2] ? a : 255;
-    }
-
-    vector<unsigned char*> splitData{ redImageData, greenImageData, blueImageData, alphaImageData };
-
-    for (size_t i = 0; i < outputs.size(); i++)
-    {
-        bool newBuffer = false;
-        ImageBuffer* outbuffer = static_cast<ImageBuffer*>(outputs[i]->data);
-        if (!outbuffer)
-        {
-            outbuffer = new ImageBuffer();
-            outbuffer->width = width;
-            outbuffer->height = height;
-            glGenTextures(1, &outbuffer->texture);
-            outputs[i]->data = outbuffer;
-            newBuffer = true;
-        }
-        else if (outbuffer->width != width || outbuffer->height != height)
-        {
-            delete[] outbuffer->imageData;
-            outbuffer->width = width;
-            outbuffer->height = height;
-        }
-
-        if (outbuffer->imageData)
-            delete[] outbuffer->imageData;
-
-        outbuffer->imageData = splitData[i];
-        if (newBuffer)
-            UploadTextureToOpenGL(width, height, outbuffer->texture, splitData[i], !newBuffer);
-    }
+    out << "grey " << greyFlags[0] << " " << greyFlags[1] << " " << greyFlags[2] << " " << greyFlags[3] << "\n";
+}
 
-    MarkClean();
-    return true;
+void ColorChannelSplitterNode::LoadParam(const string& key, istream& value)
+{
+    if (key == "grey")
+        value >> greyFlags[0] >> greyFlags[1] >> greyFlags[2] >> greyFlags[3];
 }
 
 ImageBuffer* ColorChannelSplitterNode::GetImageBuffer()
@@ -828,172 +774,83 @@ ImageBuffer* ColorChannelSplitterNode::GetImageBuffer()
 BlurNode::BlurNode(int id)
 {
     this->id = id;
+    this->type = NodeType::Blur;
     inputs.push_back(new Channel(id + 1, "Image", Channel::ChannelType::Input, Channel::ChannelDataType::Image));
     outputs.push_back(new Channel(id + 2, "Blurred", Channel::ChannelType::Output, Channel::ChannelDataType::Image));
 }
 
-void BlurNode::CreateImNode()
-{
-    ImNodes::BeginNode(id);
-    ImNodes::BeginNodeTitleBar();
-    ImGui::TextUnformatted(GetName().c_str());
-    ImNodes::EndNodeTitleBar();
-
-    for (Channel* c : inputs)
-    {
-        ImNodes::BeginInputAttribute(c->id);
-        ImGui::Text(c->name.c_str());
-        ImNodes::EndInputAttribute();
-    }
-
-    int currentMode = static_cast<int>(direction);
-    const char* modes[] = { "Uniform", "Horizontal", "Vertical" };
-    ImGui::SetNextItemWidth(100.0f);
-    if (ImGui::Combo("Direction", &currentMode, modes, IM_ARRAYSIZE(modes)))
-    {
-        direction = static_cast<BlurDirection>(currentMode);
-        MarkDirty();
-    }
-
-    HelpMarker("Click to reset the Blur Radius");
-
-    ImGui::SameLine();
-    ImGui::PushID("Reset Blur Radius");
-    if (ImGui::Button(".."))
-    {
-        if (blurRadius != 0.0f)
-        {
-            blurRadius = 0.0f;
-            MarkDirty();
-        }
-    }
-    ImGui::PopID();
-
-    ImGui::SameLine();
-    ImGui::SetNextItemWidth(100.0f);
-    if (ImGui::SliderInt("Blur Radius", &blurSliderValue, 0, 20))
-    {
-        blurRadius = blurSliderValue;
-        blurRadiusChanged = true;
-        MarkDirty();
-    }
-
-    for (Channel* c : outputs)
-    {
-        ImNodes::BeginOutputAttribute(c->id);
-        ImGui::Indent(150);
-        ImGui::Text(c->name.c_str());
-        ImNodes::EndOutputAttribute();
-    }
-
-    ImNodes::EndNode();
-}
-
-void BlurNode::CreateImNodeProperties()
-{
-    int width = 0, height = 0;
-    if (outputs[0]->data)
-    {
-        auto buffer = (ImageBuffer*)(outputs[0]->data);
-        width = buffer->width;
-        height = buffer->height;
-    }
-    ImGuiTableFlags flags = ImGuiTableFlags_BordersInnerV;
-    if (ImGui::BeginTable("table3", 2, flags))
-    {
-        ImGui::TableNextColumn();
-        ImGui::Text("Blur Radius");
-        ImGui::TableNextColumn();
-
-        ImGui::PushItemWidth(-FLT_MIN);
-        ImGui::PushID("propBlurRadius");
-        if (ImGui::SliderInt("", &blurSliderValue, 0, 20))
-        {
-            blurRadius = blurSliderValue;
-            blurRadiusChanged = true;
-            MarkDirty();
-        }
-        ImGui::PopID();
-        ImGui::TableNextColumn();
-        ImGui::Text("Width");
-        ImGui::TableNextColumn();
-        ImGui::Text("%d", width);
-        ImGui::TableNextColumn();
-        ImGui::Text("Height");
-        ImGui::TableNextColumn();
-        ImGui::Text("%d", height);
-
-        ImGui::EndTable();
-    }
-}
-
 bool BlurNode::Evaluate()
 {
     if (!IsDirty())
         return false;
 
+    EvaluateFullFrame();
+    return true;
+}
+
+bool BlurNode::PrepareOutputs()
+{
     ImageBuffer* inputBuffer = (ImageBuffer*)inputs[0]->data;
     if (!inputBuffer)
     {
-        for (Channel* outChannel : outputs)
-        {
-            if (outChannel->data != nullptr)
-            {
-                if (outChannel->dataType == Channel::ChannelDataType::Image)
-                    delete (ImageBuffer*)outChannel->data;
-                outChannel->data = nullptr;
-            }
-        }
-        MarkClean();
-        return true;
+        ReleaseOutputs();
+        return false;
     }
 
-    int width = inputBuffer->width;
-    int height = inputBuffer->height;
-
-    bool newBuffer = false;
-    ImageBuffer* outbuffer = static_cast<ImageBuffer*>(outputs[0]->data);
-    if (!outbuffer)
-    {
-        outbuffer = new ImageBuffer();
-        outbuffer->width = width;
-        outbuffer->height = height;
-        glGenTextures(1, &outbuffer->texture);
-        outputs[0]->data = outbuffer;
-        newBuffer = true;
-    }
-    else if (outbuffer->width != width || outbuffer->height != height)
+    // Regions are blurred concurrently, so the kernel is rebuilt here rather than lazily.
+    // The radius is in full resolution pixels and shrinks with the proxy level.
+    if (ProxyRadius() != kernelRadius)
     {
-        delete[] outbuffer->imageData;
-        outbuffer->width = width;
-        outbuffer->height = height;
+        kernelRadius = ProxyRadius();
+        if (kernelRadius > 0)
+            gaussianKernel = GenerateGaussianKernel(kernelRadius);
     }
 
-    if (!outbuffer->imageData)
-        outbuffer->imageData = new unsigned char[width * height * 4];
+    PrepareImageOutput(outputs[0], inputBuffer->width, inputBuffer->height);
+    return true;
+}
 
-    unsigned char* blurImageData = outbuffer->imageData;
-    if (blurRadius == 0)
+void BlurNode::ProcessRegion(const vector<ImageView>& in, const vector<ImageView>& out, const Rect& region)
+{
+    if (kernelRadius == 0)
     {
-		memcpy(blurImageData, inputBuffer->imageData, width * height * 4);
+        CopyRegion(in[0], out[0], region);
     }
     else if (direction == BlurDirection::Uniform) {
-        vector<unsigned char> tempVec(width * height * 4);
-        unsigned char* temp = tempVec.data();
-        ApplyGaussianBlur(inputBuffer->imageData, temp, width, height, true);  // H
-        ApplyGaussianBlur(temp, blurImageData, width, height, false); // V
+        // The horizontal pass has to cover the rows the vertical pass samples
+        Rect tempRect = Rect(region.x0, region.y0 - kernelRadius, region.x1, region.y1 + kernelRadius).Intersect(in[0].rect);
+        thread_local vector<unsigned char> tempVec;
+        tempVec.resize((size_t)tempRect.Width() * tempRect.Height() * 4);
+        ImageView temp{ tempVec.data(), tempRect, tempRect.Width() * 4, in[0].imageWidth, in[0].imageHeight };
+        ApplyGaussianBlur(in[0], temp, tempRect, true);  // H
+        ApplyGaussianBlur(temp, out[0], region, false); // V
     }
     else 
     {
         bool horiz = direction == BlurDirection::Horizontal;
-        ApplyGaussianBlur(inputBuffer->imageData, blurImageData, width, height, horiz);  // H
+        ApplyGaussianBlur(in[0], out[0], region, horiz);  // H
     }
+}
 
-    if (newBuffer)
-        UploadTextureToOpenGL(width, height, outbuffer->texture, blurImageData, !newBuffer);
+void BlurNode::SaveParams(ostream& out)
+{
+    out << "direction " << static_cast<int>(direction) << "\n";
+    out << "radius " << blurRadius << "\n";
+}
 
-    MarkClean();
-    return true;
+void BlurNode::LoadParam(const string& key, istream& value)
+{
+    if (key == "direction")
+    {
+        int mode = 0;
+        value >> mode;
+        direction = static_cast<BlurDirection>(Clamp(mode, 0, 2));
+    }
+    else if (key == "radius")
+    {
+        value >> blurRadius;
+        blurSliderValue = blurRadius;
+    }
 }
 
 ImageBuffer* BlurNode::GetImageBuffer()
@@ -1024,42 +881,37 @@ vector<float> BlurNode::GenerateGaussianKernel(int radius)
 }
 
 void BlurNode::ApplyGaussianBlur(
-    const unsigned char* input,
-    unsigned char* output,
-    int width,
-    int height,
+    const ImageView& input,
+    const ImageView& output,
+    const Rect& region,
     bool horizontal)
 {
-    if (blurRadiusChanged) 
-    {
-        gaussianKernel = GenerateGaussianKernel(blurRadius);
-		blurRadiusChanged = false;
-    }
-
     std::vector<float>& kernel = gaussianKernel;
-    int kernelSize = static_cast<int>(kernel.size());
+    int radius = kernelRadius;
+    int width = input.imageWidth;
+    int height = input.imageHeight;
 
-    for (int y = 0; y < height; ++y)
+    for (int y = region.y0; y < region.y1; ++y)
     {
-        for (int x = 0; x < width; ++x)
+        for (int x = region.x0; x < region.x1; ++x)
         {
             float sum[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
 
-            for (int i = -blurRadius; i <= blurRadius; ++i)
+            for (int i = -radius; i <= radius; ++i)
             {
                 int sampleX = horizontal ? Clamp(x + i, 0, width - 1) : x;
                 int sampleY = horizontal ? y : Clamp(y + i, 0, height - 1);
 
-                int sampleIndex = (sampleY * width + sampleX) * 4;
-                float weight = kernel[i + blurRadius];
+                const unsigned char* sample = input.Pixel(sampleX, sampleY);
+                float weight = kernel[i + radius];
 
                 for (int c = 0; c < 4; ++c)
-                    sum[c] += weight * input[sampleIndex + c];
+                    sum[c] += weight * sample[c];
             }
 
-            int outIndex = (y * width + x) * 4;
+            unsigned char* outPixel = output.Pixel(x, y);
             for (int c = 0; c < 4; ++c)
-                output[outIndex + c] = static_cast<unsigned char>(Clamp(sum[c], 0.0f, 255.0f));
+                outPixel[c] = static_cast<unsigned char>(Clamp(sum[c], 0.0f, 255.0f));
         }
     }
 }
@@ -1071,78 +923,6 @@ ThresholdNode::ThresholdNode(int id)
     outputs.push_back(new Channel(id + 2, "Image", Channel::ChannelType::Output, Channel::ChannelDataType::Image));
 }
 
-void ThresholdNode::CreateImNode()
-{
-    ImNodes::BeginNode(id);
-    ImNodes::BeginNodeTitleBar();
-    ImGui::TextUnformatted(GetName().c_str());
-    ImNodes::EndNodeTitleBar();
-
-    for (Channel* c : inputs)
-    {
-        ImNodes::BeginInputAttribute(c->id);
-        ImGui::Text(c->name.c_str());
-        ImNodes::EndInputAttribute();
-    }
-
-    int currentMethod = static_cast<int>(thresholdMethod);
-    const char* methods[] = { "Binary", "Adaptive", "Otsu" };
-    ImGui::SetNextItemWidth(100.0f);
-    if (ImGui::Combo("Method", &currentMethod, methods, IM_ARRAYSIZE(methods)))
-    {
-        thresholdMethod = static_cast<ThresholdMethod>(currentMethod);
-        MarkDirty();
-    }
-
-    HelpMarker("Click to reset the Threshold");
-
-    ImGui::SameLine();
-    ImGui::PushID("Reset Threshold");
-    if (ImGui::Button(".."))
-    {
-        thresholdValue = 128;
-        if (thresholdValue != 128)
-        {
-            thresholdValue = 128;
-            MarkDirty();
-        }
-    }
-    ImGui::PopID();
-
-    ImGui::SameLine();
-    ImGui::SetNextItemWidth(100.0f);
-    if (ImGui::SliderInt("Threshold", &thresholdValue, 0, 256))
-    {
-        MarkDirty();
-    }
-
-    for (Channel* c : outputs)
-    {
-        ImNodes::BeginOutputAttribute(c->id);
-        ImGui::Indent(150);
-        ImGui::Text(c->name.c_str());
-        ImNodes::EndOutputAttribute();
-    }
-
-    float histogram[256];
-    float maxValue = 0;
-    if (outputs[0]->data)
-    {
-        ImageBuffer* buffer = ((ImageBuffer*)outputs[0]->data);
-        ComputeHistogram(buffer->imageData, buffer->width, buffer->height, histogram, maxValue);
-    }
-    ImGui::Text("Histogram");
-    ImGui::PushID("Threshold Histogram");
-    ImGui::SetNextItemWidth(200.0f);
-    ImGui::PlotHistogram("", histogram, 256, 0, nullptr, 0.0f, maxValue, ImVec2(0, 80.0f));
-    ImGui::PopID();
-    ImNodes::EndNode();
-}
-
-void ThresholdNode::CreateImNodeProperties()
-{
-}
-
 bool ThresholdNode::Evaluate()
 {
     if (!IsDirty())
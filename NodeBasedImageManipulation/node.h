@@ -3,9 +3,14 @@
 #include <vector>
 #include <unordered_set>
 #include <string>
-#include "imnodes.h"
-#include <GLFW/glfw3.h> // Will drag system OpenGL headers
+#include <iostream>
 #include "ImageBuffer.h"
+#include "PerfCounters.h"
+#include "AllocationCounter.h"
+#include "ImageCache.h"
+#include "NodeUtils.h"
+#include "ExportQueue.h"
+#include "ExportHash.h"
 
 using namespace std;
 
@@ -57,6 +62,54 @@ struct Channel {
 	}
 };
 
+// What a node's evaluations cost, filled in by Graph::Evaluate. Byte counts are pixel
+// data: read from the inputs (halos included) and written to the outputs.
+struct NodeStats
+{
+	int evaluations = 0;
+	// Last evaluation
+	double wallMs = 0, cpuMs = 0;
+	size_t bytesAllocated = 0, bytesRead = 0, bytesWritten = 0;
+	// Since the last reset
+	double totalWallMs = 0, totalCpuMs = 0;
+	size_t totalBytesAllocated = 0, totalBytesRead = 0, totalBytesWritten = 0;
+	// Hardware counters of the last evaluation and since the last reset, all 0 unless
+	// PerfCounters are enabled
+	PerfCounts perf, totalPerf;
+	// Heap allocations (operator new and pixel buffers) of the last evaluation and since
+	// the last reset
+	AllocationCounts heap, totalHeap;
+
+	// Whether the node editor draws the numbers inside each node
+	static inline bool showOverlay = true;
+
+	void Record(double wall, double cpu, size_t allocated, size_t read, size_t written)
+	{
+		evaluations++;
+		wallMs = wall;
+		cpuMs = cpu;
+		bytesAllocated = allocated;
+		bytesRead = read;
+		bytesWritten = written;
+		totalWallMs += wall;
+		totalCpuMs += cpu;
+		totalBytesAllocated += allocated;
+		totalBytesRead += read;
+		totalBytesWritten += written;
+	}
+	void RecordPerf(const PerfCounts& counts)
+	{
+		perf = counts;
+		totalPerf += counts;
+	}
+	void RecordHeap(const AllocationCounts& counts)
+	{
+		heap = counts;
+		totalHeap += counts;
+	}
+	void Reset() { *this = NodeStats(); }
+};
+
 enum class NodeType
 {
 	Input, 
@@ -74,6 +127,14 @@ public:
 	NodeType type;
 	vector<Channel*> inputs;
 	vector<Channel*> outputs;
+	// Grid position on the editor canvas, kept so saved graphs reopen the same way
+	float posX = 0.0f, posY = 0.0f;
+	bool positionPending = false;
+	NodeStats stats;
+
+	// Draws a node's output as a thumbnail inside it. Set by the application, which owns
+	// the textures; the editor itself stays free of GL. Null draws none.
+	static inline void (*drawThumbnail)(unsigned int nodeId, const ImageBuffer* image) = nullptr;
 
 	virtual ~Node();
 	virtual string GetName() = 0;
@@ -82,38 +143,153 @@ public:
 	virtual bool Evaluate() = 0;
 	virtual ImageBuffer* GetImageBuffer() = 0;
 
+	// Tiled evaluation. A tileable node computes any rectangle of its outputs from the
+	// same rectangle of its inputs grown by GetFootprint() pixels on every side.
+	virtual bool SupportsTiling() { return false; }
+	virtual int GetFootprint() { return 0; }
+	// Sizes the output buffers from the inputs. Returns false (after releasing the
+	// outputs) when there is nothing to compute. Called on the main thread.
+	virtual bool PrepareOutputs() { return false; }
+	// Writes the given region of every output view. Called concurrently for different regions.
+	virtual void ProcessRegion(const vector<ImageView>&, const vector<ImageView>&, const Rect&) {}
+	// Publishes the freshly written outputs. Called on the main thread.
+	virtual void FinishOutputs();
+	// True when the next evaluation needs whole images from upstream no matter what the
+	// preview shows, e.g. an export.
+	virtual bool WantsFullFrame() { return false; }
+	// Called by Graph::Evaluate before anything else, nodes waiting on work done elsewhere
+	// mark themselves dirty here once it is done
+	virtual void Poll() {}
+	// Finest proxy level the node has anything for right now, the graph evaluates at this
+	// level or a coarser one. Inputs with only a reduced decode of their file raise it.
+	virtual int GetProxyFloor() { return 0; }
+
+	// Saved graphs store a node's parameters as one "key value" line each
+	virtual void SaveParams(ostream&) {}
+	virtual void LoadParam(const string&, istream&) {}
+
 	void MarkDirty();
 	void MarkClean() { dirty = false; }
 	bool IsDirty() { return dirty; }
+	// Set by the graph while it evaluates on 1 / (1 << shift) scale proxies of the inputs
+	void SetProxyShift(int shift) { proxyShift = shift; }
+	// Outputs of at least this many pixels are kept out of core (0 = never)
+	void SetOutOfCoreThreshold(size_t pixels) { outOfCorePixels = pixels; }
+	// Heap bytes the node allocated for images since the last call
+	size_t TakeAllocatedBytes() { size_t bytes = allocatedBytes; allocatedBytes = 0; return bytes; }
+
+protected:
+	int proxyShift = 0;
+	size_t outOfCorePixels = 0;
+	size_t allocatedBytes = 0;
+
+	bool WantsOutOfCore(int width, int height) { return outOfCorePixels && (size_t)width * height >= outOfCorePixels; }
+
+	bool EvaluateFullFrame();
+	ImageBuffer* PrepareImageOutput(Channel* channel, int width, int height);
+	void ReleaseOutputs();
+	// Profiler numbers at the bottom of the node, see NodeStats
+	void ShowStatsOverlay();
+	// What GetImageBuffer() holds, through drawThumbnail
+	void ShowThumbnail();
 };
 
+const char* GetNodeTypeName(NodeType type);
+bool GetNodeTypeFromName(const string& name, NodeType& type);
+Node* CreateNode(NodeType type, int id);
+
 class InputNode : public Node
 {
 	string filePath = "";
+	string loadedPath = "";
+	// The path the decodes in flight or done are of
+	string requestedPath = "";
 	string fileExt = "nil";
-	ImageBuffer* data = nullptr;
+	// The decoded file, shared through ImageCache with other nodes that opened it
+	std::shared_ptr<ImageBuffer> data;
+	ImageBuffer* proxies[4] = { nullptr, nullptr, nullptr, nullptr };
+	// A reduced size decode of a large JPEG, standing in until data is there
+	std::shared_ptr<ImageBuffer> reduced;
+	// Decodes of filePath still in progress
+	std::shared_ptr<ImageCache::Entry> pending;
+	std::shared_ptr<ImageCache::Entry> pendingReduced;
 public:
+	// Decode on ImageCache's I/O threads instead of inside Evaluate. The node shows as
+	// loading meanwhile and marks itself dirty from Poll() when the image is in. Large
+	// JPEGs are decoded at a fraction of their size first, and the full decode is only
+	// started once that stand-in is in use.
+	static inline bool loadInBackground = false;
+
 	InputNode(int id);
+	~InputNode();
 	void CreateImNode() override;
 	void CreateImNodeProperties() override;
 	bool Evaluate() override;
 	string GetName() override { return "Input"; }
 	ImageBuffer* GetImageBuffer() override;
+	void Poll() override;
+	int GetProxyFloor() override;
+	void SaveParams(ostream& out) override;
+	void LoadParam(const string& key, istream& value) override;
+
+	void SetFilePath(const string& path) { filePath = path; MarkDirty(); }
+	// Decodes the file again on the next Evaluate even if the path did not change
+	void Reload() { requestedPath = ""; MarkDirty(); }
+	// Hands over an image decoded elsewhere as the contents of path, the node takes ownership
+	void SetImage(const string& path, ImageBuffer* image);
+	const string& GetLoadedPath() { return loadedPath; }
+	bool IsLoading() { return pending != nullptr || pendingReduced != nullptr; }
+private:
+	ImageBuffer* GetProxy(int shift);
+	void ReleaseProxies();
+	void ReleaseImages();
 };
 
 class OutputNode : public Node
 {
 	string saveFilePath = "";
 	string saveFileExt = "";
-	const char* availableExt[3] = { ".png", ".jpg", ".bmp" };
+	const char* availableExt[4] = { ".png", ".jpg", ".bmp", ".qoi" };
 	int selectedExt = 0;
+	EncodeOptions encodeOptions;
+	// The last export handed to ExportQueue, kept after it finishes for its outcome
+	std::shared_ptr<ExportQueue::Job> exporting;
+	uint64_t exportingHash = 0; // recorded once it is done, 0 after that
+	// What the last export wrote, an identical export is not written again while the
+	// file is still as it was left
+	ExportRecord lastRecord;
+	bool useSidecar = false;
+	bool skippedLast = false;
+	size_t skippedExports = 0;
+	void Record(const string& path, uint64_t hash);
 public:
+	// Queue exports on ExportQueue's writer threads instead of writing them inside
+	// Evaluate. Poll() picks up the outcome.
+	static inline bool exportInBackground = false;
+
 	OutputNode(int id);
 	void CreateImNode() override;
 	void CreateImNodeProperties() override;
 	bool Evaluate() override;
 	string GetName() override { return "Output"; }
 	ImageBuffer* GetImageBuffer() override;
+	bool WantsFullFrame() override { return IsDirty() && !saveFilePath.empty() && proxyShift == 0; }
+	void Poll() override;
+	void SaveParams(ostream& out) override;
+	void LoadParam(const string& key, istream& value) override;
+
+	void SetSavePath(const string& path);
+	const string& GetSaveExt() { return saveFileExt; }
+	const EncodeOptions& GetEncodeOptions() { return encodeOptions; }
+	// Also keep the record of each export in a sidecar next to the file (see ExportHash.h),
+	// so unchanged exports are skipped across runs too
+	void SetUseSidecar(bool use) { useSidecar = use; }
+	// Exports skipped because the file already held the same image
+	size_t GetSkippedExports() { return skippedExports; }
+	// Path of the last file this node wrote successfully
+	const string& GetLastExport() { return lastExport; }
+private:
+	string lastExport = "";
 };
 
 class BrightnessContrastNode : public Node
@@ -127,6 +303,12 @@ public:
 	bool Evaluate() override;
 	string GetName() override { return "Brightness & Contrast"; }
 	ImageBuffer* GetImageBuffer() override;
+	void SaveParams(ostream& out) override;
+	void LoadParam(const string& key, istream& value) override;
+
+	bool SupportsTiling() override { return true; }
+	bool PrepareOutputs() override;
+	void ProcessRegion(const vector<ImageView>& in, const vector<ImageView>& out, const Rect& region) override;
 };
 
 class ColorChannelSplitterNode : public Node
@@ -141,6 +323,12 @@ public:
 	bool Evaluate() override;
 	string GetName() override { return "Color Splitter"; }
 	ImageBuffer* GetImageBuffer() override;
+	void SaveParams(ostream& out) override;
+	void LoadParam(const string& key, istream& value) override;
+
+	bool SupportsTiling() override { return true; }
+	bool PrepareOutputs() override;
+	void ProcessRegion(const vector<ImageView>& in, const vector<ImageView>& out, const Rect& region) override;
 };
 
 class BlurNode : public Node
@@ -149,7 +337,7 @@ class BlurNode : public Node
 	BlurDirection direction = BlurDirection::Uniform;
 	int blurSliderValue = 0;
 	int blurRadius = 0;
-	bool blurRadiusChanged = false;
+	int kernelRadius = -1; // blurRadius scaled to the proxy level gaussianKernel was built for
 	vector<float> gaussianKernel;
 public:
 	BlurNode(int id);
@@ -158,9 +346,17 @@ public:
 	bool Evaluate() override;
 	string GetName() override { return "Blur"; }
 	ImageBuffer* GetImageBuffer() override;
+	void SaveParams(ostream& out) override;
+	void LoadParam(const string& key, istream& value) override;
+
+	bool SupportsTiling() override { return true; }
+	int GetFootprint() override { return ProxyRadius(); }
+	bool PrepareOutputs() override;
+	void ProcessRegion(const vector<ImageView>& in, const vector<ImageView>& out, const Rect& region) override;
 private:
+	int ProxyRadius() { return (blurRadius + (1 << proxyShift) / 2) >> proxyShift; }
 	vector<float> GenerateGaussianKernel(int radius);
-	void ApplyGaussianBlur(const unsigned char* input, unsigned char* output, int width, int height, bool horizontal);
+	void ApplyGaussianBlur(const ImageView& input, const ImageView& output, const Rect& region, bool horizontal);
 };
 
 class ThresholdNode : public Node
@@ -175,9 +371,10 @@ public:
 	bool Evaluate() override;
 	string GetName() override { return "Blur"; }
 	ImageBuffer* GetImageBuffer() override;
-private:
-	void ComputeHistogram(const unsigned char* imgData, int width, int height, float* histogram, float& maxValue);
-	int ComputeOtsuThreshold(const unsigned char* hist, int width, int height);
+
+	// Kernels, public so the benchmarks can time them on their own
+	static void ComputeHistogram(const unsigned char* imgData, int width, int height, float* histogram, float& maxValue);
+	static int ComputeOtsuThreshold(const unsigned char* hist, int width, int height);
 };
 
 